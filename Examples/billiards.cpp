@@ -2,6 +2,9 @@
 #include <iostream>
 #include <vector>
 #include <random>
+#include <cmath>
+#include <string>
+#include <algorithm>
 
 #include <GL/glew.h>
 #include <GL/gl.h>
@@ -108,7 +111,9 @@ class CAnimator
 
 CScene*gl_scene_ptr=nullptr;
 
-int main()
+// ./billiards [balls]: the first ball is the geometry, the others are its instances,
+// the scene draws all of them by one instanced draw call
+int main(int argc,char**argv)
 {
     using point_t=Eigen::Vector3f;
     auto window=MakeWindow();
@@ -117,25 +122,29 @@ int main()
     gl_scene_ptr=&glScene;
 
     const float rad=1;
-    CFunctionalMesh fmesh_sphere[4],fmesh_plane;
-    CAnimator anim(rad,{-5,5},{-5,5});
+    const int   balls=argc>1? std::max(1,std::stoi(argv[1])):4;
+    const int   row=int(std::ceil(std::sqrt(float(balls))));
+    const float side=std::max(10.0f,2.5f*rad*row);
+    std::vector<CFunctionalMesh> fmesh_sphere(balls);
+    CFunctionalMesh fmesh_plane;
+    CAnimator anim(rad,{-side/2,side/2},{-side/2,side/2});
     CRenderingTraits rt;
     rt.SetMesh(false).SetSurface(true).SetSpecular(true).SetColored(true).SetBox(false);
-    fmesh_plane.SetPlane(10,10).SetTraits(rt).SetUniformColor({0,1,1});
+    fmesh_plane.SetPlane(side,side).SetTraits(rt).SetUniformColor({0,1,1});
 
-    for(auto&ball:fmesh_sphere)
+    fmesh_sphere[0].SetSphere(rad,30,30).SetTraits(rt);
+    for(int i=0;i<balls;++i)
     {
-        ball.SetSphere(rad,30,30).SetTraits(rt);
+        auto&ball=fmesh_sphere[i];
+        if(i) ball.SetSharedGeometry(&fmesh_sphere[0]);
+        // the material of each instance
+        ball.SetShininess(2.0f+i%8*4.0f);
         glScene.AddMesh(ball);
+        const float step=side/row;
+        anim.AddBall(ball,-side/2+step*(i%row+0.5f),-side/2+step*(i/row+0.5f));
     }
 
 
-    anim.AddBall(fmesh_sphere[0],-1,-1)
-        .AddBall(fmesh_sphere[1],1,-1)
-        .AddBall(fmesh_sphere[2],-1,1)
-        .AddBall(fmesh_sphere[3],1,1);
-
-
     glScene.AddMesh(fmesh_plane);
     glScene.LightSource().SetPosition({0,0,4});
 
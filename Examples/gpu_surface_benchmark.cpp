@@ -0,0 +1,238 @@
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include "offscreen_gl.h"
+#include "../grid_indices.h"
+#include "../Expression/function_pool.h"
+#include "../Shaders/shaders_source.h"
+
+// Dynamic cartesian surface of the function pool, as CScene draws it:
+// the points and the normals are evaluated by the expression on CPU and
+// uploaded for every frame, against the GLSL of the same expression in the
+// vertex shader (CFunctionalMesh::SetGpuSurface), which needs the uniforms
+// only. The positions of the vertex shader are captured by transform
+// feedback and compared with CPU evaluation first.
+// Uses surfaceless EGL of Mesa, so without GPU it runs on llvmpipe.
+// Doesn't require Qt, build with grid_indices.cpp and function_pool.cpp only:
+//
+//   g++ -std=c++20 -O2 gpu_surface_benchmark.cpp ../grid_indices.cpp ../Expression/function_pool.cpp -lEGL -lGL
+//   ./a.out [vertices per side] [frames]
+
+namespace{
+
+const float min_xy=-3.0f,max_xy=3.0f;
+
+// 'capture' - gl_Position is written into the transform feedback buffer
+GLuint link(const std::string&vertex,bool capture=false)
+{
+    GLuint program=offscreen::link(vertex,fragment_shader,capture? "gl_Position":nullptr);
+    // light source and camera of CScene::m_WriteFrameBlock
+    glUniformBlockBinding(program,glGetUniformBlockIndex(program,"frame_block"),0);
+    return program;
+}
+
+void init_frame_block()
+{
+    // position, ambient, diffuse, specular of the light and the camera
+    const float block[20]={0,0,10,0, 0.2f,0.2f,0.2f,0, 0.7f,0.7f,0.7f,0, 0.5f,0.5f,0.5f,0, 0,0,10,0};
+    GLuint ubo;
+    glGenBuffers(1,&ubo);
+    glBindBuffer(GL_UNIFORM_BUFFER,ubo);
+    glBufferData(GL_UNIFORM_BUFFER,sizeof(block),block,GL_STATIC_DRAW);
+    glBindBufferBase(GL_UNIFORM_BUFFER,0,ubo);
+}
+
+// the uniforms, which are equal for both programs
+void set_uniforms(GLuint program,const float*full_matrix)
+{
+    const float identity[16]={1,0,0,0, 0,1,0,0, 0,0,1,0, 0,0,0,1};
+    const float identity3[9]={1,0,0, 0,1,0, 0,0,1};
+    glUseProgram(program);
+    glUniformMatrix4fv(glGetUniformLocation(program,"full_matrix"),1,GL_FALSE,full_matrix);
+    glUniformMatrix4fv(glGetUniformLocation(program,"model_matrix4"),1,GL_FALSE,identity);
+    glUniformMatrix3fv(glGetUniformLocation(program,"model_matrix3"),1,GL_FALSE,identity3);
+    glUniform1f(glGetUniformLocation(program,"material.ambient"),1.0f);
+    glUniform1f(glGetUniformLocation(program,"material.diffuse"),1.0f);
+    glUniform1f(glGetUniformLocation(program,"material.specular"),1.0f);
+    glUniform1f(glGetUniformLocation(program,"material.shininess"),5.0f);
+    glUniform1i(glGetUniformLocation(program,"two_side_specular"),1);
+}
+
+// points and normals of the grid, as CFunctionalMesh computes them
+template<class function_t>
+void evaluate(const function_t&f,int side,float time,std::vector<float>&points,std::vector<float>&normals)
+{
+    const float delta=(max_xy-min_xy)/(side-1);
+    points.resize(3*side*side);
+    normals.resize(points.size());
+    auto z=[&](int i,int j){return points[3*(i+j*side)+2];};
+    for(int j=0;j<side;++j)
+    {
+        for(int i=0;i<side;++i)
+        {
+            const float x=min_xy+i*delta,y=min_xy+j*delta;
+            float*p=&points[3*(i+j*side)];
+            p[0]=x;p[1]=y;p[2]=f(x,y,time);
+        }
+    }
+    for(int j=0;j<side;++j)
+    {
+        for(int i=0;i<side;++i)
+        {
+            const int i0=std::max(i-1,0),i1=std::min(i+1,side-1);
+            const int j0=std::max(j-1,0),j1=std::min(j+1,side-1);
+            const float dx=(z(i1,j)-z(i0,j))/((i1-i0)*delta);
+            const float dy=(z(i,j1)-z(i,j0))/((j1-j0)*delta);
+            const float len=std::sqrt(dx*dx+dy*dy+1);
+            float*n=&normals[3*(i+j*side)];
+            n[0]=-dx/len;n[1]=-dy/len;n[2]=1/len;
+        }
+    }
+}
+
+}
+
+int main(int argc,char**argv)
+{
+    const int side=argc>1? std::stoi(argv[1]):257;
+    const int frames=argc>2? std::stoi(argv[2]):20;
+    if(!offscreen::init_context())
+    {
+        std::cerr<<"Surfaceless EGL context isn't created\n";
+        return 1;
+    }
+
+    CFunctionPool pool;
+    pool.CreateAndRegisterFunction("wave",{"r","time"},"sin(5*r-2*time)/(1+r)");
+    const std::string text="0.5*sin(2*x+time)*cos(3*y)+wave(sqrt(x*x+y*y),time)";
+    auto f=pool.CreateFunction({"x","y","time"},text);
+    auto glsl=pool.GlslSource(f,"surface_function");
+    if(!f||!glsl)
+    {
+        std::cerr<<"The function isn't translated into GLSL\n";
+        return 1;
+    }
+    std::cout<<"Renderer: "<<glGetString(GL_RENDERER)<<'\n'
+             <<"z(x,y,time)="<<text<<", grid "<<side<<'x'<<side<<", "<<frames<<" frames\n";
+    offscreen::init_framebuffer(128);
+    init_frame_block();
+
+    const std::string surface="#version 330 core\n"+*glsl+
+                              "vec3 surface(float s,float t,float time)\n{\n"
+                              "    return vec3(s,t,surface_function(s,t,time));\n}\n"+gpu_surface_shader;
+    const GLuint cpu_program=link(specular_shader);
+    const GLuint gpu_program=link(surface);
+    const GLuint capture_program=link(surface,true);
+    auto set_grid=[side](GLuint program,float time)
+    {
+        glUniform2f(glGetUniformLocation(program,"s_range"),min_xy,max_xy);
+        glUniform2f(glGetUniformLocation(program,"t_range"),min_xy,max_xy);
+        glUniform2i(glGetUniformLocation(program,"resolution"),side-1,side-1);
+        glUniform1f(glGetUniformLocation(program,"time"),time);
+        glUniform1i(glGetUniformLocation(program,"specular"),1);
+    };
+
+    const int vertices=side*side;
+    std::vector<float> points,normals;
+    GLuint vao,buffers[2];
+    glGenVertexArrays(1,&vao);
+    glBindVertexArray(vao);
+    glGenBuffers(2,buffers);
+    for(GLuint i=0;i<2;++i)
+    {
+        glBindBuffer(GL_ARRAY_BUFFER,buffers[i]);
+        glBufferData(GL_ARRAY_BUFFER,3*vertices*sizeof(float),nullptr,GL_STREAM_DRAW);
+        glVertexAttribPointer(2*i,3,GL_FLOAT,GL_FALSE,0,nullptr);
+        glEnableVertexAttribArray(2*i);
+    }
+    std::vector<unsigned> indices;
+    MakeTriansIndexes(side,side,indices);
+    GLuint ibo;
+    glGenBuffers(1,&ibo);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER,ibo);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER,indices.size()*sizeof(unsigned),indices.data(),GL_STATIC_DRAW);
+
+    // positions of the vertex shader against the interpreter
+    const float identity[16]={1,0,0,0, 0,1,0,0, 0,0,1,0, 0,0,0,1};
+    {
+        GLuint feedback;
+        glGenBuffers(1,&feedback);
+        glBindBuffer(GL_TRANSFORM_FEEDBACK_BUFFER,feedback);
+        glBufferData(GL_TRANSFORM_FEEDBACK_BUFFER,4*vertices*sizeof(float),nullptr,GL_STREAM_READ);
+        glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER,0,feedback);
+        set_uniforms(capture_program,identity);
+        float max_error=0;
+        for(float time:{0.0f,1.7f})
+        {
+            set_grid(capture_program,time);
+            glEnable(GL_RASTERIZER_DISCARD);
+            glBeginTransformFeedback(GL_POINTS);
+            glDrawArrays(GL_POINTS,0,vertices);
+            glEndTransformFeedback();
+            glDisable(GL_RASTERIZER_DISCARD);
+            std::vector<float> captured(4*vertices);
+            glGetBufferSubData(GL_TRANSFORM_FEEDBACK_BUFFER,0,captured.size()*sizeof(float),captured.data());
+            evaluate(f,side,time,points,normals);
+            for(int i=0;i<vertices;++i)
+            {
+                for(int k=0;k<3;++k) max_error=std::max(max_error,std::abs(captured[4*i+k]-points[3*i+k]));
+            }
+        }
+        std::cout<<"max |GPU-CPU| of positions: "<<max_error<<'\n';
+        glDeleteBuffers(1,&feedback);
+    }
+
+    // orthographic view of the square of the grid
+    const float scale=1.0f/max_xy;
+    const float full_matrix[16]={scale,0,0,0, 0,scale,0,0, 0,0,-0.1f,0, 0,0,0,1};
+    set_uniforms(cpu_program,full_matrix);
+    set_uniforms(gpu_program,full_matrix);
+    glEnable(GL_DEPTH_TEST);
+    for(bool gpu:{false,true})
+    {
+        double evaluation=0;
+        auto frame=[&](float time)
+        {
+            glClear(GL_COLOR_BUFFER_BIT|GL_DEPTH_BUFFER_BIT);
+            if(gpu)
+            {
+                glUseProgram(gpu_program);
+                set_grid(gpu_program,time);
+            }
+            else
+            {
+                auto start=std::chrono::steady_clock::now();
+                evaluate(f,side,time,points,normals);
+                std::chrono::duration<double,std::milli> pass=std::chrono::steady_clock::now()-start;
+                evaluation+=pass.count();
+                const std::vector<float>*sources[2]={&points,&normals};
+                for(int i=0;i<2;++i)
+                {
+                    glBindBuffer(GL_ARRAY_BUFFER,buffers[i]);
+                    glBufferSubData(GL_ARRAY_BUFFER,0,3*vertices*sizeof(float),sources[i]->data());
+                }
+                glUseProgram(cpu_program);
+            }
+            // the vertices of the GLSL surface have no attributes, but the same indices
+            glDrawElements(GL_TRIANGLES,indices.size(),GL_UNSIGNED_INT,nullptr);
+        };
+        frame(0.0f);// warm up
+        glFinish();
+        evaluation=0;
+        auto start=std::chrono::steady_clock::now();
+        for(int i=0;i<frames;++i) frame(0.05f*i);
+        glFinish();
+        std::chrono::duration<double,std::milli> pass=std::chrono::steady_clock::now()-start;
+        std::cout<<std::setw(22)<<(gpu? "vertex shader":"CPU and upload")
+                 <<std::setw(10)<<std::fixed<<std::setprecision(2)<<pass.count()/frames<<" ms/frame"
+                 <<std::setw(10)<<evaluation/frames<<" ms/frame on CPU"
+                 <<std::setw(10)<<(gpu? 0:2*3*vertices*sizeof(float)/1024)<<" KB/frame uploaded\n";
+    }
+    if(glGetError()!=GL_NO_ERROR) std::cerr<<"OpenGL error\n";
+    return 0;
+}
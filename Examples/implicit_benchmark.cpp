@@ -0,0 +1,81 @@
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <cmath>
+#include <string>
+
+#include "../implicit_mesh.h"
+#include "../Expression/function_pool.h"
+
+// Meshing of implicit surfaces at 256^3, with and without skipping of blocks,
+// of C++ functions and of the expressions of the function pool, cloned for
+// each parallel tile (CImplicitMesh::SetFunctorMaker).
+// Doesn't require OpenGL context, build with implicit_mesh.cpp and function_pool.cpp:
+//
+//   g++ -std=c++20 -O2 -I<eigen> implicit_benchmark.cpp ../implicit_mesh.cpp ../Expression/function_pool.cpp
+//   ./a.out [resolution]
+
+float Gyroid(float x,float y,float z)
+{
+    return std::sin(x)*std::cos(y)+std::sin(y)*std::cos(z)+std::sin(z)*std::cos(x);
+}
+
+float BarthSextic(float x,float y,float z)
+{
+    const float phi=(1+std::sqrt(5.0f))/2;
+    const float phi2=phi*phi;
+    const float r=x*x+y*y+z*z-1;
+    return 4*(phi2*x*x-y*y)*(phi2*y*y-z*z)*(phi2*z*z-x*x)-(1+2*phi)*r*r;
+}
+
+float Sphere(float x,float y,float z)
+{
+    return x*x+y*y+z*z-0.04f;
+}
+
+// 'set' sets the function of the mesh
+template<class set_t>
+void Benchmark(const std::string&name,set_t set,float half_size,std::size_t resolution)
+{
+    for(std::size_t block_size:{std::size_t(0),CImplicitMesh::default_block_size})
+    {
+        CImplicitMesh mesh;
+        set(mesh);
+        mesh.SetBox({-half_size,-half_size,-half_size},{half_size,half_size,half_size})
+            .SetResolution(resolution)
+            .SetBlockSize(block_size);
+        auto start=std::chrono::steady_clock::now();
+        mesh.UpdateData();
+        std::chrono::duration<double,std::milli> pass=std::chrono::steady_clock::now()-start;
+
+        auto&stat=mesh.Statistics();
+        std::cout<<std::setw(12)<<name
+                 <<std::setw(8)<<(block_size? "blocks":"dense")
+                 <<std::setw(10)<<std::fixed<<std::setprecision(1)<<pass.count()<<" ms"
+                 <<std::setw(12)<<stat.evaluations<<" evals"
+                 <<std::setw(8)<<stat.active_blocks<<'/'<<stat.blocks<<" blocks"
+                 <<std::setw(10)<<mesh.Vertices().size()<<" vertices"
+                 <<std::setw(10)<<mesh.Triangles()<<" triangles\n";
+    }
+}
+
+int main(int argc,char**argv)
+{
+    const std::size_t resolution=argc>1? std::stoul(argv[1]):256;
+    std::cout<<"Resolution "<<resolution<<"^3\n";
+    auto functor=[](auto func){return [func](CImplicitMesh&mesh){mesh.SetFunctor(func);};};
+    CFunctionPool pool;
+    auto expression=[&pool](const std::string&body)
+    {
+        return [&pool,f=pool.CreateFunction({"x","y","z"},body)](CImplicitMesh&mesh)
+        {
+            mesh.SetFunctorMaker([&pool,f]{return CImplicitMesh::functor_t(pool.CloneFunction(f));});
+        };
+    };
+    Benchmark("gyroid",functor(Gyroid),10.0f,resolution);
+    Benchmark("gyroid pool",expression("sin(x)*cos(y)+sin(y)*cos(z)+sin(z)*cos(x)"),10.0f,resolution);
+    Benchmark("barth",functor(BarthSextic),1.8f,resolution);
+    Benchmark("sphere",functor(Sphere),1.0f,resolution);
+    Benchmark("sphere pool",expression("x*x+y*y+z*z-0.04"),1.0f,resolution);
+    return 0;
+}
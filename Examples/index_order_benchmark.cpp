@@ -0,0 +1,156 @@
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <cmath>
+#include <string>
+#include <vector>
+
+#include "offscreen_gl.h"
+#include "../grid_indices.h"
+
+// Drawing of the grid with index orders of grid_indices.h into offscreen
+// framebuffer: entire columns against bands of rows, triangle lists against
+// strips. Uses surfaceless EGL of Mesa, so without GPU it runs on llvmpipe.
+// Doesn't require Qt, build with grid_indices.cpp only:
+//
+//   g++ -std=c++20 -O2 index_order_benchmark.cpp ../grid_indices.cpp -lEGL -lGL
+//   ./a.out [vertices per side] [frames]
+
+namespace{
+
+const char*vertex_shader=R"(
+#version 330 core
+layout (location = 0) in vec3 vertex_org;
+uniform mat4 full_matrix;
+out vec3 out_color;
+
+// the work of lighting per vertex, so the transforms dominate
+void main()
+{
+    vec3 p=vertex_org;
+    vec3 color=vec3(0.0);
+    for(int i=0;i<8;++i)
+    {
+        color+=0.1*vec3(sin(p.x*float(i)),cos(p.y*float(i)),sin(p.z+float(i)));
+    }
+    out_color=color;
+    gl_Position=full_matrix*vec4(p,1.0);
+}
+)";
+
+const char*fragment_shader=R"(
+#version 330 core
+in vec3 out_color;
+out vec4 frag_out_color;
+void main(){frag_out_color=vec4(out_color,1.0);}
+)";
+
+
+// height field in [-1,1]^3, column by column
+std::vector<float> grid_points(int side)
+{
+    std::vector<float> points;
+    points.reserve(3*side*side);
+    for(int j=0;j<side;++j)
+    {
+        for(int i=0;i<side;++i)
+        {
+            const float x=2.0f*i/(side-1)-1,y=2.0f*j/(side-1)-1;
+            points.insert(points.end(),{x,y,0.5f*std::sin(4*x)*std::cos(4*y)});
+        }
+    }
+    return points;
+}
+
+struct order_t
+{
+    std::string name;
+    bool strips;
+    int  band;
+};
+
+double draw_ms(const std::vector<unsigned>&indices,bool strips,int side,int frames)
+{
+    // 16 bit indices, if they fit, as in CScene
+    const bool shorts=side*side<restart_index16;
+    GLuint ibo;
+    glGenBuffers(1,&ibo);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER,ibo);
+    if(shorts)
+    {
+        std::vector<std::uint16_t> data(indices.begin(),indices.end());
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER,data.size()*2,data.data(),GL_STATIC_DRAW);
+    }
+    else
+    {
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER,indices.size()*4,indices.data(),GL_STATIC_DRAW);
+    }
+    glPrimitiveRestartIndex(shorts? restart_index16:restart_index);
+    const GLenum type=shorts? GL_UNSIGNED_SHORT:GL_UNSIGNED_INT;
+    const GLenum mode=strips? GL_TRIANGLE_STRIP:GL_TRIANGLES;
+
+    auto frame=[&]
+    {
+        glClear(GL_COLOR_BUFFER_BIT|GL_DEPTH_BUFFER_BIT);
+        glDrawElements(mode,indices.size(),type,nullptr);
+    };
+    frame();// warm up
+    glFinish();
+    auto start=std::chrono::steady_clock::now();
+    for(int i=0;i<frames;++i) frame();
+    glFinish();
+    std::chrono::duration<double,std::milli> pass=std::chrono::steady_clock::now()-start;
+    glDeleteBuffers(1,&ibo);
+    return pass.count()/frames;
+}
+
+}
+
+int main(int argc,char**argv)
+{
+    const int side=argc>1? std::stoi(argv[1]):1025;
+    const int frames=argc>2? std::stoi(argv[2]):20;
+    if(!offscreen::init_context())
+    {
+        std::cerr<<"Surfaceless EGL context isn't created\n";
+        return 1;
+    }
+    std::cout<<"Renderer: "<<glGetString(GL_RENDERER)<<'\n'
+             <<"Grid "<<side<<'x'<<side<<", "<<frames<<" frames\n";
+    offscreen::init_framebuffer(512);
+
+    GLuint program=offscreen::link(vertex_shader,fragment_shader);
+    glUseProgram(program);
+    const float matrix[16]={0.9f,0,0,0, 0,0.9f,0,0, 0,0,0.5f,0, 0,0,0,1};
+    glUniformMatrix4fv(glGetUniformLocation(program,"full_matrix"),1,GL_FALSE,matrix);
+
+    GLuint vao,vbo;
+    glGenVertexArrays(1,&vao);
+    glBindVertexArray(vao);
+    glGenBuffers(1,&vbo);
+    glBindBuffer(GL_ARRAY_BUFFER,vbo);
+    const auto points=grid_points(side);
+    glBufferData(GL_ARRAY_BUFFER,points.size()*sizeof(float),points.data(),GL_STATIC_DRAW);
+    glVertexAttribPointer(0,3,GL_FLOAT,GL_FALSE,0,nullptr);
+    glEnableVertexAttribArray(0);
+    glEnable(GL_DEPTH_TEST);
+    glEnable(GL_PRIMITIVE_RESTART);
+
+    const order_t orders[]={{"list columns",false,0},{"list bands",false,default_band_rows},
+                            {"strip columns",true,0},{"strip bands",true,default_band_rows}};
+    std::vector<unsigned> indices;
+    for(const auto&order:orders)
+    {
+        if(order.strips) MakeTriansStrips(side,side,indices,order.band);
+        else             MakeTriansIndexes(side,side,indices,order.band);
+        const auto stat=SimulateVertexCache(indices,order.strips);
+        const double ms=draw_ms(indices,order.strips,side,frames);
+        std::cout<<std::setw(14)<<order.name
+                 <<"  ACMR "<<std::fixed<<std::setprecision(3)<<stat.ACMR()
+                 <<"  ATVR "<<stat.ATVR()
+                 <<std::setw(10)<<indices.size()<<" indices"
+                 <<std::setw(10)<<std::setprecision(2)<<ms<<" ms/frame\n";
+    }
+    if(glGetError()!=GL_NO_ERROR) std::cerr<<"OpenGL error\n";
+    return 0;
+}
@@ -0,0 +1,108 @@
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <cmath>
+#include <string>
+#include <vector>
+
+#include <GL/glew.h>
+#include "offscreen_gl.h"
+#include "../scene.h"
+
+// Many moving spheres of one geometry, as the balls of billiards.cpp, drawn
+// by CScene: the first sphere is the geometry, the others are its instances
+// (CFunctionalMesh::SetSharedGeometry). A draw call with the uniforms of each
+// sphere against one instanced draw with the transforms and the materials
+// in the instance buffer (CScene::SetInstancing), with the default Fong
+// shading and with the Gouraud one (CScene::SetFongShading).
+// Uses surfaceless EGL of Mesa, so without GPU it runs on llvmpipe.
+// Doesn't require Qt, build with the sources of the scene:
+//
+//   g++ -std=c++20 -O2 -I<eigen> instancing_benchmark.cpp ../scene.cpp ../functional_mesh.cpp
+//       ../implicit_mesh.cpp ../grid_indices.cpp ../light_source.cpp ../rigid_transform.cpp
+//       ../view_ruling.cpp ../animation_cache.cpp ../profiler.cpp ../legacy_renderer.cpp
+//       ../../../CppProjects/json11/json11.cpp ../Shaders/*.cpp -lGLEW -lEGL -lGL -lpthread
+//   ./a.out [spheres] [vertices per side] [frames]
+
+namespace{
+
+// spheres on the grid of 'row' x 'row' with the step 1, moved around their cells at time t
+void move_spheres(std::vector<CFunctionalMesh>&spheres,int row,float t)
+{
+    for(std::size_t k=0;k<spheres.size();++k)
+    {
+        spheres[k].SetOrg(k%row+0.5f+0.1f*std::sin(t+k),
+                          k/row+0.5f+0.1f*std::cos(t+k),0);
+    }
+}
+
+}
+
+int main(int argc,char**argv)
+{
+    const int count=argc>1? std::max(1,std::stoi(argv[1])):5000;
+    const int side=argc>2? std::stoi(argv[2]):9;
+    const int frames=argc>3? std::stoi(argv[3]):20;
+    if(!offscreen::init_context())
+    {
+        std::cerr<<"Surfaceless EGL context isn't created\n";
+        return 1;
+    }
+    // the GLX part of GLEW fails without a display, the GL functions are loaded before it
+    glewExperimental=GL_TRUE;
+    glewInit();
+    if(!GLEW_VERSION_3_3)
+    {
+        std::cerr<<"OpenGL 3.3 isn't loaded\n";
+        return 1;
+    }
+    std::cout<<"Renderer: "<<glGetString(GL_RENDERER)<<'\n'
+             <<count<<" spheres "<<side<<'x'<<side<<", "<<frames<<" frames\n";
+    // small target, so the draw calls dominate
+    offscreen::init_framebuffer(64);
+    glEnable(GL_DEPTH_TEST);
+
+    const int row=int(std::ceil(std::sqrt(float(count))));
+    CRenderingTraits rt;
+    rt.SetMesh(false).SetSurface(true).SetSpecular(true).SetColored(true).SetBox(false);
+    for(auto [fong,instancing]:{std::pair{true,false},{true,true},{false,false},{false,true}})
+    {
+        std::vector<CFunctionalMesh> spheres(count);
+        CScene scene;
+        scene.SetFongShading(fong);
+        scene.SetInstancing(instancing);
+        // all spheres are drawn, wherever the camera looks
+        scene.SetFrustumCulling(false);
+        scene.Camera().SetPosition({0.5f*row,-0.5f*row,row});
+        scene.Camera().SetView({0,1,-1});
+        scene.LightSource().SetPosition({0.5f*row,0.5f*row,row});
+        spheres[0].SetSphere(0.4f,side-1,side-1).SetTraits(rt);
+        for(int k=0;k<count;++k)
+        {
+            if(k) spheres[k].SetSharedGeometry(&spheres[0]);
+            // the material of each instance
+            spheres[k].SetShininess(2.0f+k%8*4.0f);
+            scene.AddMesh(spheres[k]);
+        }
+        auto frame=[&](float t)
+        {
+            glClear(GL_COLOR_BUFFER_BIT|GL_DEPTH_BUFFER_BIT);
+            move_spheres(spheres,row,t);
+            scene.Render(t);
+        };
+        frame(0.0f);// warm up and initial data
+        glFinish();
+        auto start=std::chrono::steady_clock::now();
+        for(int i=0;i<frames;++i) frame(0.1f*(i+1));
+        glFinish();
+        std::chrono::duration<double,std::milli> pass=std::chrono::steady_clock::now()-start;
+        const auto&stat=scene.RenderStat();
+        std::cout<<std::setw(8)<<(fong? "Fong":"Gouraud")
+                 <<std::setw(12)<<(instancing? "instanced":"separate")
+                 <<std::setw(8)<<stat.draw_calls<<" draws"
+                 <<std::setw(8)<<stat.instances<<" instances"
+                 <<std::setw(10)<<std::fixed<<std::setprecision(2)<<pass.count()/frames<<" ms/frame\n";
+    }
+    if(glGetError()!=GL_NO_ERROR) std::cerr<<"OpenGL error\n";
+    return 0;
+}
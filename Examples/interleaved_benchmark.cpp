@@ -0,0 +1,115 @@
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <cmath>
+#include <string>
+#include <vector>
+
+#include <GL/glew.h>
+#include "offscreen_gl.h"
+#include "../scene.h"
+
+// Many small colored specular meshes, drawn by CScene: the positions, colors
+// and normals in three buffers with three uploads per mesh against one
+// interleaved buffer with one upload (CScene::SetInterleaved). Static meshes
+// are uploaded once, dynamic ones are evaluated and uploaded for every frame.
+// Uses surfaceless EGL of Mesa, so without GPU it runs on llvmpipe.
+// Doesn't require Qt, build with the sources of the scene:
+//
+//   g++ -std=c++20 -O2 -I<eigen> interleaved_benchmark.cpp ../scene.cpp ../functional_mesh.cpp
+//       ../implicit_mesh.cpp ../grid_indices.cpp ../light_source.cpp ../rigid_transform.cpp
+//       ../view_ruling.cpp ../animation_cache.cpp ../profiler.cpp ../legacy_renderer.cpp
+//       ../../../CppProjects/json11/json11.cpp ../Shaders/*.cpp -lGLEW -lEGL -lGL -lpthread
+//   ./a.out [meshes] [vertices per side] [frames]
+
+namespace{
+
+// small wave on [0,1]^2 with the colors of its points
+void make_meshes(std::vector<CFunctionalMesh>&meshes,int side,bool dynamic)
+{
+    using point_t=Eigen::Vector3f;
+    CRenderingTraits rt;
+    rt.SetMesh(false).SetSurface(true).SetSpecular(true).SetColored(true).SetBox(false);
+    const int row=int(std::ceil(std::sqrt(float(meshes.size()))));
+    for(std::size_t m=0;m<meshes.size();++m)
+    {
+        auto&mesh=meshes[m];
+        auto wave=[](float x,float y,float t){return 0.1f*std::sin(8*x+t)*std::cos(8*y);};
+        if(dynamic) mesh.SetMeshFunctor(plot::cartesian(wave),CFunctionalMesh::dynamic_id);
+        else        mesh.SetMeshFunctor(plot::cartesian([wave](float x,float y){return wave(x,y,0);}));
+        mesh.SetColorFunctor([](float x,float y,float z){return point_t(x,y,0.5f+5*z);})
+            .SetRange({0,1},{0,1})
+            .SetResolution(side-1,side-1)
+            .SetTraits(rt)
+            .SetOrg(1.2f*(m%row),1.2f*(m/row),0);
+    }
+}
+
+}
+
+int main(int argc,char**argv)
+{
+    const int count=argc>1? std::stoi(argv[1]):2000;
+    const int side=argc>2? std::stoi(argv[2]):17;
+    const int frames=argc>3? std::stoi(argv[3]):20;
+    if(!offscreen::init_context())
+    {
+        std::cerr<<"Surfaceless EGL context isn't created\n";
+        return 1;
+    }
+    // the GLX part of GLEW fails without a display, the GL functions are loaded before it
+    glewExperimental=GL_TRUE;
+    glewInit();
+    if(!GLEW_VERSION_3_3)
+    {
+        std::cerr<<"OpenGL 3.3 isn't loaded\n";
+        return 1;
+    }
+    std::cout<<"Renderer: "<<glGetString(GL_RENDERER)<<'\n'
+             <<count<<" meshes "<<side<<'x'<<side<<", "<<frames<<" frames\n";
+    // small target, so the uploads and the draw calls dominate
+    offscreen::init_framebuffer(128);
+    glEnable(GL_DEPTH_TEST);
+
+    const float row=std::ceil(std::sqrt(float(count)));
+    for(bool interleaved:{false,true})
+    {
+        for(bool dynamic:{false,true})
+        {
+            std::vector<CFunctionalMesh> meshes(count);
+            make_meshes(meshes,side,dynamic);
+            CScene scene;
+            scene.SetInterleaved(interleaved);
+            // all meshes are drawn, wherever the camera looks
+            scene.SetFrustumCulling(false);
+            scene.Camera().SetPosition({-0.2f*row,-0.2f*row,0.5f*row});
+            scene.Camera().SetView({1,1,-1});
+            scene.LightSource().SetPosition({0.6f*row,0.6f*row,row});
+            for(auto&mesh:meshes) scene.AddMesh(mesh);
+            auto frame=[&](float t)
+            {
+                glClear(GL_COLOR_BUFFER_BIT|GL_DEPTH_BUFFER_BIT);
+                scene.Render(t);
+            };
+            frame(0.0f);// warm up and initial data
+            glFinish();
+            float update_ms=0;
+            auto start=std::chrono::steady_clock::now();
+            for(int i=0;i<frames;++i)
+            {
+                frame(0.1f*(i+1));
+                update_ms+=scene.RenderStat().update_ms;
+            }
+            glFinish();
+            std::chrono::duration<double,std::milli> pass=std::chrono::steady_clock::now()-start;
+            std::cout<<std::setw(12)<<(interleaved? "interleaved":"separate")
+                     <<std::setw(10)<<(dynamic? "dynamic":"static")
+                     <<std::setw(6)<<(dynamic? (interleaved? 1:3):0)<<" uploads/mesh"
+                     <<std::setw(10)<<std::fixed<<std::setprecision(2)<<pass.count()/frames<<" ms/frame"
+                     <<std::setw(10)<<update_ms/frames<<" ms/frame of updates"
+                     <<std::setw(8)<<scene.RenderStat().draw_calls<<" draws\n";
+        }
+    }
+    if(glGetError()!=GL_NO_ERROR) std::cerr<<"OpenGL error\n";
+    return 0;
+}
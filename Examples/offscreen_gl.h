@@ -0,0 +1,86 @@
+#ifndef  _offscreen_gl_
+#define  _offscreen_gl_
+
+#include <iostream>
+#include <string>
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#define GL_GLEXT_PROTOTYPES
+#include <GL/gl.h>
+#include <GL/glext.h>
+
+// OpenGL 3.3 core context of the benchmarks without a window: surfaceless
+// EGL of Mesa, so without GPU they run on llvmpipe. The frames are drawn
+// into the framebuffer of init_framebuffer. If GLEW is included before,
+// glewInit must be called after init_context.
+
+namespace offscreen{
+
+inline bool init_context()
+{
+    auto get_display=reinterpret_cast<PFNEGLGETPLATFORMDISPLAYEXTPROC>(eglGetProcAddress("eglGetPlatformDisplayEXT"));
+    if(!get_display) return false;
+    EGLDisplay display=get_display(EGL_PLATFORM_SURFACELESS_MESA,EGL_DEFAULT_DISPLAY,nullptr);
+    if(display==EGL_NO_DISPLAY||!eglInitialize(display,nullptr,nullptr)) return false;
+    if(!eglBindAPI(EGL_OPENGL_API)) return false;
+    const EGLint attributes[]={EGL_CONTEXT_MAJOR_VERSION,3,EGL_CONTEXT_MINOR_VERSION,3,
+                               EGL_CONTEXT_OPENGL_PROFILE_MASK,EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+                               EGL_NONE};
+    EGLContext context=eglCreateContext(display,EGL_NO_CONFIG_KHR,EGL_NO_CONTEXT,attributes);
+    return context!=EGL_NO_CONTEXT&&eglMakeCurrent(display,EGL_NO_SURFACE,EGL_NO_SURFACE,context);
+}
+
+inline GLuint compile(GLenum type,const std::string&source)
+{
+    GLuint shader=glCreateShader(type);
+    const char*str=source.c_str();
+    glShaderSource(shader,1,&str,nullptr);
+    glCompileShader(shader);
+    GLint ok=0;
+    glGetShaderiv(shader,GL_COMPILE_STATUS,&ok);
+    if(!ok)
+    {
+        char log[1024]={};
+        glGetShaderInfoLog(shader,sizeof(log),nullptr,log);
+        std::cerr<<"Shader isn't compiled: "<<log<<'\n';
+    }
+    return shader;
+}
+
+// 'captured' - the output of the vertex shader, which is written
+// into the transform feedback buffer, nullptr for none
+inline GLuint link(const std::string&vertex,const std::string&fragment,const char*captured=nullptr)
+{
+    GLuint program=glCreateProgram();
+    glAttachShader(program,compile(GL_VERTEX_SHADER,vertex));
+    glAttachShader(program,compile(GL_FRAGMENT_SHADER,fragment));
+    if(captured) glTransformFeedbackVaryings(program,1,&captured,GL_INTERLEAVED_ATTRIBS);
+    glLinkProgram(program);
+    GLint ok=0;
+    glGetProgramiv(program,GL_LINK_STATUS,&ok);
+    if(!ok) std::cerr<<"Program isn't linked\n";
+    return program;
+}
+
+// framebuffer with color and depth of size x size
+inline void init_framebuffer(int size)
+{
+    GLuint fbo,color,depth;
+    glGenFramebuffers(1,&fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER,fbo);
+    glGenRenderbuffers(1,&color);
+    glBindRenderbuffer(GL_RENDERBUFFER,color);
+    glRenderbufferStorage(GL_RENDERBUFFER,GL_RGBA8,size,size);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER,GL_COLOR_ATTACHMENT0,GL_RENDERBUFFER,color);
+    glGenRenderbuffers(1,&depth);
+    glBindRenderbuffer(GL_RENDERBUFFER,depth);
+    glRenderbufferStorage(GL_RENDERBUFFER,GL_DEPTH_COMPONENT24,size,size);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER,GL_DEPTH_ATTACHMENT,GL_RENDERBUFFER,depth);
+    if(glCheckFramebufferStatus(GL_FRAMEBUFFER)!=GL_FRAMEBUFFER_COMPLETE) std::cerr<<"Framebuffer isn't complete\n";
+    glViewport(0,0,size,size);
+}
+
+}// offscreen
+
+#endif
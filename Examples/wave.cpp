@@ -102,7 +102,8 @@ void MakeRevolveWave(CFunctionalMesh&mesh)
     mesh.SetMeshFunctor(make_wave(2*pi_v<float>/2.0))
         .SetResolution(20,20)
         .SetTraits(rt)
-        .SetRange({0,2*pi_v<float>},{-2,2});
+        .SetRange({0,2*pi_v<float>},{-2,2})
+        .SetAnimationCache(2.0f,120);// period of cos(t*omega)
 }
 
 
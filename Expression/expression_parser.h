@@ -137,6 +137,7 @@ class constant_t:public invokable_with_stack_t<T>
     {
         stack.push_back(m_const);
     }
+    T value()const{return m_const;}
     virtual invokable_with_stack_t<T>* clone()const override
     {
         return new constant_t(m_const);
@@ -210,6 +211,8 @@ class function_ref_t:public invokable_with_stack_t<T>
     {
         m_ref->call_stack(stack);
     }
+    // the called function, its arity is 1-stack_increment()
+    const invokable_with_stack_t<T>* ref()const{return m_ref;}
     virtual invokable_with_stack_t<T>* clone()const override
     {
         return new function_ref_t(m_ref);
@@ -227,6 +230,8 @@ class base_operation_t:public invokable_with_stack_t<T>
     {
     }
     int priority()const{return m_priority;}
+    // infix symbol of the operation, 0 if it has no one
+    virtual char symbol()const{return 0;}
 };
 
 template<class functor_t,class T>
@@ -246,6 +251,14 @@ class operation_t:public base_operation_t<T>
         stack.pop_back();
         stack.back()=result;
     }
+    virtual char symbol()const override
+    {
+        if constexpr(std::is_same_v<functor_t,std::plus<T>>)       return '+';
+        if constexpr(std::is_same_v<functor_t,std::minus<T>>)      return '-';
+        if constexpr(std::is_same_v<functor_t,std::multiplies<T>>) return '*';
+        if constexpr(std::is_same_v<functor_t,std::divides<T>>)    return '/';
+        return 0;
+    }
     virtual invokable_with_stack_t<T>* clone()const override
     {
         return new operation_t(m_functor,m_priority);
@@ -669,9 +682,9 @@ class function:public invokable_with_stack_t<T>
             m_postfix.push_back(token->clone());
             if(token->type()==invokable_with_stack_t<T>::variable_id)
             {
-                std::ptrdiff_t i=static_cast<variable_t<T>*>(token).m_var_ptr-&other.m_args[0];
-                assert(i>=0&&i<m_args.size());
-                static_cast<variable_t<T>*>(m_postfix.back()).m_var_ptr=&m_args[i];
+                std::ptrdiff_t i=static_cast<const variable_t<T>*>(token)->m_var_ptr-other.m_args.data();
+                assert(i>=0&&i<std::ptrdiff_t(m_args.size()));
+                static_cast<variable_t<T>*>(m_postfix.back())->m_var_ptr=&m_args[i];
             }
         }
         this->m_stack_inc=other.m_stack_inc;
@@ -692,7 +705,7 @@ class function:public invokable_with_stack_t<T>
     }
     public:
     function():invokable_with_stack_t<T>(invokable_with_stack_t<T>::function_id,0){}
-    function(const function&other)
+    function(const function&other):invokable_with_stack_t<T>(invokable_with_stack_t<T>::function_id,0)
     {
         m_copy(other);
     }
@@ -797,6 +810,26 @@ class function:public invokable_with_stack_t<T>
     }
     std::size_t arity()const{return m_args.size();}
     explicit operator bool()const{return !m_postfix.empty();}
+    const std::vector<invokable_with_stack_t<T>*>& postfix()const{return m_postfix;}
+    // the calls of the function 'callee' are replaced by the calls of 'map(callee)'
+    template<class map_t>//(const invokable_with_stack_t<T>*)->invokable_with_stack_t<T>*
+    void rebind_calls(map_t map)
+    {
+        for(auto*&token:m_postfix)
+        {
+            auto*ref=dynamic_cast<const function_ref_t<T>*>(token);
+            if(!ref) continue;
+            auto*callee=map(ref->ref());
+            delete token;
+            token=new function_ref_t<T>(callee);
+        }
+    }
+    // index of the argument, which is read by the variable, -1 for foreign one
+    int arg_index(const variable_t<T>*var)const
+    {
+        std::ptrdiff_t i=var->m_var_ptr-m_args.data();
+        return (i>=0&&i<std::ptrdiff_t(m_args.size()))? int(i):-1;
+    }
     ~function()
     {
         m_clear();
@@ -1,5 +1,6 @@
 #include <assert.h>
 #include <numbers>
+#include <map>
 #include <math.h>
 //#include <iostream>
 
@@ -141,6 +142,37 @@ CFunctionPool::CreateFunction(const std::vector<std::string>& vars,
     return CreateFunction(vars,begin,end,error);
 }
 
+CFunctionPool::CFunction CFunctionPool::CloneFunction(CFunction func)const
+{
+    if(!func) return CFunction(nullptr,false);
+    auto fdata=std::make_unique<function_data_t>();
+    fdata->is_buildin=false;
+    fdata->args=func.m_data->args;
+    fdata->name="";
+    fdata->body=func.m_data->body;
+    fdata->expr=func.m_data->expr;
+    // every called function is copied once, the copies call the copies too
+    std::map<const expr::invokable_with_stack_t<real_t>*,function_t*> copies;
+    auto rebind=[&](auto&self,function_t&expr)->void
+    {
+        expr.rebind_calls([&](const expr::invokable_with_stack_t<real_t>*callee)
+        {
+            auto [iter,inserted]=copies.try_emplace(callee,nullptr);
+            if(inserted)
+            {
+                // the callees are the expressions of the pool functions
+                auto*source=static_cast<const function_t*>(callee);
+                fdata->callees.push_back(std::make_unique<function_t>(*source));
+                iter->second=fdata->callees.back().get();
+                self(self,*iter->second);
+            }
+            return iter->second;
+        });
+    };
+    rebind(rebind,fdata->expr);
+    return CFunction(fdata.release(),false);
+}
+
 CFunctionPool::CFunction
 CFunctionPool::CreateAndRegisterFunction(const std::string& name,
                                          const std::vector<std::string>& args,
@@ -271,6 +303,55 @@ void CFunctionPool::TopologicalSortFunctions(std::vector<CFunction>&funcs)const
     m_dependency_graph.topological_sort(fn_output_iterator_t(inserter));
 }
 
+// GLSL
+
+bool CFunctionPool::m_AppendGlsl(const function_t&func,const std::string&name,
+                                 std::vector<const function_t*>&defined,std::string&source)const
+{
+    std::vector<std::string> args;
+    std::string params;
+    for(std::size_t i=0;i<func.arity();++i)
+    {
+        args.push_back("a"+std::to_string(i));
+        params+=(i? ",float ":"float ")+args.back();
+    }
+    auto function_name=[&](const expr::invokable_with_stack_t<real_t>*ref)->std::optional<std::string>
+    {
+        for(auto*fdata:m_buildin_functions)
+        {
+            if(&fdata->expr==ref) return fdata->name;
+        }
+        for(auto*fdata:m_functions)
+        {
+            if(&fdata->expr!=ref) continue;
+            std::string glsl_name="pool_"+fdata->name;
+            if(rg::find(defined,&fdata->expr)==defined.end()&&
+               !m_AppendGlsl(fdata->expr,glsl_name,defined,source)) return {};
+            return glsl_name;
+        }
+        return {};
+    };
+    // the called functions are appended to the source first
+    auto body=expr::postfix_to_glsl(func,args,function_name);
+    if(!body) return false;
+    defined.push_back(&func);
+    source+="float "+name+"("+params+")\n{\n    return "+*body+";\n}\n";
+    return true;
+}
+
+std::optional<std::string>
+CFunctionPool::GlslSource(const std::vector<std::pair<CFunction,std::string>>&funcs)const
+{
+    std::string source;
+    std::vector<const function_t*> defined;
+    for(auto&[func,name]:funcs)
+    {
+        if(!func||func.IsBuildin()) return {};
+        if(!m_AppendGlsl(func.m_data->expr,name,defined,source)) return {};
+    }
+    return source;
+}
+
 CFunctionPool::~CFunctionPool()
 {
     // delete registered functions and constants
@@ -5,6 +5,7 @@
 #include <memory>
 
 #include "expression_parser.h"
+#include "glsl_codegen.h"
 #include "dependency_graph.h"
 
 struct constant_t;
@@ -50,6 +51,8 @@ class CFunctionPool
         std::string              body;
         node_descriptor          node;
         int                      index=-1;
+        // own copies of the called functions of a clone
+        std::vector<std::unique_ptr<function_t>> callees;
     };
     struct comparer_t
     {
@@ -138,6 +141,8 @@ class CFunctionPool
         return (iter!=vector.end()&&comp.equal(*iter,std::pair{b,e}))? *iter:nullptr;
     }
     expr::invokable_with_stack_t<real_t>* m_IdenMap(str_iterator_t b,str_iterator_t e)const;
+    bool m_AppendGlsl(const function_t&,const std::string&name,
+                      std::vector<const function_t*>&defined,std::string&source)const;
 
     public:
     using parse_error_t=expr::parse_error_t;
@@ -200,6 +205,10 @@ class CFunctionPool
     {
         return CreateFunction(vars,body.begin(),body.end());
     }
+    // Not registered copy, which calls its own copies of the called functions:
+    // it shares no state with the pool and other functions, so it can be
+    // evaluated in another thread. Later changes of the pool aren't seen by it.
+    CFunction CloneFunction(CFunction)const;
     // Create and register function
     CFunction
     CreateAndRegisterFunction(const std::string& name,
@@ -247,6 +256,15 @@ class CFunctionPool
     auto      BuildinFunctions()const{return m_buildin_functions.size();}
     CFunction BuildinFunction(int i)const{return CFunction(m_buildin_functions[i],true);}
     void      TopologicalSortFunctions(std::vector<CFunction>&)const;
+    // GLSL definitions of the functions: float name(float a0,...) for every
+    // pair, the registered functions called by them are defined before
+    // as pool_<name>, builtins are called as GLSL functions of the same name.
+    // Nothing, if some function can't be translated.
+    std::optional<std::string> GlslSource(const std::vector<std::pair<CFunction,std::string>>&)const;
+    std::optional<std::string> GlslSource(CFunction f,const std::string&name)const
+    {
+        return GlslSource({{f,name}});
+    }
     //   Constants
     CConstant CreateConstant(const std::string&str,real_t real);
     CConstant FindConstant(str_citerator b,str_citerator e)const;
@@ -0,0 +1,100 @@
+#ifndef  _glsl_codegen_
+#define  _glsl_codegen_
+
+#include <vector>
+#include <optional>
+#include <string>
+#include <charconv>
+#include <cmath>
+
+#include "expression_parser.h"
+
+namespace expr{
+
+// GLSL float literal, which is read back as the same float,
+// empty for infinities and NaN
+template<class T>
+std::optional<std::string> glsl_literal(T value)
+{
+    if(!std::isfinite(value)) return {};
+    char buffer[64];
+    auto [ptr,ec]=std::to_chars(buffer,buffer+sizeof(buffer),static_cast<float>(value));
+    if(ec!=std::errc()) return {};
+    std::string literal(buffer,ptr);
+    if(literal.find_first_of(".e")==std::string::npos) literal+=".0";
+    return value<0? "("+literal+")":literal;
+}
+
+/* postfix_to_glsl - converting the postfix form of 'func' into
+  the GLSL expression, the stack of the evaluation holds the GLSL
+  expressions of its values instead of the values.
+  args - GLSL names of the arguments of 'func'.
+  function_name - by the function referenced by function_ref_t
+  returns the name of GLSL function, which is called for it.
+  Returns nothing, if some token can't be translated: operations without
+  infix symbol, functors of function_t or unnamed functions.
+*/
+template<class T,
+         class function_name_t>//(const invokable_with_stack_t<T>*)->std::optional<std::string>
+std::optional<std::string> postfix_to_glsl(const function<T>&func,
+                                           const std::vector<std::string>&args,
+                                           function_name_t function_name)
+{
+    using invoke_t=invokable_with_stack_t<T>;
+    if(args.size()!=func.arity()) return {};
+    std::vector<std::string> stack;
+    for(const invoke_t*token:func.postfix())
+    {
+        switch(token->type())
+        {
+            case invoke_t::constant_id:
+            {
+                auto literal=glsl_literal(static_cast<const constant_t<T>*>(token)->value());
+                if(!literal) return {};
+                stack.push_back(std::move(*literal));
+                break;
+            }
+            case invoke_t::variable_id:
+            {
+                int i=func.arg_index(static_cast<const variable_t<T>*>(token));
+                if(i<0) return {};
+                stack.push_back(args[i]);
+                break;
+            }
+            case invoke_t::operation_id:
+            {
+                char symbol=static_cast<const base_operation_t<T>*>(token)->symbol();
+                if(!symbol||stack.size()<2) return {};
+                std::string right=std::move(stack.back());
+                stack.pop_back();
+                stack.back()="("+stack.back()+symbol+right+")";
+                break;
+            }
+            case invoke_t::function_id:
+            {
+                auto*ref=dynamic_cast<const function_ref_t<T>*>(token);
+                if(!ref) return {};
+                auto name=function_name(ref->ref());
+                const std::size_t arity=1-ref->stack_increment();
+                if(!name||stack.size()<arity) return {};
+                // the value at the top of the stack is the last argument
+                std::string call=*name+"(";
+                for(std::size_t i=stack.size()-arity;i<stack.size();++i)
+                {
+                    if(i!=stack.size()-arity) call+=",";
+                    call+=stack[i];
+                }
+                stack.erase(stack.end()-arity,stack.end());
+                stack.push_back(call+")");
+                break;
+            }
+            default: return {};
+        }
+    }
+    if(stack.size()!=1) return {};
+    return std::move(stack.back());
+}
+
+}// expr
+
+#endif
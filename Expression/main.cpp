@@ -3,6 +3,7 @@
 #include "test/test_dependency_graph.h"
 #include "test/test_parsing.h"
 #include "test/test_function_pool.h"
+#include "test/test_glsl_codegen.h"
 #include "test/benchmarks.h"
 
 
@@ -15,6 +16,7 @@ int main()
     test_dependency_graph();
     test_parsing();
     test_function_pool();
+    test_glsl_codegen();
     test_benchmarks();
     return 0;
 }
@@ -212,6 +212,22 @@ void test_function_pool()
         assert(fpool.FindFunction("f2"));
         assert(f2(0,1)==1&&f2(0,2)==2&&f2(0,3)==3);
     }
+    {
+        fpool.Clear();
+        auto f1=fpool.CreateAndRegisterFunction("f1",{"x"},"sin(x)+1");
+        assert(f1);
+        assert(fpool.CreateAndRegisterFunction("f2",{"x","y"},"f1(x)*f1(y)"));
+        auto f=fpool.CreateFunction({"x","y"},"f2(x,y)+f1(y)");
+        assert(f);
+        auto clone=fpool.CloneFunction(f);
+        assert(clone&&!clone.IsRegister());
+        auto check=[](real_t x,real_t y){return (std::sin(x)+1)*(std::sin(y)+1)+std::sin(y)+1;};
+        TEST(real_eq(accumulate_error(check,clone,{0,1,0.2},{0,1,0.2}),0));
+        // the clone keeps the called functions of the moment of cloning
+        assert(!fpool.ReparseFunction(f1,{"x"},"x"));
+        TEST(real_eq(f(0.5,0.5),1.5*0.5));
+        TEST(real_eq(accumulate_error(check,clone,{0,1,0.2},{0,1,0.2}),0));
+    }
     std::cout<<"test data pool\n";
 }
 
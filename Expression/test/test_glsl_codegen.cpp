@@ -0,0 +1,70 @@
+
+#include <assert.h>
+#include <string>
+#include <limits>
+
+#include "../function_pool.h"
+#include "../glsl_codegen.h"
+#include  "test_common.h"
+#include "test_glsl_codegen.h"
+
+static bool check_source(const std::optional<std::string>&source,const std::string&expected)
+{
+    if(source&&*source==expected) return true;
+    std::cout<<"expected:\n"<<expected<<"generated:\n"<<(source? *source:"nothing")<<'\n';
+    return false;
+}
+
+void test_glsl_codegen()
+{
+    // literals are read back as the same floats
+    TEST(expr::glsl_literal(1.0f)==std::string("1.0"));
+    TEST(expr::glsl_literal(0.1f)==std::string("0.1"));
+    TEST(expr::glsl_literal(-2.5f)==std::string("(-2.5)"));
+    TEST(expr::glsl_literal(1e-7f)==std::string("1e-07"));
+    TEST(!expr::glsl_literal(std::numeric_limits<float>::infinity()));
+
+    CFunctionPool fpool;
+    assert(fpool.CreateConstant("const_a",-1.5f));
+    {
+        auto fn=fpool.CreateFunction({"x","y"},"1+2*x-y/4");
+        assert(fn);
+        TEST(check_source(fpool.GlslSource(fn,"f"),
+                          "float f(float a0,float a1)\n{\n    return ((1.0+(2.0*a0))-(a1/4.0));\n}\n"));
+    }
+    {
+        // unary minus, builtins and constants
+        auto fn=fpool.CreateFunction({"x"},"-sin(x)*const_a+pi");
+        assert(fn);
+        TEST(check_source(fpool.GlslSource(fn,"g"),
+                          "float g(float a0)\n{\n    return ((0.0-(sin(a0)*(-1.5)))+3.1415927);\n}\n"));
+    }
+    {
+        // registered functions are defined once, before their callers
+        assert(fpool.CreateAndRegisterFunction("r",{"x","y"},"sqrt(x*x+y*y)"));
+        assert(fpool.CreateAndRegisterFunction("f1",{"x","y"},"x/r(x,y)"));
+        assert(fpool.CreateAndRegisterFunction("f2",{"x","y"},"r(y,x)"));
+        auto z=fpool.CreateFunction({"s","t","time"},"f1(s,t)+f2(t,time)");
+        auto w=fpool.CreateFunction({"s","t","time"},"r(s,t)");
+        assert(z&&w);
+        const std::string r="float pool_r(float a0,float a1)\n{\n    return sqrt(((a0*a0)+(a1*a1)));\n}\n";
+        const std::string f1="float pool_f1(float a0,float a1)\n{\n    return (a0/pool_r(a0,a1));\n}\n";
+        const std::string f2="float pool_f2(float a0,float a1)\n{\n    return pool_r(a1,a0);\n}\n";
+        TEST(check_source(fpool.GlslSource({{z,"z"},{w,"w"}}),
+                          r+f1+f2+"float z(float a0,float a1,float a2)\n{\n    return (pool_f1(a0,a1)+pool_f2(a1,a2));\n}\n"+
+                          "float w(float a0,float a1,float a2)\n{\n    return pool_r(a0,a1);\n}\n"));
+    }
+    {
+        // functions without arguments are called without them
+        assert(fpool.CreateAndRegisterFunction("k",{},"2*pi"));
+        auto fn=fpool.CreateFunction({"x"},"k()*x");
+        assert(fn);
+        TEST(check_source(fpool.GlslSource(fn,"h"),
+                          "float pool_k()\n{\n    return (2.0*3.1415927);\n}\n"
+                          "float h(float a0)\n{\n    return (pool_k()*a0);\n}\n"));
+    }
+    // builtins are GLSL functions already, functors aren't translated
+    TEST(!fpool.GlslSource(fpool.FindFunction("sin"),"f"));
+    TEST(!fpool.GlslSource(CFunctionPool::CFunction(),"f"));
+    std::cout<<"test glsl codegen\n";
+}
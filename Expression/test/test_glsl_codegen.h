@@ -0,0 +1,9 @@
+
+#ifndef  _test_glsl_codegen_
+#define  _test_glsl_codegen_
+
+
+void test_glsl_codegen();
+
+
+#endif
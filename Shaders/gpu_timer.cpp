@@ -0,0 +1,62 @@
+#include <GL/glew.h>
+#include <GL/gl.h>
+
+#include "gpu_timer.h"
+
+////////////////////////////////////////////////
+//                  CGpuTimer
+////////////////////////////////////////////////
+
+CGpuTimer::CGpuTimer()
+{
+    glGenQueries(latency,m_queries.data());
+    glCheckError();
+}
+
+bool CGpuTimer::Begin(double tag)
+{
+    assert(!m_active);
+    if(m_pending[m_current]) return false;
+    glBeginQuery(GL_TIME_ELAPSED,m_queries[m_current]);
+    glCheckError();
+    m_tags[m_current]=tag;
+    m_active=true;
+    return true;
+}
+
+void CGpuTimer::End()
+{
+    if(!m_active) return;
+    glEndQuery(GL_TIME_ELAPSED);
+    glCheckError();
+    m_pending[m_current]=true;
+    m_current=(m_current+1)%latency;
+    m_active=false;
+}
+
+const std::vector<CGpuTimer::interval_t>& CGpuTimer::Poll()
+{
+    m_finished.clear();
+    // queries finish in the order of their intervals
+    for(size_t k=0;k<latency;++k)
+    {
+        const size_t i=(m_current+k)%latency;
+        if(!m_pending[i]) continue;
+        GLint available=0;
+        glGetQueryObjectiv(m_queries[i],GL_QUERY_RESULT_AVAILABLE,&available);
+        glCheckError();
+        if(!available) break;
+        GLuint64 ns=0;
+        glGetQueryObjectui64v(m_queries[i],GL_QUERY_RESULT,&ns);
+        glCheckError();
+        m_pending[i]=false;
+        m_finished.push_back({m_tags[i],ns/1.0e6});
+    }
+    return m_finished;
+}
+
+CGpuTimer::~CGpuTimer()
+{
+    glDeleteQueries(latency,m_queries.data());
+    glCheckError();
+}
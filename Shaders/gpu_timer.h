@@ -0,0 +1,46 @@
+#ifndef _gpu_timer_
+#define _gpu_timer_
+
+#include <assert.h>
+#include <array>
+#include <vector>
+
+#include <GL/gl.h>
+
+#include "../opengl_iface.h"
+
+// GPU time of the commands between Begin and End by GL_TIME_ELAPSED queries.
+// The ring of 'latency' queries is read without waiting: Poll returns the
+// intervals finished by the GPU and frees their queries, Begin skips the
+// interval, if the GPU lags behind by all the queries. The tag of the interval
+// is returned with its time.
+
+class CGpuTimer
+{
+    using size_t=std::size_t;
+    public:
+    static const size_t latency=4;
+    struct interval_t
+    {
+        double tag;
+        double ms;
+    };
+    private:
+    std::array<GLuint,latency> m_queries;
+    std::array<double,latency> m_tags={};
+    std::array<bool,latency>   m_pending={};
+    size_t m_current=0;// the query of the next interval, the oldest pending
+    bool   m_active=false;
+    std::vector<interval_t> m_finished;
+    public:
+    CGpuTimer();
+    CGpuTimer(const CGpuTimer&)=delete;
+    CGpuTimer&operator=(const CGpuTimer&)=delete;
+
+    bool Begin(double tag);
+    void End();
+    const std::vector<interval_t>& Poll();
+    ~CGpuTimer();
+};
+
+#endif
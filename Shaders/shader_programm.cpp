@@ -115,11 +115,42 @@ void CShaderProgramm::m_glLinkProgram( )
   glCheckError();
 }
 
-GLint CShaderProgramm::m_glGetUniformLocation(const GLchar*str)const
+void CShaderProgramm::m_ResolveLocations()
 {
-  auto handler=glGetUniformLocation(m_handler,str);
-  glCheckError();
-  return handler;
+    m_locations.clear();
+    if(!m_handler) return;
+    GLint count=0,max_length=0;
+    glGetProgramiv(m_handler,GL_ACTIVE_UNIFORMS,&count);
+    glGetProgramiv(m_handler,GL_ACTIVE_UNIFORM_MAX_LENGTH,&max_length);
+    glCheckError();
+    std::string name(max_length,'\0');
+    for(GLint i=0;i<count;++i)
+    {
+        GLsizei length=0;
+        GLint   size;
+        GLenum  type;
+        glGetActiveUniform(m_handler,i,name.size(),&length,&size,&type,name.data());
+        glCheckError();
+        std::string uniform(name.data(),length);
+        const GLint location=glGetUniformLocation(m_handler,uniform.c_str());
+        glCheckError();
+        if(location==-1) continue;
+        if(uniform.size()>3&&uniform.compare(uniform.size()-3,3,"[0]")==0)
+        {
+            m_locations.emplace(uniform.substr(0,uniform.size()-3),location);
+        }
+        m_locations.emplace(std::move(uniform),location);
+    }
+}
+
+bool CShaderProgramm::BindUniformBlock(const char*name,GLuint binding)const
+{
+    const GLuint index=glGetUniformBlockIndex(m_handler,name);
+    glCheckError();
+    if(index==GL_INVALID_INDEX) return false;
+    glUniformBlockBinding(m_handler,index,binding);
+    glCheckError();
+    return true;
 }
 
 
@@ -132,6 +163,7 @@ CShaderProgramm& CShaderProgramm::operator=(CShaderProgramm&&other)
         glCheckError();
     }
     m_handler=other.m_handler;
+    m_locations=std::move(other.m_locations);
     other.m_handler=0;
     return *this;
 }
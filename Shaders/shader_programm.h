@@ -4,6 +4,8 @@
 
 #include <assert.h>
 #include <string>
+#include <string_view>
+#include <map>
 #include <type_traits>
 
 #include <GL/gl.h>
@@ -82,6 +84,9 @@ class CShader
 class CShaderProgramm
 {
     GLuint m_handler=0;
+    // locations of active uniforms by name, resolved once after linking,
+    // the elements of arrays are found by the name without [0] too
+    std::map<std::string,GLint,std::less<>> m_locations;
     CShaderProgramm(GLuint h):m_handler(h){}
     static GLuint m_glCreateProgram();
 
@@ -89,7 +94,7 @@ class CShaderProgramm
     void m_glAttachShader(GLuint);
     void m_glDetachShader(GLuint);
     void m_glLinkProgram();
-    GLint m_glGetUniformLocation(const GLchar*)const;
+    void m_ResolveLocations();
 
     static const CShaderProgramm*m_current;
     template<class...shaders_t>
@@ -112,7 +117,7 @@ class CShaderProgramm
     CShaderProgramm(const CShaderProgramm&)=delete;
     CShaderProgramm&operator=(const CShaderProgramm&)=delete;
 
-    CShaderProgramm(CShaderProgramm&&other)
+    CShaderProgramm(CShaderProgramm&&other):m_locations(std::move(other.m_locations))
     {
         m_handler=other.m_handler;
         other.m_handler=0;
@@ -128,6 +133,7 @@ class CShaderProgramm
         result.m_glLinkProgram();
         result.m_detach_all(shaders...);
         result.m_CheckError(error);
+        result.m_ResolveLocations();
         return result;
     }
     template<class...shaders_t>
@@ -142,10 +148,18 @@ class CShaderProgramm
     void   Use()const;
     GLuint Handler()const{return m_handler;}
     bool Valid()const{return m_handler;}
+    // -1 for inactive uniforms and for members of uniform blocks
+    GLint Location(std::string_view name)const
+    {
+        auto iter=m_locations.find(name);
+        return iter!=m_locations.end()? iter->second:-1;
+    }
+    // The block is read from the buffer bound to GL_UNIFORM_BUFFER binding point
+    bool BindUniformBlock(const char*name,GLuint binding)const;
     template<class T>
     auto get_uniform(const char*str)const
     {
-        return uniform_value<T>(m_glGetUniformLocation(str));
+        return uniform_value<T>(Location(str));
     }
     template<class T>
     auto get_uniform(const std::string&str)const
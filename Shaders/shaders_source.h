@@ -15,14 +15,21 @@ uniform mat4 full_matrix=mat4(vec4(1.0, 0.0, 0.0, 0.0),
                               vec4(0.0, 1.0, 0.0, 0.0),
                               vec4(0.0, 0.0, 0.1, 0.0),
                               vec4(0.0, 0.0, 0.0, 1.0));
+// instanced draws: the transform of each instance replaces the matrix above,
+// the full matrix is camera_matrix*instance_matrix*decode_matrix then
+layout (location = 3) in mat4 instance_matrix;
+uniform int  instanced=0;
+uniform mat4 camera_matrix;
+uniform mat4 decode_matrix=mat4(1.0);
 out vec3 out_color;
 
 
 
 void main()
 {
+   mat4 full=instanced==0? full_matrix:camera_matrix*instance_matrix*decode_matrix;
    out_color=color;
-   gl_Position = full_matrix*vec4(vertex_org,1.0);
+   gl_Position = full*vec4(vertex_org,1.0);
 };
 )";
 
@@ -43,13 +50,32 @@ uniform mat4 full_matrix=mat4(vec4(1.0, 0.0, 0.0, 0.0),
                               vec4(0.0, 1.0, 0.0, 0.0),
                               vec4(0.0, 0.0, 0.1, 0.0),
                               vec4(0.0, 0.0, 0.0, 1.0));
-
+// instanced draws: the transform of each instance replaces the matrix above,
+// the full matrix is camera_matrix*instance_matrix*decode_matrix then
+layout (location = 3) in mat4 instance_matrix;
+uniform int  instanced=0;
+uniform mat4 camera_matrix;
+uniform mat4 decode_matrix=mat4(1.0);
+uniform int       palette_colors=0;
+uniform sampler1D palette;
+uniform vec2      palette_range=vec2(0.0,1.0);
+
+// height colors: the palette from the bottom to the top of the bounded box
+vec3 palette_color(vec3 color)
+{
+    if(palette_colors==0) return color;
+    float height=palette_range.y-palette_range.x;
+    float u=height>0.0? clamp((vertex_org.z-palette_range.x)/height,0.0,1.0):0.0;
+    float texels=float(textureSize(palette,0));
+    return texture(palette,(u*(texels-1.0)+0.5)/texels).rgb;
+}
 
 
 void main()
 {
-   gl_Position = full_matrix*vec4(vertex_org,1.0);
-   out_color=vertex_color;
+   mat4 full=instanced==0? full_matrix:camera_matrix*instance_matrix*decode_matrix;
+   gl_Position = full*vec4(vertex_org,1.0);
+   out_color=palette_color(vertex_color);
 };
 )";
 
@@ -79,10 +105,14 @@ struct material_t
     float shininess;
 };
 
-uniform CLightSource light_source;
+// light source and camera, the same for all programs, written once per frame
+layout (std140) uniform frame_block
+{
+    CLightSource light_source;
+    vec3         view_org;
+};
 uniform material_t   material;
 uniform int two_side_specular=0;
-uniform vec3 view_org;
 
 uniform mat4 model_matrix4;
 uniform mat3 model_matrix3;
@@ -90,26 +120,55 @@ uniform mat4 full_matrix=mat4(vec4(1.0, 0.0, 0.0, 0.0),
                               vec4(0.0, 1.0, 0.0, 0.0),
                               vec4(0.0, 0.0, 0.1, 0.0),
                               vec4(0.0, 0.0, 0.0, 1.0));
+uniform int oct_normals=0;
+// instanced draws: the transform and the material of each instance replace
+// the uniforms above, the full matrix is camera_matrix*instance_matrix*decode_matrix
+layout (location = 3) in mat4 instance_matrix;
+layout (location = 7) in vec4 instance_material;// ambient, diffuse, specular, shininess
+uniform int  instanced=0;
+uniform mat4 camera_matrix;
+uniform mat4 decode_matrix=mat4(1.0);
+
+// normals of lean meshes are octahedral encoded in xy
+vec3 decode_normal(vec3 n)
+{
+    if(oct_normals==0) return n;
+    vec3 r=vec3(n.xy,1.0-abs(n.x)-abs(n.y));
+    float t=max(-r.z,0.0);
+    r.xy+=vec2(r.x>=0.0? -t:t,r.y>=0.0? -t:t);
+    return normalize(r);
+}
 
 out vec3 out_color;
 
 
 void main()
 {
+    mat4 model4=model_matrix4;
+    mat3 model3=model_matrix3;
+    mat4 full=full_matrix;
+    material_t surface=material;
+    if(instanced!=0)
+    {
+        model4=instance_matrix*decode_matrix;
+        model3=mat3(instance_matrix);
+        full=camera_matrix*model4;
+        surface=material_t(instance_material.x,instance_material.y,instance_material.z,instance_material.w);
+    }
     vec4 vertex4=vec4(vertex_org,1.0);
-    vec3 transform_normal=model_matrix3*vertex_normals;
-    vec4 transform_org=model_matrix4*vertex4;
+    vec3 transform_normal=model3*decode_normal(vertex_normals);
+    vec4 transform_org=model4*vertex4;
     vec3 S=normalize(light_source.position-transform_org.xyz);
-    vec3 color=light_source.ambient*material.ambient;
+    vec3 color=light_source.ambient*surface.ambient;
 
     if(two_side_specular==0)
     {
         float S_N=dot(S,transform_normal);
         if(S_N>0.0)
         {
-            color+=light_source.diffuse*material.diffuse*S_N;
+            color+=light_source.diffuse*surface.diffuse*S_N;
             float V_N=dot(reflect(-S,transform_normal),normalize(view_org-transform_org.xyz));
-            color+=pow(max(V_N,0.0),material.shininess)*light_source.specular*material.specular;
+            color+=pow(max(V_N,0.0),surface.shininess)*light_source.specular*surface.specular;
         }
 
     }
@@ -119,13 +178,13 @@ void main()
         if(dot(view_org-transform_org.xyz,transform_normal)>0.0 == S_N>0.0)
         {
             float V_N=dot(reflect(-S,transform_normal),normalize(view_org-transform_org.xyz));
-            color+=light_source.diffuse*material.diffuse*abs(S_N)+
-                   pow(max(V_N,0.0),material.shininess)*light_source.specular*material.specular;
+            color+=light_source.diffuse*surface.diffuse*abs(S_N)+
+                   pow(max(V_N,0.0),surface.shininess)*light_source.specular*surface.specular;
         }
     }
 
     out_color=color;
-    gl_Position = full_matrix*vertex4;
+    gl_Position = full*vertex4;
 };
 )";
 
@@ -147,10 +206,14 @@ struct CLightSource
     vec3 specular;
 };
 
-uniform CLightSource light_source;
+// light source and camera, the same for all programs, written once per frame
+layout (std140) uniform frame_block
+{
+    CLightSource light_source;
+    vec3         view_org;
+};
 uniform float        shininess;
 uniform int two_side_specular=0;
-uniform vec3 view_org;
 
 
 uniform mat4 model_matrix4;
@@ -159,26 +222,69 @@ uniform mat4 full_matrix=mat4(vec4(1.0, 0.0, 0.0, 0.0),
                               vec4(0.0, 1.0, 0.0, 0.0),
                               vec4(0.0, 0.0, 0.1, 0.0),
                               vec4(0.0, 0.0, 0.0, 1.0));
+uniform int oct_normals=0;
+// instanced draws: the transform and the material of each instance replace
+// the uniforms above, the full matrix is camera_matrix*instance_matrix*decode_matrix
+layout (location = 3) in mat4 instance_matrix;
+layout (location = 7) in vec4 instance_material;// the shininess in w
+uniform int  instanced=0;
+uniform mat4 camera_matrix;
+uniform mat4 decode_matrix=mat4(1.0);
+uniform int       palette_colors=0;
+uniform sampler1D palette;
+uniform vec2      palette_range=vec2(0.0,1.0);
+
+// height colors: the palette from the bottom to the top of the bounded box
+vec3 palette_color(vec3 color)
+{
+    if(palette_colors==0) return color;
+    float height=palette_range.y-palette_range.x;
+    float u=height>0.0? clamp((vertex_org.z-palette_range.x)/height,0.0,1.0):0.0;
+    float texels=float(textureSize(palette,0));
+    return texture(palette,(u*(texels-1.0)+0.5)/texels).rgb;
+}
+
+// normals of lean meshes are octahedral encoded in xy
+vec3 decode_normal(vec3 n)
+{
+    if(oct_normals==0) return n;
+    vec3 r=vec3(n.xy,1.0-abs(n.x)-abs(n.y));
+    float t=max(-r.z,0.0);
+    r.xy+=vec2(r.x>=0.0? -t:t,r.y>=0.0? -t:t);
+    return normalize(r);
+}
 
 out vec3 out_color;
 
 
 void main()
 {
+    mat4 model4=model_matrix4;
+    mat3 model3=model_matrix3;
+    mat4 full=full_matrix;
+    float power=shininess;
+    if(instanced!=0)
+    {
+        model4=instance_matrix*decode_matrix;
+        model3=mat3(instance_matrix);
+        full=camera_matrix*model4;
+        power=instance_material.w;
+    }
+    vec3 colors=palette_color(vertex_colors);
     vec4 vertex4=vec4(vertex_org,1.0);
-    vec3 transform_normal=model_matrix3*vertex_normals;
-    vec4 transform_org=model_matrix4*vertex4;
+    vec3 transform_normal=model3*decode_normal(vertex_normals);
+    vec4 transform_org=model4*vertex4;
     vec3 S=normalize(light_source.position-transform_org.xyz);
-    vec3 color=light_source.ambient*vertex_colors;
+    vec3 color=light_source.ambient*colors;
 
     if(two_side_specular==0)
     {
         float S_N=dot(S,transform_normal);
         if(S_N>0.0)
         {
-            color+=light_source.diffuse*vertex_colors*S_N;
+            color+=light_source.diffuse*colors*S_N;
             float V_N=dot(reflect(-S,transform_normal),normalize(view_org-transform_org.xyz));
-            color+=pow(max(V_N,0.0),shininess)*light_source.specular*vertex_colors;
+            color+=pow(max(V_N,0.0),power)*light_source.specular*colors;
         }
 
     }
@@ -188,19 +294,133 @@ void main()
         if(dot(view_org-transform_org.xyz,transform_normal)>0.0 == S_N>0.0)
         {
             float V_N=dot(reflect(-S,transform_normal),normalize(view_org-transform_org.xyz));
-            color+=light_source.diffuse*vertex_colors*abs(S_N)+
-                   pow(max(V_N,0.0),shininess)*light_source.specular*vertex_colors;
+            color+=light_source.diffuse*colors*abs(S_N)+
+                   pow(max(V_N,0.0),power)*light_source.specular*colors;
         }
     }
 
 
     out_color=color;
-    gl_Position = full_matrix*vertex4;
+    gl_Position = full*vertex4;
 };
 )";
 
 
 
+//////////////////////////////////////////////////////
+//      Surface evaluated on GPU
+/////////////////////////////////////////////////////
+
+// Follows "#version 330 core" and the definition of
+// vec3 surface(float s,float t,float time) of the mesh: there are no
+// attributes, the vertex gl_VertexID is the sample (i,j) of the column-major
+// matrix of (resolution.x+1) rows, as in the vertex buffer of the mesh.
+// The normals are the central differences over the grid steps.
+
+const char* gpu_surface_shader = R"(
+struct CLightSource
+{
+    vec3 position;
+    vec3 ambient;
+    vec3 diffuse;
+    vec3 specular;
+};
+
+struct material_t
+{
+    float ambient;
+    float diffuse;
+    float specular;
+    float shininess;
+};
+
+// light source and camera, the same for all programs, written once per frame
+layout (std140) uniform frame_block
+{
+    CLightSource light_source;
+    vec3         view_org;
+};
+uniform material_t material;
+uniform int  two_side_specular=0;
+// lit by the light source, the uniform color otherwise
+uniform int  specular=0;
+uniform vec3 color;
+
+uniform mat4 model_matrix4;
+uniform mat3 model_matrix3;
+uniform mat4 full_matrix;
+
+uniform vec2  s_range;
+uniform vec2  t_range;
+uniform ivec2 resolution;
+uniform float time;
+
+uniform int       palette_colors=0;
+uniform sampler1D palette;
+uniform vec2      palette_range=vec2(0.0,1.0);
+
+out vec3 out_color;
+
+vec3 palette_color(float z)
+{
+    float height=palette_range.y-palette_range.x;
+    float u=height>0.0? clamp((z-palette_range.x)/height,0.0,1.0):0.0;
+    float texels=float(textureSize(palette,0));
+    return texture(palette,(u*(texels-1.0)+0.5)/texels).rgb;
+}
+
+void main()
+{
+    int rows=resolution.x+1;
+    vec2 delta=vec2(s_range.y-s_range.x,t_range.y-t_range.x)/vec2(resolution);
+    float s=s_range.x+float(gl_VertexID%rows)*delta.x;
+    float t=t_range.x+float(gl_VertexID/rows)*delta.y;
+    vec3 vertex_org=surface(s,t,time);
+    vec4 vertex4=vec4(vertex_org,1.0);
+    gl_Position=full_matrix*vertex4;
+
+    vec3 colors=palette_colors==0? color:palette_color(vertex_org.z);
+    if(specular==0)
+    {
+        out_color=colors;
+        return;
+    }
+    // reflections of the material or of the palette colors
+    vec3 ambient=vec3(material.ambient);
+    vec3 diffuse=vec3(material.diffuse);
+    vec3 reflection=vec3(material.specular);
+    if(palette_colors!=0)
+    {
+        ambient=colors;
+        diffuse=colors;
+        reflection=colors;
+    }
+    vec3 s_tangent=surface(s+delta.x,t,time)-surface(s-delta.x,t,time);
+    vec3 t_tangent=surface(s,t+delta.y,time)-surface(s,t-delta.y,time);
+    vec3 transform_normal=model_matrix3*normalize(cross(s_tangent,t_tangent));
+    vec4 transform_org=model_matrix4*vertex4;
+    vec3 S=normalize(light_source.position-transform_org.xyz);
+    vec3 result=light_source.ambient*ambient;
+
+    float S_N=dot(S,transform_normal);
+    float V_N=dot(reflect(-S,transform_normal),normalize(view_org-transform_org.xyz));
+    if(two_side_specular==0)
+    {
+        if(S_N>0.0)
+        {
+            result+=light_source.diffuse*diffuse*S_N+
+                    pow(max(V_N,0.0),material.shininess)*light_source.specular*reflection;
+        }
+    }
+    else if(dot(view_org-transform_org.xyz,transform_normal)>0.0 == S_N>0.0)
+    {
+        result+=light_source.diffuse*diffuse*abs(S_N)+
+                pow(max(V_N,0.0),material.shininess)*light_source.specular*reflection;
+    }
+    out_color=result;
+}
+)";
+
 //////////////////////////////////////////////
 //  Base fragment shader
 /////////////////////////////////////////////
@@ -218,8 +438,6 @@ void main() {
 
 /** Fong shading */
 
-
-/*
 const char* fong_vertex_shader = R"(
 #version 330 core
 layout (location = 0) in vec3 vertex_org;
@@ -233,17 +451,46 @@ uniform mat4 full_matrix=mat4(vec4(1.0, 0.0, 0.0, 0.0),
                               vec4(0.0, 1.0, 0.0, 0.0),
                               vec4(0.0, 0.0, 0.1, 0.0),
                               vec4(0.0, 0.0, 0.0, 1.0));
+uniform int oct_normals=0;
+// instanced draws: the transform and the material of each instance replace
+// the uniforms above, the full matrix is camera_matrix*instance_matrix*decode_matrix
+layout (location = 3) in mat4 instance_matrix;
+layout (location = 7) in vec4 instance_material;// ambient, diffuse, specular, shininess
+uniform int  instanced=0;
+uniform mat4 camera_matrix;
+uniform mat4 decode_matrix=mat4(1.0);
+
+// normals of lean meshes are octahedral encoded in xy
+vec3 decode_normal(vec3 n)
+{
+    if(oct_normals==0) return n;
+    vec3 r=vec3(n.xy,1.0-abs(n.x)-abs(n.y));
+    float t=max(-r.z,0.0);
+    r.xy+=vec2(r.x>=0.0? -t:t,r.y>=0.0? -t:t);
+    return normalize(r);
+}
 
 out vec3 out_transform_normal;
 out vec3 out_transform_vertex;
+flat out vec4 out_material;
 
 
 
 void main()
 {
-    out_transform_normal=model_matrix3*vertex_normals;
-    out_transform_vertex=(model_matrix4*vec4(vertex_org,1.0)).xyz;
-    gl_Position = full_matrix*vec4(vertex_org,1.0);
+    mat4 model4=model_matrix4;
+    mat3 model3=model_matrix3;
+    mat4 full=full_matrix;
+    if(instanced!=0)
+    {
+        model4=instance_matrix*decode_matrix;
+        model3=mat3(instance_matrix);
+        full=camera_matrix*model4;
+    }
+    out_material=instance_material;
+    out_transform_normal=model3*decode_normal(vertex_normals);
+    out_transform_vertex=(model4*vec4(vertex_org,1.0)).xyz;
+    gl_Position = full*vec4(vertex_org,1.0);
 };
 )";
 
@@ -261,19 +508,61 @@ uniform mat4 full_matrix=mat4(vec4(1.0, 0.0, 0.0, 0.0),
                               vec4(0.0, 1.0, 0.0, 0.0),
                               vec4(0.0, 0.0, 0.1, 0.0),
                               vec4(0.0, 0.0, 0.0, 1.0));
+uniform int oct_normals=0;
+// instanced draws: the transform and the material of each instance replace
+// the uniforms above, the full matrix is camera_matrix*instance_matrix*decode_matrix
+layout (location = 3) in mat4 instance_matrix;
+layout (location = 7) in vec4 instance_material;// the shininess in w
+uniform int  instanced=0;
+uniform mat4 camera_matrix;
+uniform mat4 decode_matrix=mat4(1.0);
+uniform int       palette_colors=0;
+uniform sampler1D palette;
+uniform vec2      palette_range=vec2(0.0,1.0);
+
+// height colors: the palette from the bottom to the top of the bounded box
+vec3 palette_color(vec3 color)
+{
+    if(palette_colors==0) return color;
+    float height=palette_range.y-palette_range.x;
+    float u=height>0.0? clamp((vertex_org.z-palette_range.x)/height,0.0,1.0):0.0;
+    float texels=float(textureSize(palette,0));
+    return texture(palette,(u*(texels-1.0)+0.5)/texels).rgb;
+}
+
+// normals of lean meshes are octahedral encoded in xy
+vec3 decode_normal(vec3 n)
+{
+    if(oct_normals==0) return n;
+    vec3 r=vec3(n.xy,1.0-abs(n.x)-abs(n.y));
+    float t=max(-r.z,0.0);
+    r.xy+=vec2(r.x>=0.0? -t:t,r.y>=0.0? -t:t);
+    return normalize(r);
+}
 
 out vec3 out_transform_normal;
 out vec3 out_transform_vertex;
 out vec3 out_color;
+flat out float out_shininess;
 
 
 
 void main()
 {
-    out_transform_normal=model_matrix3*vertex_normals;
-    out_transform_vertex=(model_matrix4*vec4(vertex_org,1.0)).xyz;
-    gl_Position = full_matrix*vec4(vertex_org,1.0);
-    out_color=vertex_color;
+    mat4 model4=model_matrix4;
+    mat3 model3=model_matrix3;
+    mat4 full=full_matrix;
+    if(instanced!=0)
+    {
+        model4=instance_matrix*decode_matrix;
+        model3=mat3(instance_matrix);
+        full=camera_matrix*model4;
+    }
+    out_shininess=instance_material.w;
+    out_transform_normal=model3*decode_normal(vertex_normals);
+    out_transform_vertex=(model4*vec4(vertex_org,1.0)).xyz;
+    gl_Position = full*vec4(vertex_org,1.0);
+    out_color=palette_color(vertex_color);
 };
 )";
 
@@ -299,28 +588,37 @@ struct material_t
     float shininess;
 };
 
-uniform CLightSource light_source;
+// light source and camera, the same for all programs, written once per frame
+layout (std140) uniform frame_block
+{
+    CLightSource light_source;
+    vec3         view_org;
+};
 uniform material_t   material;
 uniform int two_side_specular=0;
-uniform vec3 view_org;
+uniform int instanced=0;
 
 in vec3 out_transform_normal;
 in vec3 out_transform_vertex;
+flat in vec4 out_material;
+out vec4 frag_out_color;
 
 
 void main()
 {
+    material_t surface=material;
+    if(instanced!=0) surface=material_t(out_material.x,out_material.y,out_material.z,out_material.w);
     vec3 S=normalize(light_source.position-out_transform_vertex);
-    vec3 color=light_source.ambient*material.ambient;
+    vec3 color=light_source.ambient*surface.ambient;
 
     if(two_side_specular==0)
     {
         float S_N=dot(S,out_transform_normal);
         if(S_N>0.0)
         {
-            color+=light_source.diffuse*material.diffuse*S_N;
+            color+=light_source.diffuse*surface.diffuse*S_N;
             float V_N=dot(reflect(-S,out_transform_normal),normalize(view_org-out_transform_vertex));
-            color+=pow(max(V_N,0.0),material.shininess)*light_source.specular*material.specular;
+            color+=pow(max(V_N,0.0),surface.shininess)*light_source.specular*surface.specular;
         }
 
     }
@@ -330,12 +628,12 @@ void main()
         if(dot(view_org-out_transform_vertex,out_transform_normal)>0.0 == S_N>0.0)
         {
             float V_N=dot(reflect(-S,out_transform_normal),normalize(view_org-out_transform_vertex));
-            color+=light_source.diffuse*material.diffuse*abs(S_N)+
-                   pow(max(V_N,0.0),material.shininess)*light_source.specular*material.specular;
+            color+=light_source.diffuse*surface.diffuse*abs(S_N)+
+                   pow(max(V_N,0.0),surface.shininess)*light_source.specular*surface.specular;
         }
     }
 
-    gl_FragColor=vec4(color,1.0);
+    frag_out_color=vec4(color,1.0);
 };
 )";
 
@@ -351,18 +649,26 @@ struct CLightSource
     vec3 specular;
 };
 
-uniform CLightSource light_source;
+// light source and camera, the same for all programs, written once per frame
+layout (std140) uniform frame_block
+{
+    CLightSource light_source;
+    vec3         view_org;
+};
 uniform float        shininess;
 uniform int two_side_specular=0;
-uniform vec3 view_org;
+uniform int instanced=0;
 
 
 in vec3 out_transform_vertex;
 in vec3 out_color;
 in vec3 out_transform_normal;
+flat in float out_shininess;
+out vec4 frag_out_color;
 
 void main()
 {
+    float power=instanced==0? shininess:out_shininess;
     vec3 S=normalize(light_source.position-out_transform_vertex);
     vec3 color=light_source.ambient*out_color;
 
@@ -373,7 +679,7 @@ void main()
         {
             color+=light_source.diffuse*out_color*S_N;
             float V_N=dot(reflect(-S,out_transform_normal),normalize(view_org-out_transform_vertex));
-            color+=pow(max(V_N,0.0),shininess)*light_source.specular*out_color;
+            color+=pow(max(V_N,0.0),power)*light_source.specular*out_color;
         }
 
     }
@@ -384,15 +690,14 @@ void main()
         {
             float V_N=dot(reflect(-S,out_transform_normal),normalize(view_org-out_transform_vertex));
             color+=light_source.diffuse*out_color*abs(S_N)+
-                   pow(max(V_N,0.0),shininess)*light_source.specular*out_color;
+                   pow(max(V_N,0.0),power)*light_source.specular*out_color;
         }
     }
 
 
-    gl_FragColor=vec4(color,1.0);
+    frag_out_color=vec4(color,1.0);
 };
 )";
-*/
 
 
 
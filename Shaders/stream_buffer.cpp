@@ -0,0 +1,179 @@
+#include <algorithm>
+#include <utility>
+
+#include <GL/glew.h>
+#include <GL/gl.h>
+
+#include "stream_buffer.h"
+
+namespace{
+
+// offsets of the parts are suitable for any attribute type
+const std::size_t region_alignment=256;
+
+std::size_t align_region(std::size_t bytes)
+{
+    return (bytes+region_alignment-1)/region_alignment*region_alignment;
+}
+
+}
+
+////////////////////////////////////////////////
+//                  CStreamBuffer
+////////////////////////////////////////////////
+
+CStreamBuffer::CStreamBuffer(bool persistent):
+m_persistent(persistent&&IsPersistentSupported())
+{
+    glGenBuffers(1,&m_handler);
+    glCheckError();
+}
+
+CStreamBuffer::CStreamBuffer(CStreamBuffer&&other):
+m_moved(true),m_persistent(false),m_handler(0)
+{
+    Swap(other);
+}
+
+CStreamBuffer&CStreamBuffer::operator=(CStreamBuffer&&other)
+{
+    if(this==&other) return *this;
+    CStreamBuffer temp(std::move(other));
+    Swap(temp);
+    return *this;
+}
+
+bool CStreamBuffer::IsPersistentSupported()
+{
+    return GLEW_ARB_buffer_storage||GLEW_VERSION_4_4;
+}
+
+void CStreamBuffer::m_Release()
+{
+    for(auto&fence:m_fences)
+    {
+        if(fence) glDeleteSync(fence);
+        fence=nullptr;
+    }
+    if(m_mapped||m_unmap)
+    {
+        glBindBuffer(GL_ARRAY_BUFFER,m_handler);
+        glUnmapBuffer(GL_ARRAY_BUFFER);
+        glBindBuffer(GL_ARRAY_BUFFER,0);
+        glCheckError();
+    }
+    m_mapped=nullptr;
+    m_unmap=false;
+}
+
+// Immutable storage can't grow, the new buffer is created,
+// the old one is alive, while the GPU uses it
+void CStreamBuffer::m_Reallocate(size_t region_bytes)
+{
+    m_Release();
+    glDeleteBuffers(1,&m_handler);
+    glGenBuffers(1,&m_handler);
+    glCheckError();
+
+    const GLbitfield flags=GL_MAP_WRITE_BIT|GL_MAP_PERSISTENT_BIT|GL_MAP_COHERENT_BIT;
+    glBindBuffer(GL_ARRAY_BUFFER,m_handler);
+    glBufferStorage(GL_ARRAY_BUFFER,regions*region_bytes,nullptr,flags);
+    glCheckError();
+    m_mapped=glMapBufferRange(GL_ARRAY_BUFFER,0,regions*region_bytes,flags);
+    glCheckError();
+    glBindBuffer(GL_ARRAY_BUFFER,0);
+    assert(m_mapped);
+    m_region_bytes=region_bytes;
+    m_region=0;
+}
+
+void CStreamBuffer::m_Wait(size_t region)
+{
+    GLsync&fence=m_fences[region];
+    if(!fence) return;
+    if(glClientWaitSync(fence,0,0)==GL_TIMEOUT_EXPIRED)
+    {
+        ++m_stalls;
+        while(glClientWaitSync(fence,GL_SYNC_FLUSH_COMMANDS_BIT,1000000)==GL_TIMEOUT_EXPIRED){}
+    }
+    glDeleteSync(fence);
+    fence=nullptr;
+}
+
+void*CStreamBuffer::m_Map(size_t size_of_type,size_t num_type)
+{
+    const size_t bytes=size_of_type*num_type;
+    assert(bytes>0&&!m_unmap);
+    m_sizeof_type=size_of_type;
+    m_num_elements=num_type;
+    if(!m_persistent)
+    {
+        // orphaning: the driver gives the new storage, if the old one is in use
+        glBindBuffer(GL_ARRAY_BUFFER,m_handler);
+        glBufferData(GL_ARRAY_BUFFER,bytes,nullptr,GL_STREAM_DRAW);
+        glCheckError();
+        void*ptr=glMapBufferRange(GL_ARRAY_BUFFER,0,bytes,GL_MAP_WRITE_BIT|GL_MAP_INVALIDATE_BUFFER_BIT);
+        glCheckError();
+        glBindBuffer(GL_ARRAY_BUFFER,0);
+        assert(ptr);
+        m_region_bytes=bytes;
+        m_unmap=true;
+        return ptr;
+    }
+    if(bytes>m_region_bytes)
+    {
+        m_Reallocate(align_region(std::max(bytes,m_region_bytes+m_region_bytes/2)));
+    }
+    else
+    {
+        m_region=(m_region+1)%regions;
+        m_Wait(m_region);
+    }
+    return static_cast<char*>(m_mapped)+m_region*m_region_bytes;
+}
+
+void CStreamBuffer::Unmap()
+{
+    // coherent memory is visible without unmapping
+    if(!m_unmap) return;
+    glBindBuffer(GL_ARRAY_BUFFER,m_handler);
+    glUnmapBuffer(GL_ARRAY_BUFFER);
+    glBindBuffer(GL_ARRAY_BUFFER,0);
+    glCheckError();
+    m_unmap=false;
+}
+
+void CStreamBuffer::Fence()
+{
+    if(!m_persistent||!m_mapped) return;
+    GLsync&fence=m_fences[m_region];
+    if(fence) glDeleteSync(fence);
+    fence=glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE,0);
+    glCheckError();
+}
+
+void CStreamBuffer::Swap(CStreamBuffer&other)
+{
+    std::swap(m_moved,other.m_moved);
+    std::swap(m_persistent,other.m_persistent);
+    std::swap(m_handler,other.m_handler);
+    std::swap(m_type_enum,other.m_type_enum);
+    std::swap(m_sizeof_type,other.m_sizeof_type);
+    std::swap(m_num_elements,other.m_num_elements);
+    std::swap(m_region_bytes,other.m_region_bytes);
+    std::swap(m_region,other.m_region);
+    std::swap(m_mapped,other.m_mapped);
+    std::swap(m_unmap,other.m_unmap);
+    std::swap(m_fences,other.m_fences);
+    std::swap(m_stalls,other.m_stalls);
+}
+
+CStreamBuffer::~CStreamBuffer()
+{
+    if(!m_moved)
+    {
+        m_Release();
+        glDeleteBuffers(1,&m_handler);
+        glCheckError();
+    }
+}
@@ -0,0 +1,81 @@
+#ifndef _stream_buffer_
+#define _stream_buffer_
+
+#include <assert.h>
+#include <array>
+
+#include <GL/gl.h>
+
+#include "../opengl_iface.h"
+#include "vao_managment.h"
+
+// Vertex buffer, which is rewritten entirely for every frame.
+// With ARB_buffer_storage the storage is mapped once, persistently and
+// coherently, and is divided into the ring of 'regions' parts: Map returns
+// the next part, which is waited by its fence, the previous parts may be
+// still read by the GPU. Fence must be called after the draws, which read
+// the part. Without the extension the buffer is orphaned by glBufferData
+// and mapped for every write, the offset is 0 then.
+
+class CStreamBuffer
+{
+    using size_t=std::size_t;
+    public:
+    static const size_t regions=3;
+    private:
+    bool   m_moved=false;
+    bool   m_persistent;
+    GLuint m_handler;
+    GLenum m_type_enum=GL_FLOAT;
+    size_t m_sizeof_type=0;
+    size_t m_num_elements=0;
+    size_t m_region_bytes=0;// capacity of one part
+    size_t m_region=0;
+    void*  m_mapped=nullptr;
+    bool   m_unmap=false;
+    std::array<GLsync,regions> m_fences={};
+    size_t m_stalls=0;
+
+    void*  m_Map(size_t size_of_type,size_t num_type);
+    void   m_Reallocate(size_t region_bytes);
+    void   m_Wait(size_t region);
+    void   m_Release();
+    public:
+    explicit CStreamBuffer(bool persistent=IsPersistentSupported());
+    CStreamBuffer(const CStreamBuffer&)=delete;
+    CStreamBuffer&operator=(const CStreamBuffer&)=delete;
+    CStreamBuffer(CStreamBuffer&&other);
+    CStreamBuffer&operator=(CStreamBuffer&&other);
+
+    static bool IsPersistentSupported();
+
+    // Memory for 'size' elements, valid until Unmap
+    template<class T>
+    T* Map(size_t size)
+    {
+        m_type_enum=type_to_enum<T>();
+        return static_cast<T*>(m_Map(sizeof(T),size));
+    }
+    void   Unmap();
+    // The part of the last Map is read by the commands before
+    void   Fence();
+
+    bool   IsPersistent()const{return m_persistent;}
+    GLenum TypeEnum()const{return m_type_enum;}
+    GLuint Handler()const{return m_handler;}
+    size_t SizeOfType()const{return m_sizeof_type;}
+    size_t Size()const{return m_num_elements;}
+    bool   Empty()const{return m_num_elements==0;}
+    bool   Valid()const{return m_sizeof_type!=0;}
+    // bytes from the start of the buffer to the last written part
+    size_t Offset()const{return m_persistent? m_region*m_region_bytes:0;}
+    // GPU memory of all parts
+    size_t Capacity()const{return m_persistent? regions*m_region_bytes:m_region_bytes;}
+    // Map had to wait, until the GPU has read the part
+    size_t Stalls()const{return m_stalls;}
+
+    void Swap(CStreamBuffer&other);
+    ~CStreamBuffer();
+};
+
+#endif
@@ -0,0 +1,67 @@
+#include <utility>
+
+#include "texture.h"
+
+////////////////////////////////////////////////
+//                  CTexture1D
+////////////////////////////////////////////////
+
+CTexture1D::CTexture1D()
+{
+    glGenTextures(1,&m_handler);
+    glCheckError();
+}
+
+CTexture1D& CTexture1D::operator=(CTexture1D&&other)
+{
+    if(this==&other) return *this;
+    if(!m_moved)
+    {
+        glDeleteTextures(1,&m_handler);
+        glCheckError();
+    }
+    m_handler=other.m_handler;
+    m_size=other.m_size;
+    m_moved=false;
+    other.m_moved=true;
+    return *this;
+}
+
+void CTexture1D::Write(const float*rgb,size_t texels)
+{
+    glBindTexture(GL_TEXTURE_1D,m_handler);
+    glCheckError();
+    // float texels keep colors out of [0,1], which are clamped after lighting
+    glTexImage1D(GL_TEXTURE_1D,0,GL_RGB32F,texels,0,GL_RGB,GL_FLOAT,rgb);
+    glCheckError();
+    glTexParameteri(GL_TEXTURE_1D,GL_TEXTURE_MIN_FILTER,GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_1D,GL_TEXTURE_MAG_FILTER,GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_1D,GL_TEXTURE_WRAP_S,GL_CLAMP_TO_EDGE);
+    glCheckError();
+    glBindTexture(GL_TEXTURE_1D,0);
+    glCheckError();
+    m_size=texels;
+}
+
+void CTexture1D::Bind(GLuint unit)const
+{
+    glActiveTexture(GL_TEXTURE0+unit);
+    glBindTexture(GL_TEXTURE_1D,m_handler);
+    glCheckError();
+}
+
+void CTexture1D::Swap(CTexture1D&other)
+{
+    std::swap(m_moved,other.m_moved);
+    std::swap(m_handler,other.m_handler);
+    std::swap(m_size,other.m_size);
+}
+
+CTexture1D::~CTexture1D()
+{
+    if(!m_moved)
+    {
+        glDeleteTextures(1,&m_handler);
+        glCheckError();
+    }
+}
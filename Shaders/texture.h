@@ -0,0 +1,41 @@
+#ifndef _texture_
+#define _texture_
+
+#include <assert.h>
+
+#include <GL/gl.h>
+
+#include "../opengl_iface.h"
+
+// One dimensional RGB texture with linear filtering, clamped to edges
+
+class CTexture1D
+{
+    using size_t=std::size_t;
+    bool   m_moved=false;
+    GLuint m_handler;
+    size_t m_size=0;
+    public:
+    CTexture1D();
+    CTexture1D(const CTexture1D&)=delete;
+    CTexture1D&operator=(const CTexture1D&)=delete;
+    CTexture1D(CTexture1D&&other)
+    {
+        m_handler=other.m_handler;
+        m_size=other.m_size;
+        other.m_moved=true;
+    }
+    CTexture1D&operator=(CTexture1D&&other);
+
+    GLuint Handler()const{return m_handler;}
+    size_t Size()const{return m_size;}
+    bool   Empty()const{return m_size==0;}
+    // 3 floats per texel
+    void   Write(const float*rgb,size_t texels);
+    void   Bind(GLuint unit)const;
+
+    void Swap(CTexture1D&other);
+    ~CTexture1D();
+};
+
+#endif
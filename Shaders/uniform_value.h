@@ -90,6 +90,8 @@ class uniform_value:public uniform_value_base
 
     uniform_value(GLint h):uniform_value_base(h){}
     public:
+    // the handle of no uniform
+    uniform_value():uniform_value_base(-1){}
     uniform_value& operator=(const T&val)
     {
         assert(m_handler!=-1);
@@ -121,6 +123,7 @@ class uniform_value<vec<T,dim>>:public uniform_value_base
     static_assert(availabele_uniform_scalar<T>());
     uniform_value(GLint h):uniform_value_base(h){}
     public:
+    uniform_value():uniform_value_base(-1){}
     template<class range_t>
     uniform_value&operator=(const range_t&rg)
     {
@@ -197,6 +200,7 @@ class uniform_value<mat<dim>>:public uniform_value_base
 {
     uniform_value(GLint h):uniform_value_base(h){}
     public:
+    uniform_value():uniform_value_base(-1){}
     template<class range_t>
     uniform_value&operator=(const range_t&rg)
     {
@@ -225,6 +229,7 @@ class uniform_value<T[dim]>:public uniform_value_base
     static_assert(availabele_uniform_scalar<T>()&&dim>0&&dim<5);
     uniform_value(GLint h):uniform_value_base(h){}
     public:
+    uniform_value():uniform_value_base(-1){}
     template<class range_t,typename=decltype(std::data(std::declval<const range_t&>())),
                            typename=decltype(std::size(std::declval<const range_t&>()))>
     uniform_value& operator=(const range_t&source)
@@ -259,6 +264,7 @@ class uniform_value<vec<T,dim>[array_dim]>:public uniform_value_base
     static_assert(availabele_uniform_scalar<T>()&&dim>1&&dim<5);
     uniform_value(GLint h):uniform_value_base(h){}
     public:
+    uniform_value():uniform_value_base(-1){}
     template<class range_t,typename=decltype(std::data(std::declval<const range_t&>())),
                            typename=decltype(std::size(std::declval<const range_t&>()))>
     uniform_value&operator=(const range_t&source)
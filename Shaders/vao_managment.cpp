@@ -5,6 +5,7 @@
 #include <GL/gl.h>
 
 #include "vao_managment.h"
+#include "stream_buffer.h"
 
 ////////////////////////////////////////////////
 //                  CBufferFormat
@@ -13,9 +14,10 @@
 bool CBufferFormat::operator==(const CBufferFormat&other)const
 {
     return m_normalize==other.m_normalize&&
-           m_start_ofset==other.m_normalize&&
+           m_start_ofset==other.m_start_ofset&&
            m_block_size==other.m_block_size&&
-           m_step==other.m_step;
+           m_step==other.m_step&&
+           m_divisor==other.m_divisor;
 }
 
 CBufferFormat&CBufferFormat::SetStartOffset(size_t offset)
@@ -42,6 +44,12 @@ CBufferFormat&CBufferFormat::SetNormalize(size_t norm)
     return *this;
 }
 
+CBufferFormat&CBufferFormat::SetDivisor(size_t divisor)
+{
+    m_divisor=divisor;
+    return *this;
+}
+
 ////////////////////////////////////////////////
 //                  CBaseBufferImpl
 ////////////////////////////////////////////////
@@ -92,6 +100,18 @@ void CBaseBufferImpl::m_Write(size_t size_of_el,size_t size_of_stor,const void*p
     glCheckError();
 }
 
+void CBaseBufferImpl::m_WriteSub(size_t first,size_t size_of_stor,const void*ptr)
+{
+    assert(first+size_of_stor<=m_num_elements);
+    if(!size_of_stor) return;
+    glBindBuffer(m_buffer_type, m_handler);
+    glCheckError();
+    glBufferSubData(m_buffer_type,first*m_sizeof_type,size_of_stor*m_sizeof_type,ptr);
+    glCheckError();
+    glBindBuffer(m_buffer_type, 0);
+    glCheckError();
+}
+
 std::size_t CBaseBufferImpl::m_Read(void*ptr,size_t bytes)const
 {
     size_t byte_for_read=std::min(bytes,m_sizeof_type*m_num_elements);
@@ -110,6 +130,13 @@ void CBaseBufferImpl::m_Swap(CBaseBufferImpl&other)
     std::swap(m_type_enum,other.m_type_enum);
 }
 
+void CBaseBufferImpl::BindBase(GLuint index)const
+{
+    assert(m_buffer_type==GL_UNIFORM_BUFFER);
+    glBindBufferBase(m_buffer_type,index,m_handler);
+    glCheckError();
+}
+
 CBaseBufferImpl::~CBaseBufferImpl()
 {
     if(m_sizeof_type!=0)
@@ -147,6 +174,9 @@ CVao& CVao::operator=(CVao&&other)
 const CVao& CVao::EnableLayout(GLuint layout_index,CBuffer&buff,const CBufferFormat&format)const
 {
     assert(buff.Valid());
+    // normalization is defined for integer types only
+    assert(!format.Normalize()||(buff.TypeEnum()!=GL_FLOAT&&buff.TypeEnum()!=GL_DOUBLE&&
+                                 buff.TypeEnum()!=GL_HALF_FLOAT));
     glBindVertexArray(m_handler);
     glCheckError();
     glBindBuffer(GL_ARRAY_BUFFER, buff.Handler());
@@ -158,6 +188,36 @@ const CVao& CVao::EnableLayout(GLuint layout_index,CBuffer&buff,const CBufferFor
                           format.Step()*buff.SizeOfType(),
                           (void*)(format.StartOfset()*buff.SizeOfType()));
     glCheckError();
+    glVertexAttribDivisor(layout_index,format.Divisor());
+    glCheckError();
+    glEnableVertexAttribArray(layout_index);
+    glCheckError();
+
+    glBindBuffer(GL_ARRAY_BUFFER,0);
+    glCheckError();
+    glBindVertexArray(0);
+    glCheckError();
+    return *this;
+}
+
+const CVao& CVao::EnableLayout(GLuint layout_index,const CStreamBuffer&buff,const CBufferFormat&format)const
+{
+    assert(buff.Valid());
+    assert(!format.Normalize()||(buff.TypeEnum()!=GL_FLOAT&&buff.TypeEnum()!=GL_DOUBLE&&
+                                 buff.TypeEnum()!=GL_HALF_FLOAT));
+    glBindVertexArray(m_handler);
+    glCheckError();
+    glBindBuffer(GL_ARRAY_BUFFER, buff.Handler());
+    glCheckError();
+    glVertexAttribPointer(layout_index,
+                          format.BlockSize(),
+                          buff.TypeEnum(),
+                          format.Normalize(),
+                          format.Step()*buff.SizeOfType(),
+                          (void*)(buff.Offset()+format.StartOfset()*buff.SizeOfType()));
+    glCheckError();
+    glVertexAttribDivisor(layout_index,format.Divisor());
+    glCheckError();
     glEnableVertexAttribArray(layout_index);
     glCheckError();
 
@@ -168,6 +228,17 @@ const CVao& CVao::EnableLayout(GLuint layout_index,CBuffer&buff,const CBufferFor
     return *this;
 }
 
+void CVao::DisableLayout(GLuint layout_index)const
+{
+    glBindVertexArray(m_handler);
+    glCheckError();
+    glDisableVertexAttribArray(layout_index);
+    glCheckError();
+    glVertexAttribDivisor(layout_index,0);
+    glCheckError();
+    glBindVertexArray(0);
+    glCheckError();
+}
 
 void CVao::DrawArraw(mode_t mode,size_t beg,size_t count)const
 {
@@ -179,6 +250,17 @@ void CVao::DrawArraw(mode_t mode,size_t beg,size_t count)const
     glCheckError();
 }
 
+void CVao::MultiDrawArrays(mode_t mode,const GLint*first,const GLsizei*count,size_t draws)const
+{
+    if(!draws) return;
+    glBindVertexArray(m_handler);
+    glCheckError();
+    glMultiDrawArrays(mode,first,count,draws);
+    glCheckError();
+    glBindVertexArray(0);
+    glCheckError();
+}
+
 void CVao::DrawElement(const CIndexBuffer&buff,mode_t mode,size_t count)const
 {
     assert(buff.Valid());
@@ -203,6 +285,25 @@ void CVao::DrawElement(const CIndexBuffer&buff,mode_t mode)const
     glCheckError();
 }
 
+void CVao::DrawElementInstanced(const CIndexBuffer&buff,mode_t mode,size_t instances)const
+{
+    assert(buff.Valid());
+    if(!instances) return;
+
+    glBindVertexArray(m_handler);
+    glCheckError();
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buff.Handler());
+    glCheckError();
+
+    glDrawElementsInstanced(mode,buff.Size(),buff.TypeEnum(),0,instances);
+    glCheckError();
+
+    glBindVertexArray(0);
+    glCheckError();
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    glCheckError();
+}
+
 void CVao::Swap(CVao&other)
 {
     std::swap(m_moved,other.m_moved);
@@ -9,6 +9,7 @@
 #include <GL/gl.h>
 
 #include "../opengl_iface.h"
+#include "vertex_convert.h"
 
 template<class T>
 constexpr GLenum type_to_enum()
@@ -22,6 +23,7 @@ constexpr GLenum type_to_enum()
     else if constexpr(std::is_same_v<decay_type,GLuint>) return GL_UNSIGNED_INT;
     else if constexpr(std::is_same_v<decay_type,GLfloat>) return GL_FLOAT;
     else if constexpr(std::is_same_v<decay_type,GLdouble>) return GL_DOUBLE;
+    else if constexpr(std::is_same_v<decay_type,half_t>) return GL_HALF_FLOAT;
 
     else static_assert(sizeof(T)==0, "No match");
 }
@@ -45,6 +47,7 @@ class CBufferFormat
     size_t m_start_ofset=0;
     size_t m_block_size=0;
     size_t m_step=0;
+    size_t m_divisor=0;
     CBufferFormat(size_t n,size_t s,size_t b,size_t step):
     m_normalize(n),m_start_ofset(s),m_block_size(b),m_step(step)
     {}
@@ -54,11 +57,18 @@ class CBufferFormat
     {
         return CBufferFormat{false,0,s,s};
     }
+    // Integer values are mapped onto [0,1] or [-1,1]
+    static CBufferFormat Normalized(size_t s)
+    {
+        return CBufferFormat{true,0,s,s};
+    }
 
     CBufferFormat&SetStartOffset(size_t);
     CBufferFormat&SetBlockSize(size_t);
     CBufferFormat&SetStep(size_t);
     CBufferFormat&SetNormalize(size_t);
+    // The value is advanced once per 'divisor' instances, 0 for every vertex
+    CBufferFormat&SetDivisor(size_t);
 
     bool operator==(const CBufferFormat&)const;
     bool operator!=(const CBufferFormat&other)const{return !(other==*this);}
@@ -67,6 +77,7 @@ class CBufferFormat
     size_t Gap()const{return m_step-m_block_size;}
     size_t Step()const{return m_step;}
     bool   Normalize()const{return m_normalize;}
+    size_t Divisor()const{return m_divisor;}
 };
 #undef value_wrapper
 
@@ -91,6 +102,7 @@ class CBaseBufferImpl
     protected:
     GLenum       m_type_enum;
     void         m_Write(size_t size_of_type,size_t num_type,const void*ptr,usage_t);
+    void         m_WriteSub(size_t first,size_t num_type,const void*ptr);
     size_t       m_Read(void*ptr,size_t bytes)const;
     void         m_Swap(CBaseBufferImpl&other);
 
@@ -112,6 +124,8 @@ class CBaseBufferImpl
     size_t Size()const{return m_num_elements;}
     bool   Empty()const{return m_num_elements==0;}
     bool   Valid()const{return m_sizeof_type!=0;}
+    // Indexed binding point of uniform buffers
+    void   BindBase(GLuint index)const;
     ~CBaseBufferImpl();
 };
 
@@ -156,6 +170,16 @@ class buffer_impl_t:public CBaseBufferImpl
         m_type_enum=type_to_enum<type>();
         m_Write(sizeof(type),std::size(r),std::data(r),usage);
     }
+    // Rewrite elements [first,first+size(r)) of allocated storage
+    template<class range_t,typename=decltype(std::data(std::declval<const range_t&>())),
+                           typename=decltype(std::size(std::declval<const range_t&>()))>
+    void WriteSub(size_t first,const range_t&r)
+    {
+        using type=std::decay_t<decltype(*std::data(r))>;
+        static_assert(m_acceptable_type<type,avail_t...>());
+        assert(type_to_enum<type>()==m_type_enum&&sizeof(type)==SizeOfType());
+        m_WriteSub(first,std::size(r),std::data(r));
+    }
 
     template<class T>
     size_t Read(T*ptr,size_t size)const
@@ -180,8 +204,12 @@ class buffer_impl_t:public CBaseBufferImpl
     friend class CVao;
 };
 
-using CBuffer=buffer_impl_t<GL_ARRAY_BUFFER,GLbyte,GLubyte,GLushort,GLint,GLuint,GLfloat,GLdouble>;
+using CBuffer=buffer_impl_t<GL_ARRAY_BUFFER,GLbyte,GLubyte,GLshort,GLushort,GLint,GLuint,half_t,GLfloat,GLdouble>;
 using CIndexBuffer=buffer_impl_t<GL_ELEMENT_ARRAY_BUFFER,GLubyte,GLushort,GLuint>;
+// std140 blocks, written as arrays of 4 byte values
+using CUniformBuffer=buffer_impl_t<GL_UNIFORM_BUFFER,GLfloat,GLint,GLuint>;
+
+class CStreamBuffer;
 
 
 class CVao
@@ -213,13 +241,17 @@ class CVao
 
     GLuint Handler()const{return m_handler;}
     const CVao& EnableLayout(GLuint,CBuffer&,const CBufferFormat&)const;
+    // the part of the stream, which is written last
+    const CVao& EnableLayout(GLuint,const CStreamBuffer&,const CBufferFormat&)const;
     void DisableLayout(GLuint)const;
     CBufferFormat GetFormatOfLayout(GLuint)const;
 
     void DrawArraw(mode_t,size_t ,size_t )const;
+    void MultiDrawArrays(mode_t,const GLint*,const GLsizei*,size_t)const;
 
     void DrawElement(const CIndexBuffer&,mode_t ,size_t )const;
     void DrawElement(const CIndexBuffer&,mode_t )const;
+    void DrawElementInstanced(const CIndexBuffer&,mode_t,size_t instances)const;
 
     void Swap(CVao&other);
     ~CVao();
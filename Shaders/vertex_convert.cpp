@@ -0,0 +1,191 @@
+#include <cstring>
+#include <cmath>
+
+#include "vertex_convert.h"
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#define VERTEX_CONVERT_SSE2
+#if defined(__GNUC__)
+#define VERTEX_CONVERT_F16C
+#endif
+#endif
+
+namespace{
+
+template<class T>
+T clamp_scale_round(float v,float lo,float hi,float scale)
+{
+    // the same order of comparisons, as in minps/maxps: NaN gives lo
+    v=v>lo? v:lo;
+    v=v<hi? v:hi;
+    return T(std::nearbyint(v*scale));
+}
+
+#ifdef VERTEX_CONVERT_SSE2
+// 4 floats clamped, scaled and rounded into 32 bit integers
+inline __m128i clamp_scale_round(const float*src,__m128 lo,__m128 hi,__m128 scale)
+{
+    __m128 v=_mm_loadu_ps(src);
+    v=_mm_min_ps(_mm_max_ps(v,lo),hi);
+    return _mm_cvtps_epi32(_mm_mul_ps(v,scale));
+}
+#endif
+
+#ifdef VERTEX_CONVERT_F16C
+__attribute__((target("f16c")))
+std::size_t float_to_half_f16c(const float*src,half_t*dst,std::size_t n)
+{
+    const int round=_MM_FROUND_TO_NEAREST_INT|_MM_FROUND_NO_EXC;
+    std::size_t i=0;
+    for(;i+8<=n;i+=8)
+    {
+        const __m128i lo=_mm_cvtps_ph(_mm_loadu_ps(src+i),round);
+        const __m128i hi=_mm_cvtps_ph(_mm_loadu_ps(src+i+4),round);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst+i),_mm_unpacklo_epi64(lo,hi));
+    }
+    return i;
+}
+#endif
+
+}
+
+///////////////////////////////////////////////////////////////
+//                    Half floats
+///////////////////////////////////////////////////////////////
+
+// Rounding of the mantissa to nearest even by integer addition,
+// denormals are produced by the float addition of magic number
+
+half_t float_to_half(float value)
+{
+    const std::uint32_t f32_infinity=255u<<23;
+    const std::uint32_t f16_max=(127u+16u)<<23;// 65520 and greater overflow
+    const std::uint32_t denorm_magic_bits=((127u-15u)+(23u-10u)+1u)<<23;
+    std::uint32_t f;
+    std::memcpy(&f,&value,sizeof(f));
+    const std::uint32_t sign=f&0x80000000u;
+    f^=sign;
+
+    std::uint16_t bits;
+    if(f>=f16_max)
+    {
+        bits=f>f32_infinity? 0x7e00:0x7c00;
+    }
+    else if(f<(113u<<23))
+    {
+        float denorm_magic,v;
+        std::memcpy(&denorm_magic,&denorm_magic_bits,sizeof(f));
+        std::memcpy(&v,&f,sizeof(f));
+        v+=denorm_magic;
+        std::memcpy(&f,&v,sizeof(f));
+        bits=std::uint16_t(f-denorm_magic_bits);
+    }
+    else
+    {
+        const std::uint32_t mantissa_odd=(f>>13)&1;
+        f+=(std::uint32_t(15-127)<<23)+0xfff;
+        f+=mantissa_odd;
+        bits=std::uint16_t(f>>13);
+    }
+    return half_t{std::uint16_t(bits|(sign>>16))};
+}
+
+float half_to_float(half_t h)
+{
+    const std::uint32_t sign=std::uint32_t(h.m_bits&0x8000)<<16;
+    const std::uint32_t exponent=(h.m_bits>>10)&0x1f;
+    const std::uint32_t mantissa=h.m_bits&0x3ff;
+    std::uint32_t f;
+    if(exponent==0x1f)
+    {
+        f=sign|0x7f800000u|(mantissa<<13);
+    }
+    else if(exponent!=0)
+    {
+        f=sign|((exponent+127-15)<<23)|(mantissa<<13);
+    }
+    else
+    {
+        // zero or denormal: mantissa*2^-24
+        const float v=std::ldexp(float(mantissa),-24);
+        std::memcpy(&f,&v,sizeof(f));
+        f|=sign;
+    }
+    float result;
+    std::memcpy(&result,&f,sizeof(f));
+    return result;
+}
+
+bool has_f16c()
+{
+#ifdef VERTEX_CONVERT_F16C
+    static const bool f16c=__builtin_cpu_supports("f16c");
+    return f16c;
+#else
+    return false;
+#endif
+}
+
+void float_to_half(const float*src,half_t*dst,std::size_t n)
+{
+    static_assert(sizeof(half_t)==2);
+    std::size_t i=0;
+#ifdef VERTEX_CONVERT_F16C
+    if(has_f16c()) i=float_to_half_f16c(src,dst,n);
+#endif
+    for(;i<n;++i) dst[i]=float_to_half(src[i]);
+}
+
+///////////////////////////////////////////////////////////////
+//                    Normalized integers
+///////////////////////////////////////////////////////////////
+
+void float_to_snorm16(const float*src,std::int16_t*dst,std::size_t n)
+{
+    std::size_t i=0;
+#ifdef VERTEX_CONVERT_SSE2
+    const __m128 lo=_mm_set1_ps(-1.0f),hi=_mm_set1_ps(1.0f),scale=_mm_set1_ps(32767.0f);
+    for(;i+8<=n;i+=8)
+    {
+        const __m128i a=clamp_scale_round(src+i,lo,hi,scale);
+        const __m128i b=clamp_scale_round(src+i+4,lo,hi,scale);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst+i),_mm_packs_epi32(a,b));
+    }
+#endif
+    for(;i<n;++i) dst[i]=clamp_scale_round<std::int16_t>(src[i],-1.0f,1.0f,32767.0f);
+}
+
+void float_to_snorm8(const float*src,std::int8_t*dst,std::size_t n)
+{
+    std::size_t i=0;
+#ifdef VERTEX_CONVERT_SSE2
+    const __m128 lo=_mm_set1_ps(-1.0f),hi=_mm_set1_ps(1.0f),scale=_mm_set1_ps(127.0f);
+    for(;i+16<=n;i+=16)
+    {
+        const __m128i a=_mm_packs_epi32(clamp_scale_round(src+i,lo,hi,scale),
+                                        clamp_scale_round(src+i+4,lo,hi,scale));
+        const __m128i b=_mm_packs_epi32(clamp_scale_round(src+i+8,lo,hi,scale),
+                                        clamp_scale_round(src+i+12,lo,hi,scale));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst+i),_mm_packs_epi16(a,b));
+    }
+#endif
+    for(;i<n;++i) dst[i]=clamp_scale_round<std::int8_t>(src[i],-1.0f,1.0f,127.0f);
+}
+
+void float_to_unorm8(const float*src,std::uint8_t*dst,std::size_t n)
+{
+    std::size_t i=0;
+#ifdef VERTEX_CONVERT_SSE2
+    const __m128 lo=_mm_set1_ps(0.0f),hi=_mm_set1_ps(1.0f),scale=_mm_set1_ps(255.0f);
+    for(;i+16<=n;i+=16)
+    {
+        const __m128i a=_mm_packs_epi32(clamp_scale_round(src+i,lo,hi,scale),
+                                        clamp_scale_round(src+i+4,lo,hi,scale));
+        const __m128i b=_mm_packs_epi32(clamp_scale_round(src+i+8,lo,hi,scale),
+                                        clamp_scale_round(src+i+12,lo,hi,scale));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst+i),_mm_packus_epi16(a,b));
+    }
+#endif
+    for(;i<n;++i) dst[i]=clamp_scale_round<std::uint8_t>(src[i],0.0f,1.0f,255.0f);
+}
@@ -0,0 +1,32 @@
+#ifndef _vertex_convert_
+#define _vertex_convert_
+
+#include <cstddef>
+#include <cstdint>
+
+// Conversion of float attributes into compact vertex formats.
+// The kernels use SSE2 (and F16C for halfs, if the processor supports it)
+// on x86, otherwise the scalar code, results are the same in both cases:
+// round to nearest even, NaN of normalized formats is clamped to the minimum.
+
+// IEEE 754 binary16, uploaded as GL_HALF_FLOAT
+struct half_t
+{
+    std::uint16_t m_bits=0;
+};
+
+half_t float_to_half(float);
+float  half_to_float(half_t);
+
+void float_to_half(const float*src,half_t*dst,std::size_t n);
+// [-1,1] -> [-32767,32767]
+void float_to_snorm16(const float*src,std::int16_t*dst,std::size_t n);
+// [-1,1] -> [-127,127]
+void float_to_snorm8(const float*src,std::int8_t*dst,std::size_t n);
+// [0,1] -> [0,255]
+void float_to_unorm8(const float*src,std::uint8_t*dst,std::size_t n);
+
+// The kernels use F16C instructions for halfs
+bool has_f16c();
+
+#endif
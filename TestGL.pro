@@ -23,7 +23,7 @@ CONFIG+=qt
 
 INCLUDEPATH =/home/roma/EIGEN_ROOT/eigen-3.4.0
 
-LIBS +=-lGLEW
+LIBS +=-lGLEW -lpthread
 
 # The following define makes your compiler emit warnings if you use
 # any feature of Qt which has been marked as deprecated (the exact warnings
@@ -44,12 +44,21 @@ view_ruling.cpp\
 ../../CppProjects/json11/json11.cpp\
 Shaders/shader_programm.cpp\
 Shaders/vao_managment.cpp\
+Shaders/vertex_convert.cpp\
+Shaders/texture.cpp\
+Shaders/stream_buffer.cpp\
+Shaders/gpu_timer.cpp\
 functional_mesh.cpp\
+profiler.cpp\
+animation_cache.cpp\
+implicit_mesh.cpp\
+mesh_export.cpp\
 Shaders/uniform_value.cpp\
 legacy_render.cpp\
 light_source.cpp\
 rigid_transform.cpp\
 scene.cpp\
+grid_indices.cpp\
 plot_2D_base.cpp \
 plot_2D_opengl.cpp\
 plot_2D_qt.cpp\
@@ -65,16 +74,25 @@ view_ruling.h\
 ../BaseLibraries/GEOMETRY/vecalg.h\
 ../BaseLibraries/Expression/expression_parser.h\
 ../BaseLibraries/Expression/function_pool.h\
+../BaseLibraries/Expression/glsl_codegen.h\
 ../BaseLibraries/Expression/reversed_sequence.h\
 ../BaseLibraries/Expression/string_util.h\
 ../BaseLibraries/Expression/dependency_graph.h\
 ../../CppProjects/json11/json11.hpp\
 Shaders/shader_programm.h\
 Shaders/vao_managment.h\
+Shaders/vertex_convert.h\
+Shaders/texture.h\
+Shaders/stream_buffer.h\
+Shaders/gpu_timer.h\
 Shaders/shader_programm.h\
 Shaders/uniform_value.h\
 legacy_render.h\
+grid_indices.h\
 functional_mesh.h\
+animation_cache.h\
+implicit_mesh.h\
+mesh_export.h\
 rigid_transform.h\
 legacy_render.h\
 scene.h\
@@ -84,7 +102,9 @@ plot_2D_qt.h\
 main_window.h \
 view_widget.h\
 json_convert.h\
-rect_mesh.h
+rect_mesh.h\
+parallel_for.h\
+profiler.h
 
 
 
@@ -0,0 +1,128 @@
+#include <assert.h>
+#include <algorithm>
+#include <cmath>
+
+#include "animation_cache.h"
+
+///////////////////////////////////////////////////////////////
+//                    CAnimationCache
+///////////////////////////////////////////////////////////////
+
+CAnimationCache::CAnimationCache(float period,size_t frames,size_t max_bytes,
+                                 size_t rows,size_t cols,fill_functor_t fill):
+m_period(period),
+m_frames(frames),
+m_fill_functor(std::move(fill))
+{
+    assert(period>0&&frames>1);
+    const size_t frame_bytes=std::max<size_t>(rows*cols*sizeof(point_t),1);
+    m_slots.resize(std::clamp<size_t>(max_bytes/frame_bytes,2,frames));
+    for(auto&slot:m_slots) slot.m_points.resize(rows,cols);
+    m_worker=std::thread(&CAnimationCache::m_Work,this);
+}
+
+CAnimationCache::slot_t* CAnimationCache::m_Find(int frame)
+{
+    auto iter=std::find_if(m_slots.begin(),m_slots.end(),
+                           [frame](const slot_t&slot){return slot.m_frame==frame;});
+    return iter!=m_slots.end()? &*iter:nullptr;
+}
+
+bool CAnimationCache::m_InWindow(int frame)const
+{
+    int ahead=(frame-m_play_frame+m_frames)%m_frames;
+    return ahead<static_cast<int>(m_slots.size());
+}
+
+void CAnimationCache::m_Work()
+{
+    std::unique_lock lock(m_mutex);
+    while(!m_stop)
+    {
+        // the nearest frame of the window, which is absent in the ring
+        int frame=-1;
+        for(size_t i=0;i<m_slots.size();++i)
+        {
+            int candidate=(m_play_frame+i)%m_frames;
+            if(!m_Find(candidate))
+            {
+                frame=candidate;
+                break;
+            }
+        }
+        slot_t*slot=nullptr;
+        if(frame!=-1)
+        {
+            auto iter=std::find_if(m_slots.begin(),m_slots.end(),[this](const slot_t&slot)
+            {
+                return slot.m_frame==-1||!m_InWindow(slot.m_frame);
+            });
+            if(iter!=m_slots.end()) slot=&*iter;
+        }
+        if(!slot)
+        {
+            m_condition.wait(lock);
+            continue;
+        }
+        slot->m_frame=frame;
+        slot->m_ready=false;
+        lock.unlock();
+        m_fill_functor(slot->m_points,frame*m_period/m_frames);
+        lock.lock();
+        slot->m_ready=true;
+        m_condition.notify_all();
+    }
+}
+
+void CAnimationCache::Frame(float time,matrix_t&points)
+{
+    float phase=std::fmod(time,m_period);
+    if(phase<0) phase+=m_period;
+    const float position=phase/m_period*m_frames;
+    const int   frame=std::min(static_cast<int>(position),m_frames-1);
+    const int   next=(frame+1)%m_frames;
+    const float alpha=position-frame;
+
+    std::unique_lock lock(m_mutex);
+    if(m_play_frame!=frame)
+    {
+        m_play_frame=frame;
+        m_condition.notify_all();
+    }
+    auto ready=[this](int frame)
+    {
+        auto*slot=m_Find(frame);
+        return slot&&slot->m_ready;
+    };
+    m_condition.wait(lock,[&]{return ready(frame)&&(alpha==0||ready(next));});
+    const matrix_t&current=m_Find(frame)->m_points;
+    if(alpha>0)
+    {
+        const matrix_t&following=m_Find(next)->m_points;
+        points.resize(current.rows(),current.cols());
+        for(decltype(current.size()) i=0;i<current.size();++i)
+        {
+            points(i)=(1-alpha)*current(i)+alpha*following(i);
+        }
+    }
+    else
+    {
+        points=current;
+    }
+}
+
+std::size_t CAnimationCache::ReadyFrames()const
+{
+    std::lock_guard lock(m_mutex);
+    return std::count_if(m_slots.begin(),m_slots.end(),[](const slot_t&slot){return slot.m_ready;});
+}
+
+CAnimationCache::~CAnimationCache()
+{
+    {
+        std::lock_guard lock(m_mutex);
+        m_stop=true;
+    }
+    m_condition.notify_all();
+    m_worker.join();
+}
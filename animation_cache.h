@@ -0,0 +1,62 @@
+#ifndef  _animation_cache_
+#define  _animation_cache_
+
+#include <functional>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include <Eigen/Core>
+
+// CAnimationCache - frames of a surface, periodic in time,
+// computed by a background thread into a bounded ring of slots.
+// If all frames fit in the memory budget, they are computed once and kept,
+// otherwise the ring holds a window of frames, starting from the played one.
+// The fill functor is called only from the worker thread.
+
+class CAnimationCache
+{
+    public:
+    using point_t=Eigen::Vector3f;
+    using matrix_t=Eigen::Matrix<point_t,Eigen::Dynamic,Eigen::Dynamic>;
+    using fill_functor_t=std::function<void(matrix_t&,float)>;
+    using size_t=std::size_t;
+    private:
+    struct slot_t
+    {
+        matrix_t m_points;
+        int      m_frame=-1;
+        bool     m_ready=false;
+    };
+    const float          m_period;
+    const int            m_frames;
+    std::vector<slot_t>  m_slots;
+    fill_functor_t       m_fill_functor;
+
+    mutable std::mutex      m_mutex;
+    std::condition_variable m_condition;
+    int                     m_play_frame=0;
+    bool                    m_stop=false;
+    std::thread             m_worker;
+
+    slot_t* m_Find(int frame);
+    bool    m_InWindow(int frame)const;
+    void    m_Work();
+    public:
+    CAnimationCache(float period,size_t frames,size_t max_bytes,
+                    size_t rows,size_t cols,fill_functor_t);
+    CAnimationCache(const CAnimationCache&)=delete;
+    CAnimationCache&operator=(const CAnimationCache&)=delete;
+
+    // Points of surface in the moment 'time', linearly interpolated
+    // between the neighbouring frames. Waits, if they aren't computed yet.
+    void   Frame(float time,matrix_t&points);
+    float  Period()const{return m_period;}
+    size_t Frames()const{return m_frames;}
+    size_t Capacity()const{return m_slots.size();}
+    size_t ReadyFrames()const;
+    ~CAnimationCache();
+};
+
+#endif
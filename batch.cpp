@@ -0,0 +1,373 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <chrono>
+#include <filesystem>
+#include <clocale>
+#include <limits>
+
+#include "../../CppProjects/json11/json11.hpp"
+#include "../BaseLibraries/Expression/string_util.h"
+#include "json_convert.h"
+#include "functional_mesh.h"
+#include "implicit_mesh.h"
+#include "mesh_export.h"
+#include "plot_2D_base.h"
+
+// GraphViewerBatch - evaluation of meshes and 2D plots without Qt and OpenGL
+//
+//   GraphViewerBatch <pool.json> <scene.json> [--report <file>] [--output-dir <dir>]
+//
+// The pool is loaded by FromJson, the scene by SceneFromJson, both can be
+// in the same file. Every mesh and plot is evaluated in the given times,
+// optionally exported, implicit surfaces are meshed once. The report
+// in json is written to stdout or file.
+// Exit codes: 0 - success, 1 - invalid arguments, 2 - invalid json,
+// 3 - error in functions, evaluation or export.
+
+using json11::Json;
+using std::string;
+using std::vector;
+
+namespace{
+
+enum exit_code_t{success_id=0,arguments_id=1,input_id=2,evaluation_id=3};
+
+struct options_t
+{
+    string pool_path;
+    string scene_path;
+    string report_path;
+    std::filesystem::path output_dir;
+};
+
+const char*usage="usage: GraphViewerBatch <pool.json> <scene.json> "
+                 "[--report <file>] [--output-dir <dir>]";
+
+double milliseconds(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double,std::milli>(std::chrono::steady_clock::now()-start).count();
+}
+
+bool read_file(const string&path,string&content)
+{
+    std::ifstream file(path,std::ios::binary);
+    if(!file) return false;
+    std::stringstream stream;
+    stream<<file.rdbuf();
+    content=stream.str();
+    return true;
+}
+
+bool depends_on_time(const vector<string>&bodies)
+{
+    return std::any_of(bodies.begin(),bodies.end(),[](const string&body)
+    {
+        return sutil::find_identifier(body,string("time"))!=body.end();
+    });
+}
+
+// Path of export: relative paths are placed in output directory,
+// index of time is appended to the name, if there are several times
+string export_path(const options_t&opt,const string&path,size_t time_index,size_t times)
+{
+    std::filesystem::path result(path);
+    if(result.is_relative()&&!opt.output_dir.empty()) result=opt.output_dir/result;
+    if(times>1)
+    {
+        result.replace_filename(result.stem().string()+"_"+std::to_string(time_index)+
+                                result.extension().string());
+    }
+    return result.string();
+}
+
+template<class vector_t>
+Json vector_json(const vector_t&v)
+{
+    Json::array result;
+    for(decltype(v.size()) i=0;i<v.size();++i) result.push_back(v[i]);
+    return result;
+}
+
+///////////////////////////////////////////////////////////////
+//                    Meshes
+///////////////////////////////////////////////////////////////
+
+string build_mesh(const mesh_description_t&desc,const CFunctionPool&pool,CFunctionalMesh&mesh)
+{
+    expr::parse_error_t error;
+    const auto hint=depends_on_time(desc.functions)? CFunctionalMesh::dynamic_id:
+                                                     CFunctionalMesh::static_id;
+    if(desc.kind=="parametric")
+    {
+        auto _x=pool.CreateFunction({"s","t","time"},desc.functions[0],error);
+        if(error) return "Error in x(...):"+error.detail();
+        auto _y=pool.CreateFunction({"s","t","time"},desc.functions[1],error);
+        if(error) return "Error in y(...):"+error.detail();
+        auto _z=pool.CreateFunction({"s","t","time"},desc.functions[2],error);
+        if(error) return "Error in z(...):"+error.detail();
+        auto ftr=[_x,_y,_z](float s,float t,float time)
+        {
+            return Eigen::Vector3f(_x(s,t,time),_y(s,t,time),_z(s,t,time));
+        };
+        mesh.SetMeshFunctor(ftr,hint);
+    }
+    else
+    {
+        const vector<string> args=desc.kind=="cartesian"? vector<string>{"x","y","time"}:
+                                  desc.kind=="spherical"? vector<string>{"t","phi","time"}:
+                                                          vector<string>{"r","phi","time"};
+        auto f=pool.CreateFunction(args,desc.functions[0],error);
+        if(error) return "Error:"+error.detail();
+        auto ftr=[f](float s,float t,float time){return f(s,t,time);};
+        if(desc.kind=="cartesian")      mesh.SetMeshFunctor(plot::cartesian(ftr),hint);
+        else if(desc.kind=="spherical") mesh.SetMeshFunctor(plot::spherical(ftr),hint);
+        else                            mesh.SetMeshFunctor(plot::cylindrical(ftr),hint);
+    }
+    mesh.SetRange(desc.s_range,desc.t_range);
+    mesh.SetResolution(desc.s_resolution,desc.t_resolution);
+    mesh.RenderingTraits().SetSurface(true).SetSpecular(true);
+    return {};
+}
+
+string evaluate_mesh(const mesh_description_t&desc,const CFunctionPool&pool,
+                     const options_t&opt,Json::array&report)
+{
+    CFunctionalMesh mesh;
+    auto err=build_mesh(desc,pool,mesh);
+    if(!err.empty()) return err;
+
+    CMeshExporter exporter;
+    if(!desc.export_path.empty())
+    {
+        auto format=CMeshExporter::FormatOfPath(desc.export_path);
+        if(!format) return "Unknown format of export:"+desc.export_path;
+        exporter.SetFormat(*format);
+    }
+    for(size_t i=0;i<desc.times.size();++i)
+    {
+        const float time=desc.times[i];
+        auto start=std::chrono::steady_clock::now();
+        mesh.UpdateData(time);
+        const double evaluate_ms=milliseconds(start);
+
+        const auto&points=*mesh.Points();
+        size_t invalid=0;
+        for(decltype(points.size()) k=0;k<points.size();++k) invalid+=!points(k).allFinite();
+        const auto&box=*mesh.BoundedBox();
+        Json::object item={{"name",desc.name},
+                           {"kind",desc.kind},
+                           {"time",time},
+                           {"resolution",Json::array{int(desc.s_resolution),int(desc.t_resolution)}},
+                           {"vertices",int(points.size())},
+                           {"invalid",int(invalid)},
+                           {"box",Json::array{vector_json(box.first),vector_json(box.second)}},
+                           {"evaluate_ms",evaluate_ms}};
+        if(!desc.export_path.empty())
+        {
+            const string path=export_path(opt,desc.export_path,i,desc.times.size());
+            err=exporter.Export(mesh,path,time);
+            if(!err.empty()) return err;
+            const auto&stat=exporter.Statistics();
+            item["export"]=Json::object{{"path",path},
+                                        {"bytes",double(stat.bytes)},
+                                        {"triangles",double(stat.triangles)},
+                                        {"export_ms",stat.seconds*1000}};
+        }
+        report.push_back(item);
+    }
+    return {};
+}
+
+///////////////////////////////////////////////////////////////
+//                    Implicit surfaces
+///////////////////////////////////////////////////////////////
+
+string evaluate_implicit(const implicit_description_t&desc,const CFunctionPool&pool,Json::array&report)
+{
+    expr::parse_error_t error;
+    auto f=pool.CreateFunction({"x","y","z"},desc.function,error);
+    if(error) return "Error:"+error.detail();
+    CImplicitMesh mesh;
+    // the blocks are sampled in parallel, each thread by its own copy
+    mesh.SetFunctorMaker([&pool,f=pool.CloneFunction(f)]{return CImplicitMesh::functor_t(pool.CloneFunction(f));});
+    mesh.SetIsoValue(desc.iso)
+        .SetBox({desc.box[0].first,desc.box[1].first,desc.box[2].first},
+                {desc.box[0].second,desc.box[1].second,desc.box[2].second})
+        .SetResolution(desc.resolution[0],desc.resolution[1],desc.resolution[2]);
+    auto start=std::chrono::steady_clock::now();
+    mesh.UpdateData();
+    const double evaluate_ms=milliseconds(start);
+
+    const auto&stat=mesh.Statistics();
+    report.push_back(Json::object{{"name",desc.name},
+                                  {"kind","implicit"},
+                                  {"resolution",Json::array{int(desc.resolution[0]),int(desc.resolution[1]),int(desc.resolution[2])}},
+                                  {"vertices",int(mesh.Vertices().size())},
+                                  {"triangles",int(mesh.Triangles())},
+                                  {"blocks",int(stat.blocks)},
+                                  {"active_blocks",int(stat.active_blocks)},
+                                  {"evaluations",double(stat.evaluations)},
+                                  {"evaluate_ms",evaluate_ms}});
+    return {};
+}
+
+///////////////////////////////////////////////////////////////
+//                    2D plots
+///////////////////////////////////////////////////////////////
+
+string build_plot(const plot_description_t&desc,const CFunctionPool&pool,CPlot2D&plot)
+{
+    expr::parse_error_t error;
+    CPlot2D::traits_t::m_num_points=desc.points;
+    if(desc.kind=="parametric")
+    {
+        auto _x=pool.CreateFunction({"s","time"},desc.functions[0],error);
+        if(error) return "Error in x(...):"+error.detail();
+        auto _y=pool.CreateFunction({"s","time"},desc.functions[1],error);
+        if(error) return "Error in y(...):"+error.detail();
+        auto graph=CPlot2D::make_parametric_dyn(_x,_y,desc.range);
+        graph.m_is_dynamic=depends_on_time(desc.functions);
+        plot.AddPlot(graph);
+    }
+    else if(desc.kind=="polar")
+    {
+        auto f=pool.CreateFunction({"phi","time"},desc.functions[0],error);
+        if(error) return "Error:"+error.detail();
+        auto graph=CPlot2D::make_polar_dyn(f);
+        graph.m_param_range=desc.range;
+        graph.m_is_dynamic=depends_on_time(desc.functions);
+        plot.AddPlot(graph);
+    }
+    else
+    {
+        auto f=pool.CreateFunction({"x","time"},desc.functions[0],error);
+        if(error) return "Error:"+error.detail();
+        auto graph=CPlot2D::make_cartesian_dyn(f,desc.range);
+        graph.m_is_dynamic=depends_on_time(desc.functions);
+        plot.AddPlot(graph);
+    }
+    return {};
+}
+
+string evaluate_plot(const plot_description_t&desc,const CFunctionPool&pool,
+                     const options_t&opt,Json::array&report)
+{
+    CPlot2D plot;
+    auto err=build_plot(desc,pool,plot);
+    if(!err.empty()) return err;
+    for(size_t i=0;i<desc.times.size();++i)
+    {
+        const float time=desc.times[i];
+        // the plot is filled in its creation, so the fill is timed itself
+        auto start=std::chrono::steady_clock::now();
+        plot.Plot(0).Fill(time);
+        const double evaluate_ms=milliseconds(start);
+
+        const auto&points=plot.Plot(0).Points();
+        const auto&box=plot.Plot(0).Box();
+        size_t invalid=std::count_if(points.begin(),points.end(),[](auto&p){return !p.allFinite();});
+        Json::object item={{"name",desc.name},
+                           {"kind",desc.kind},
+                           {"time",time},
+                           {"points",int(points.size())},
+                           {"invalid",int(invalid)},
+                           {"box",Json::array{vector_json(box.min()),vector_json(box.max())}},
+                           {"evaluate_ms",evaluate_ms}};
+        if(!desc.export_path.empty())
+        {
+            const string path=export_path(opt,desc.export_path,i,desc.times.size());
+            std::ofstream file(path);
+            if(!file) return "Can't open file:"+path;
+            start=std::chrono::steady_clock::now();
+            file.precision(std::numeric_limits<float>::max_digits10);
+            file<<"x,y\n";
+            for(const auto&p:points) file<<p[0]<<','<<p[1]<<'\n';
+            if(!file) return "Write error:"+path;
+            item["export"]=Json::object{{"path",path},{"export_ms",milliseconds(start)}};
+        }
+        report.push_back(item);
+    }
+    return {};
+}
+
+bool parse_options(int argc,char**argv,options_t&opt)
+{
+    vector<string> positional;
+    for(int i=1;i<argc;++i)
+    {
+        const string arg=argv[i];
+        if(arg=="--report"&&i+1<argc)          opt.report_path=argv[++i];
+        else if(arg=="--output-dir"&&i+1<argc) opt.output_dir=argv[++i];
+        else if(arg.starts_with("--"))         return false;
+        else                                   positional.push_back(arg);
+    }
+    if(positional.size()!=2) return false;
+    opt.pool_path=positional[0];
+    opt.scene_path=positional[1];
+    return true;
+}
+
+}
+
+int main(int argc,char**argv)
+{
+    std::setlocale(LC_ALL,"C");
+    options_t opt;
+    if(!parse_options(argc,argv,opt))
+    {
+        std::cerr<<usage<<'\n';
+        return arguments_id;
+    }
+    auto fail=[](const string&path,const string&err,exit_code_t code)
+    {
+        std::cerr<<path<<": "<<err<<'\n';
+        return code;
+    };
+    string content;
+    CFunctionPool pool;
+    if(!read_file(opt.pool_path,content)) return fail(opt.pool_path,"can't open file",input_id);
+    if(auto err=FromJson(content,pool);!err.empty()) return fail(opt.pool_path,err,input_id);
+
+    scene_description_t scene;
+    if(!read_file(opt.scene_path,content)) return fail(opt.scene_path,"can't open file",input_id);
+    if(auto err=SceneFromJson(content,scene);!err.empty()) return fail(opt.scene_path,err,input_id);
+
+    if(!opt.output_dir.empty())
+    {
+        std::error_code ec;
+        std::filesystem::create_directories(opt.output_dir,ec);
+        if(ec) return fail(opt.output_dir.string(),ec.message(),arguments_id);
+    }
+    auto start=std::chrono::steady_clock::now();
+    Json::array meshes,plots,implicit;
+    for(const auto&desc:scene.meshes)
+    {
+        auto err=evaluate_mesh(desc,pool,opt,meshes);
+        if(!err.empty()) return fail(desc.name,err,evaluation_id);
+    }
+    for(const auto&desc:scene.plots)
+    {
+        auto err=evaluate_plot(desc,pool,opt,plots);
+        if(!err.empty()) return fail(desc.name,err,evaluation_id);
+    }
+    for(const auto&desc:scene.implicit)
+    {
+        auto err=evaluate_implicit(desc,pool,implicit);
+        if(!err.empty()) return fail(desc.name,err,evaluation_id);
+    }
+    const string report=Json(Json::object{{"meshes",meshes},
+                                          {"plots",plots},
+                                          {"implicit",implicit},
+                                          {"total_ms",milliseconds(start)}}).dump();
+    if(opt.report_path.empty())
+    {
+        std::cout<<report<<'\n';
+    }
+    else
+    {
+        std::ofstream file(opt.report_path);
+        if(!(file<<report<<'\n')) return fail(opt.report_path,"can't write report",evaluation_id);
+    }
+    return success_id;
+}
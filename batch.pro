@@ -0,0 +1,50 @@
+#-------------------------------------------------
+#
+# Headless batch evaluation, without Qt and OpenGL
+#
+#-------------------------------------------------
+
+QMAKE_CXX = g++-11
+QMAKE_LINK = g++-11
+
+QT      -=core gui
+CONFIG  -=qt
+CONFIG  +=console
+
+QMAKE_CXXFLAGS+=-std=c++20
+
+TARGET = GraphViewerBatch
+TEMPLATE = app
+
+INCLUDEPATH =/home/roma/EIGEN_ROOT/eigen-3.4.0
+
+LIBS +=-lpthread
+
+SOURCES += \
+../BaseLibraries/Expression/function_pool.cpp\
+../../CppProjects/json11/json11.cpp\
+functional_mesh.cpp\
+implicit_mesh.cpp\
+profiler.cpp\
+animation_cache.cpp\
+rigid_transform.cpp\
+mesh_export.cpp\
+plot_2D_base.cpp\
+json_convert.cpp\
+batch.cpp
+
+HEADERS +=\
+../BaseLibraries/Expression/expression_parser.h\
+../BaseLibraries/Expression/function_pool.h\
+../BaseLibraries/Expression/glsl_codegen.h\
+../BaseLibraries/Expression/string_util.h\
+../../CppProjects/json11/json11.hpp\
+functional_mesh.h\
+implicit_mesh.h\
+animation_cache.h\
+rigid_transform.h\
+mesh_export.h\
+plot_2D_base.h\
+json_convert.h\
+parallel_for.h\
+profiler.h
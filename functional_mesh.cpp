@@ -2,9 +2,17 @@
 
 
 #include <numbers>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 #include <Eigen/Geometry>
 
 #include "functional_mesh.h"
+#include "parallel_for.h"
+#include "profiler.h"
 
 
 ///////////////////////////////////////////////////////////////
@@ -16,193 +24,459 @@ CFunctionalMesh::CFunctionalMesh()
     SetColorFunctor(nullptr);
 }
 
-void CFunctionalMesh::m_InvalidateAll()const
+CFunctionalMesh::~CFunctionalMesh()
+{
+    m_CancelAsyncJob();
+}
+
+// Only the time is changed, results of running job remain acceptable
+
+void CFunctionalMesh::m_InvalidateComputed()const
 {
+    // samples in the dirty columns are obsolete
+    if(m_dirty_columns) m_samples_grid.reset();
+    m_dirty_columns.reset();
     m_valid_points=m_valid_normals=m_valid_colors=false;
     m_levels_valid[0]=m_levels_valid[1]=m_levels_valid[2]=false;
 }
 
-void CFunctionalMesh::m_SetBoundedBox()const
+void CFunctionalMesh::m_InvalidateAll()const
+{
+    m_InvalidateComputed();
+    ++m_generation;
+}
+
+bool CFunctionalMesh::m_FillMask(const matrix_t&points,mask_t&mask)
+{
+    mask.resize(points.rows(),points.cols());
+    bool has_invalid=false;
+    for(decltype(points.size()) i=0;i<points.size();++i)
+    {
+        mask(i)=points(i).allFinite();
+        has_invalid|=!mask(i);
+    }
+    return has_invalid;
+}
+
+// Store the new mask, update_mask flag is returned if it's changed
+
+int CFunctionalMesh::m_SetMask(mask_t&mask,bool has_invalid)const
+{
+    int update=0;
+    if(has_invalid!=m_has_invalid||
+       (has_invalid&&(mask.rows()!=m_mask.rows()||mask.cols()!=m_mask.cols()||mask!=m_mask)))
+    {
+        update=CUpdateResult::update_mask;
+    }
+    m_mask.swap(mask);
+    m_has_invalid=has_invalid;
+    return update;
+}
+
+void CFunctionalMesh::m_SetBoundedBox(const matrix_t&points,const mask_t*mask,box_t&box)
 {
-    using eig_size_t=decltype(m_points.rows());
-    m_bounded_box.first=m_bounded_box.second=m_points(0,0);
-    for(eig_size_t i_s=0;i_s<m_points.rows();++i_s)
+    using eig_size_t=decltype(points.rows());
+    bool empty=true;
+    for(eig_size_t i_s=0;i_s<points.rows();++i_s)
     {
-        for(eig_size_t i_t=0;i_t<m_points.cols();++i_t)
+        for(eig_size_t i_t=0;i_t<points.cols();++i_t)
         {
+            if(mask&&!(*mask)(i_s,i_t)) continue;
+            const point_t& current=points(i_s,i_t);
+            if(empty)
+            {
+                box.first=box.second=current;
+                empty=false;
+                continue;
+            }
             for(size_t dim=0;dim<3;dim++)
             {
-                const point_t& current=m_points(i_s,i_t);
-                m_bounded_box.first[dim]=std::min(current[dim],m_bounded_box.first[dim]);
-                m_bounded_box.second[dim]=std::max(current[dim],m_bounded_box.second[dim]);
+                box.first[dim]=std::min(current[dim],box.first[dim]);
+                box.second[dim]=std::max(current[dim],box.second[dim]);
             }
         }
     }
+    if(empty) box.first=box.second=point_t(0,0,0);
+}
+
+void CFunctionalMesh::m_DropSamples()
+{
+    // the running job can use the animation cache
+    m_CancelAsyncJob();
+    m_samples_grid.reset();
+    m_animation_cache=nullptr;
+}
+
+// NestedNodes - for each node of the axis (first,delta,res) the index of
+// the coinciding node of the axis (old_first,old_delta,old_res), or -1.
+// Returns the number of coinciding nodes.
+
+static size_t NestedNodes(float first,float delta,size_t res,
+                          float old_first,float old_delta,size_t old_res,
+                          std::vector<int>&nodes)
+{
+    const float tolerance=1e-3f;
+    nodes.assign(res+1,-1);
+    if(!(old_delta>0)) return 0;
+    size_t count=0;
+    for(size_t i=0;i<=res;++i)
+    {
+        float old_index=(first+i*delta-old_first)/old_delta;
+        float nearest=std::round(old_index);
+        if(std::abs(old_index-nearest)<tolerance&&nearest>=0&&nearest<=old_res)
+        {
+            nodes[i]=nearest;
+            ++count;
+        }
+    }
+    return count;
+}
+
+// Fill m_points for the new grid, copying samples, which coincide with nodes
+// of the previous grid (nested refinement, overlapping range) and evaluating
+// only new ones. Returns false, if there is nothing to reuse.
+
+bool CFunctionalMesh::m_RefinePoints(float time)const
+{
+    if(!m_samples_grid||m_samples_time!=time) return false;
+    const grid_t&old=*m_samples_grid;
+    assert(size_t(m_points.rows())==old.s_resolution+1&&size_t(m_points.cols())==old.t_resolution+1);
+    std::vector<int> s_nodes,t_nodes;
+    size_t common=NestedNodes(m_grid.s_range.first,m_grid.s_delta(),m_grid.s_resolution,
+                              old.s_range.first,old.s_delta(),old.s_resolution,s_nodes);
+    common*=NestedNodes(m_grid.t_range.first,m_grid.t_delta(),m_grid.t_resolution,
+                        old.t_range.first,old.t_delta(),old.t_resolution,t_nodes);
+    if(common==0) return false;
+
+    matrix_t points(m_grid.s_resolution+1,m_grid.t_resolution+1);
+    for(size_t i=0;i<=m_grid.s_resolution;++i)
+    {
+        const float s=m_grid.s(i);
+        for(size_t j=0;j<=m_grid.t_resolution;++j)
+        {
+            points(i,j)=(s_nodes[i]>=0&&t_nodes[j]>=0)? m_points(s_nodes[i],t_nodes[j]):
+                                                        m_points_functor(s,m_grid.t(j),time);
+        }
+    }
+    m_points.swap(points);
+    return true;
+}
+
+// Recompute only dirty columns of m_points
+
+void CFunctionalMesh::m_UpdateColumns(float time)const
+{
+    assert(m_dirty_columns);
+    const auto [first,last]=*m_dirty_columns;
+    for(size_t j=first;j<last;++j)
+    {
+        const float t=m_grid.t(j);
+        for(size_t i=0;i<=m_grid.s_resolution;++i)
+        {
+            m_points(i,j)=m_points_functor(m_grid.s(i),t,time);
+        }
+    }
+}
+
+// Animation cache for the actual grid, restarted
+// if it was dropped or the grid was changed
+
+CAnimationCache& CFunctionalMesh::m_AnimationCache()const
+{
+    assert(m_cache_settings);
+    if(!m_animation_cache||m_cache_grid!=m_grid)
+    {
+        m_animation_cache=nullptr;
+        m_cache_grid=m_grid;
+        m_animation_cache=std::make_unique<CAnimationCache>(
+            m_cache_settings->period,m_cache_settings->frames,m_cache_settings->max_bytes,
+            m_grid.s_resolution+1,m_grid.t_resolution+1,
+            [fill=m_fill_functor,grid=m_grid](matrix_t&points,float time)mutable
+            {
+                fill(points,grid,time);
+            });
+    }
+    return *m_animation_cache;
+}
+
+void CFunctionalMesh::m_CachedPoints(float time)const
+{
+    m_AnimationCache().Frame(time,m_points);
 }
 
 // normal to parametrically defined surface
 // defined as || (dr / ds) x (dr / dt) ||
 // derivatives are approximated by finite differences
 
-void CFunctionalMesh::m_FillNormals()const
+void CFunctionalMesh::m_FillNormals(const matrix_t&points,const mask_t*mask,const grid_t&grid,matrix_t&normals)
 {
-    using eig_size_t=decltype(m_points.rows());
-    float s_delta=m_grid.s_delta();
-    auto get_s_tangent=[this,&s_delta](size_t i,size_t j)->point_t
+    using eig_size_t=decltype(points.rows());
+    float s_delta=grid.s_delta();
+    auto get_s_tangent=[&points,&s_delta](size_t i,size_t j)->point_t
     {
-        return (m_points(i+1,j)-m_points(i-1,j))/(2*s_delta);
+        return (points(i+1,j)-points(i-1,j))/(2*s_delta);
     };
     auto get_s_top_bound=[&](size_t j)->point_t
     {
-        return (m_points(1,j)-m_points(0,j))/(s_delta);
+        return (points(1,j)-points(0,j))/(s_delta);
     };
     auto get_s_down_bound=[&](size_t j)->point_t
     {
-        return (m_points(m_points.rows()-1,j)-m_points(m_points.rows()-2,j))/(s_delta);
+        return (points(points.rows()-1,j)-points(points.rows()-2,j))/(s_delta);
     };
 
-    float t_delta=m_grid.t_delta();
-    auto get_t_tangent=[this,&t_delta](size_t i,size_t j)->point_t
+    float t_delta=grid.t_delta();
+    auto get_t_tangent=[&points,&t_delta](size_t i,size_t j)->point_t
     {
-        return (m_points(i,j+1)-m_points(i,j-1) )/(2*t_delta);
+        return (points(i,j+1)-points(i,j-1) )/(2*t_delta);
     };
     auto get_t_left_bound=[&](size_t i)->point_t
     {
-        return (m_points(i,1)-m_points(i,0))/(t_delta);
+        return (points(i,1)-points(i,0))/(t_delta);
     };
     auto get_t_right_bound=[&](size_t i)->point_t
     {
-        return (m_points(i,m_points.cols()-1)-m_points(i,m_points.cols()-2))/(t_delta);
+        return (points(i,points.cols()-1)-points(i,points.cols()-2))/(t_delta);
     };
 
-    m_normals.resize(m_points.rows(),m_points.cols());
+    normals.resize(points.rows(),points.cols());
+
+    if(mask)
+    {
+        // differences only between valid samples: central, if both
+        // neighbours are valid, one-sided otherwise, zero for isolated samples
+        auto tangent=[&](eig_size_t i,eig_size_t j,eig_size_t di,eig_size_t dj,float delta)->point_t
+        {
+            auto valid=[&](eig_size_t _i,eig_size_t _j)
+            {
+                return _i>=0&&_j>=0&&_i<points.rows()&&_j<points.cols()&&(*mask)(_i,_j);
+            };
+            const bool next=valid(i+di,j+dj),prev=valid(i-di,j-dj);
+            if(next&&prev) return (points(i+di,j+dj)-points(i-di,j-dj))/(2*delta);
+            if(next)       return (points(i+di,j+dj)-points(i,j))/delta;
+            if(prev)       return (points(i,j)-points(i-di,j-dj))/delta;
+            return point_t(0,0,0);
+        };
+        for(eig_size_t i=0;i<normals.rows();++i)
+          for(eig_size_t j=0;j<normals.cols();++j)
+          {
+              if(!(*mask)(i,j))
+              {
+                  normals(i,j)=point_t(0,0,0);
+                  continue;
+              }
+              normals(i,j)=tangent(i,j,1,0,s_delta).cross(tangent(i,j,0,1,t_delta)).normalized();
+          }
+        return;
+    }
 
     // internal domain
-    for(eig_size_t i=1;i<m_normals.rows()-1;++i)
-      for(eig_size_t j=1;j<m_normals.cols()-1;++j)
+    for(eig_size_t i=1;i<normals.rows()-1;++i)
+      for(eig_size_t j=1;j<normals.cols()-1;++j)
       {
-          m_normals(i,j)=get_s_tangent(i,j).cross(get_t_tangent(i,j));
-          m_normals(i,j).normalize();
+          normals(i,j)=get_s_tangent(i,j).cross(get_t_tangent(i,j));
+          normals(i,j).normalize();
       }
     // left bound
-    for(eig_size_t i=1;i<m_normals.rows()-1;++i)
+    for(eig_size_t i=1;i<normals.rows()-1;++i)
     {
-        m_normals(i,0)=get_s_tangent(i,0).cross(get_t_left_bound(i));
-        m_normals(i,0).normalize();
+        normals(i,0)=get_s_tangent(i,0).cross(get_t_left_bound(i));
+        normals(i,0).normalize();
     }
     // right bound
-    for(eig_size_t i=1;i<m_normals.rows()-1;++i)
+    for(eig_size_t i=1;i<normals.rows()-1;++i)
     {
-        m_normals(i,m_normals.cols()-1)=get_s_tangent(i,0).cross(get_t_right_bound(i));
-        m_normals(i,m_normals.cols()-1).normalize();
+        normals(i,normals.cols()-1)=get_s_tangent(i,0).cross(get_t_right_bound(i));
+        normals(i,normals.cols()-1).normalize();
     }
 
     // top bound
-    for(eig_size_t i=1;i<m_normals.cols()-1;++i)
+    for(eig_size_t i=1;i<normals.cols()-1;++i)
     {
-        m_normals(0,i)=get_s_top_bound(i).cross(get_t_tangent(0,i));
-        m_normals(0,i).normalize();
+        normals(0,i)=get_s_top_bound(i).cross(get_t_tangent(0,i));
+        normals(0,i).normalize();
     }
     // down bound
-    for(eig_size_t i=1;i<m_normals.cols()-1;++i)
+    for(eig_size_t i=1;i<normals.cols()-1;++i)
     {
-        m_normals(m_normals.rows()-1,i)=get_s_down_bound(i).cross(get_t_tangent(m_normals.rows()-1,i));
-        m_normals(m_normals.rows()-1,i).normalize();
+        normals(normals.rows()-1,i)=get_s_down_bound(i).cross(get_t_tangent(normals.rows()-1,i));
+        normals(normals.rows()-1,i).normalize();
     }
     // corners
-    m_normals(0,0)=get_s_top_bound(0).cross(get_t_left_bound(0));
-    m_normals(0,0).normalize();
+    normals(0,0)=get_s_top_bound(0).cross(get_t_left_bound(0));
+    normals(0,0).normalize();
+
+    normals(0,normals.cols()-1)=get_s_top_bound(normals.cols()-1).cross(get_t_right_bound(0));
+    normals(0,normals.cols()-1).normalize();
 
-    m_normals(0,m_normals.cols()-1)=get_s_top_bound(m_normals.cols()-1).cross(get_t_right_bound(0));
-    m_normals(0,m_normals.cols()-1).normalize();
+    normals(normals.rows()-1,normals.cols()-1)=get_s_down_bound(normals.cols()-1).
+                                                     cross(get_t_right_bound(normals.rows()-1));
+    normals(normals.rows()-1,normals.cols()-1).normalize();
 
-    m_normals(m_normals.rows()-1,m_normals.cols()-1)=get_s_down_bound(m_normals.cols()-1).
-                                                     cross(get_t_right_bound(m_normals.rows()-1));
-    m_normals(m_normals.rows()-1,m_normals.cols()-1).normalize();
+    normals(normals.rows()-1,0)=get_s_down_bound(0).cross(get_t_left_bound(normals.rows()-1));
+    normals(normals.rows()-1,0).normalize();
+}
+
+// Level lines are built by marching squares in a single pass over cells:
+// for each cell all levels in the span [min,max] of its corners are processed,
+// cells are split into tiles of rows, which are processed in parallel.
+// Segments are stitched into polylines by common grid edges.
+
+namespace{
+
+struct level_segment_t
+{
+    uint32_t                 level;
+    std::array<size_t,2>     edges;// grid edges, crossed by the segment
+    std::array<Eigen::Vector3f,2> points;
+};
+
+// stitch segments of the same level into polylines
+void StitchSegments(const std::vector<level_segment_t>&segments,
+                    CFunctionalMesh::level_line_t&line)
+{
+    const int none=-1;
+    std::vector<std::pair<size_t,int>> ends;// (edge,2*segment+end)
+    ends.reserve(2*segments.size());
+    for(size_t i=0;i<segments.size();++i)
+    {
+        ends.push_back({segments[i].edges[0],2*i});
+        ends.push_back({segments[i].edges[1],2*i+1});
+    }
+    std::sort(ends.begin(),ends.end());
+    std::vector<int> link(ends.size(),none);
+    for(size_t i=0;i+1<ends.size();++i)
+    {
+        if(ends[i].first!=ends[i+1].first) continue;
+        link[ends[i].second]=ends[i+1].second;
+        link[ends[i+1].second]=ends[i].second;
+        ++i;
+    }
+
+    std::vector<bool> visited(segments.size(),false);
+    auto walk=[&](int start_end)
+    {
+        int seg=start_end/2;
+        int end=start_end%2;
+        line.push_back(segments[seg].points[end]);
+        while(!visited[seg])
+        {
+            visited[seg]=true;
+            line.push_back(segments[seg].points[end^1]);
+            int next=link[2*seg+(end^1)];
+            if(next==none) break;
+            seg=next/2;
+            end=next%2;
+        }
+        line.close_polyline();
+    };
+    // open polylines start from the unlinked ends
+    for(size_t i=0;i<link.size();++i)
+    {
+        if(link[i]==none&&!visited[i/2]) walk(i);
+    }
+    // the rest of segments form closed loops
+    for(size_t i=0;i<segments.size();++i)
+    {
+        if(!visited[i]) walk(2*i);
+    }
+}
 
-    m_normals(m_normals.rows()-1,0)=get_s_down_bound(0).cross(get_t_left_bound(m_normals.rows()-1));
-    m_normals(m_normals.rows()-1,0).normalize();
 }
 
-void CFunctionalMesh::m_SetLevelLines(int index,float time)const
+void CFunctionalMesh::m_SetLevelLines(const matrix_t&points,const mask_t*mask,const grid_t&grid,const box_t&box,
+                                      uint32_t num_levels,int index,std::vector<level_line_t>&levels)
 {
     assert(index==0||index==1||index==2);
-    assert(m_valid_points);
-    m_levels[index].clear();
-    auto cell_pocess=[index,time,this](float level,int i,int j,int& lines)
-    ->std::array<point_t,4>
+    const float  first=box.first[index];
+    const float  delta=(box.second[index]-first)/(1+num_levels);
+    auto level=[first,delta](size_t k){return first+delta*(k+1);};
+
+    levels.clear();
+    for(size_t k=0;k<num_levels;++k) levels.push_back(level_line_t(level(k)));
+    if(num_levels==0||!(delta>0)) return;
+
+    const size_t cols=points.cols();
+    // unique index of edge (i,j)-(i,j+1) (dir==0) or (i,j)-(i+1,j) (dir==1)
+    auto edge_index=[cols](size_t i,size_t j,size_t dir){return 2*(i*cols+j)+dir;};
+
+    auto cell_process=[&](size_t i,size_t j,std::vector<level_segment_t>&out)
     {
+        if(mask&&!((*mask)(i,j)&&(*mask)(i+1,j)&&(*mask)(i,j+1)&&(*mask)(i+1,j+1))) return;
         auto is_same_sign=[](float _1,float _2){ return (_1>=0) == (_2>=0);};
-        std::array<float,4> diffs;
-        std::array<point_t,4> cell={m_points(i+1,j),m_points(i+1,j+1),m_points(i,j+1),m_points(i,j)};
-        std::array<int,4>   intersections;
-        int num_intersetions=0;
-        auto intersection_point=[&](int side)
-        {
-            int next=(1+side)%4;
-            return (cell[side]*diffs[next]-cell[next]*diffs[side])/(diffs[next]-diffs[side]);
-        };
-        diffs[0]=cell[0][index]-level;
-        for(int i=0;i<4;++i)
+        const std::array<const point_t*,4> cell={&points(i+1,j),&points(i+1,j+1),
+                                                 &points(i,j+1),&points(i,j)};
+        const std::array<size_t,4> edges={edge_index(i+1,j,0),edge_index(i,j+1,1),
+                                          edge_index(i,j,0),edge_index(i,j,1)};
+        std::array<float,4> values;
+        for(int c=0;c<4;++c) values[c]=(*cell[c])[index];
+        const auto [min,max]=std::minmax_element(values.begin(),values.end());
+
+        // first level above the cell minimum
+        size_t k=std::clamp(std::floor((*min-first)/delta),0.0f,float(num_levels));
+        while(k>0&&level(k-1)>*min) --k;
+        while(k<num_levels&&level(k)<=*min) ++k;
+
+        for(;k<num_levels&&level(k)<=*max;++k)
         {
-            int next_index=(i+1)%4;
-            diffs[next_index]=cell[next_index][index]-level;
-            if(!is_same_sign(diffs[i],diffs[next_index])) intersections[num_intersetions++]=i;
-        }
-        lines=num_intersetions/2;
-        if(lines==0) return std::array<point_t,4>{};
-        else if(num_intersetions==2)
-        {
-            return std::array<point_t,4>{intersection_point(intersections[0]),
-                                         intersection_point(intersections[1]),
-                                         point_t{},point_t{}};
-        }
-        else if(num_intersetions==4)
-        {
-            float center_diff=m_points_functor(m_grid.s(i)+m_grid.s_delta()/2,
-                                               m_grid.t(j)+m_grid.t_delta()/2,
-                                               time)[index]-level;
-            if(is_same_sign(diffs[0],center_diff))
+            const float current=level(k);
+            std::array<float,4> diffs;
+            for(int c=0;c<4;++c) diffs[c]=values[c]-current;
+            auto intersection_point=[&](int side)
+            {
+                int next=(1+side)%4;
+                return point_t((*cell[side]*diffs[next]-*cell[next]*diffs[side])/(diffs[next]-diffs[side]));
+            };
+            std::array<int,4> intersections;
+            int num_intersections=0;
+            for(int side=0;side<4;++side)
             {
-                    return {
-                                intersection_point(intersections[0]),
-                                intersection_point(intersections[1]),
-                                intersection_point(intersections[2]),
-                                intersection_point(intersections[3])
-                            };
+                if(!is_same_sign(diffs[side],diffs[(side+1)%4])) intersections[num_intersections++]=side;
             }
-            else
+            auto push=[&](int _1,int _2)
+            {
+                out.push_back({uint32_t(k),{edges[_1],edges[_2]},
+                               {intersection_point(_1),intersection_point(_2)}});
+            };
+            if(num_intersections==2)
+            {
+                push(intersections[0],intersections[1]);
+            }
+            else if(num_intersections==4)
             {
-                    return {
-                                intersection_point(intersections[1]),
-                                intersection_point(intersections[2]),
-                                intersection_point(intersections[3]),
-                                intersection_point(intersections[0])
-                            };
+                // saddle, resolved by the mean value in the cell center
+                float center_diff=(values[0]+values[1]+values[2]+values[3])/4-current;
+                if(is_same_sign(diffs[0],center_diff))
+                {
+                    push(0,1);push(2,3);
+                }
+                else
+                {
+                    push(1,2);push(3,0);
+                }
             }
+            else assert(num_intersections==0);
         }
-        else assert(false);
     };
 
-    float delta=(m_bounded_box.second[index]-m_bounded_box.first[index])/(1+m_num_levels[index]);
-
-    for(size_t k=0;k<m_num_levels[index];++k)
+    // segments of each tile
+    const size_t rows=grid.s_resolution;
+    std::vector<std::vector<level_segment_t>> tiles(par::tiles(rows,16));
+    par::tiles_for(rows,16,[&](size_t tile,size_t begin,size_t end)
     {
-        float level=delta*(k+1);
-        m_levels[index].push_back(level_line_t(level));
-        auto&current=m_levels[index].back();
+        for(size_t i=begin;i<end;++i)
+            for(size_t j=0;j<grid.t_resolution;++j) cell_process(i,j,tiles[tile]);
+    });
 
-        for(size_t i=0;i<m_grid.s_resolution;++i)
-            for(size_t j=0;j<m_grid.t_resolution;++j)
-            {
-                int num_lines;
-                auto lines=cell_pocess(level+m_bounded_box.first[index],i,j,num_lines);
-                if(num_lines==0) continue;
+    // distribute by levels, in a stable order
+    std::vector<std::vector<level_segment_t>> by_level(num_levels);
+    for(const auto&tile:tiles)
+        for(const auto&segment:tile) by_level[segment.level].push_back(segment);
 
-                if(num_lines==1) current.push_back(lines[0],lines[1]);
-                if(num_lines==2) current.push_back(lines[2],lines[3]);
-            }
-    }
+    par::tiles_for(num_levels,1,[&](size_t,size_t begin,size_t end)
+    {
+        for(size_t k=begin;k<end;++k) StitchSegments(by_level[k],levels[k]);
+    });
 }
 
 CFunctionalMesh& CFunctionalMesh::SetUniformColor(const point_t&p)
@@ -220,6 +494,103 @@ CFunctionalMesh& CFunctionalMesh::SetTraits(const CRenderingTraits&traits)
     return *this;
 }
 
+CFunctionalMesh& CFunctionalMesh::InvalidateRange(std::pair<float,float> t_range)
+{
+    if(Empty()||t_range.second<m_grid.t_range.first||t_range.first>m_grid.t_range.second) return *this;
+    const float t_delta=m_grid.t_delta();
+    const size_t first=std::clamp(std::floor((t_range.first-m_grid.t_range.first)/t_delta),
+                                  0.0f,float(m_grid.t_resolution));
+    const size_t last=std::clamp(std::ceil((t_range.second-m_grid.t_range.first)/t_delta),
+                                 0.0f,float(m_grid.t_resolution))+1;
+    if(m_valid_points)
+    {
+        m_dirty_columns={first,last};
+    }
+    else if(m_dirty_columns)
+    {
+        m_dirty_columns->first=std::min(m_dirty_columns->first,first);
+        m_dirty_columns->second=std::max(m_dirty_columns->second,last);
+    }
+    if(m_animation_cache)
+    {
+        m_CancelAsyncJob();
+        m_animation_cache=nullptr;
+    }
+    m_valid_points=m_valid_normals=m_valid_colors=false;
+    m_levels_valid[0]=m_levels_valid[1]=m_levels_valid[2]=false;
+    ++m_generation;
+    return *this;
+}
+
+CFunctionalMesh& CFunctionalMesh::SetLeanMemory(bool lean,positions_t positions)
+{
+    if(lean==m_lean_memory&&positions==m_positions) return *this;
+    m_lean_memory=lean;
+    m_positions=positions;
+    // the buffers are uploaded again in the new format
+    m_InvalidateAll();
+    return *this;
+}
+
+CFunctionalMesh& CFunctionalMesh::SetPalette(std::vector<point_t> palette)
+{
+    assert(!palette.empty());
+    m_palette=std::move(palette);
+    if(m_height_colors) SetColorFunctor(nullptr);
+    return *this;
+}
+
+CFunctionalMesh& CFunctionalMesh::SetGpuPalette(bool gpu)
+{
+    if(gpu==m_gpu_palette) return *this;
+    m_gpu_palette=gpu;
+    // colors aren't kept up to date, while the palette is on GPU
+    m_valid_colors=false;
+    if(gpu) m_colors.resize(0,0);
+    ++m_generation;
+    return *this;
+}
+
+CFunctionalMesh::point_t CFunctionalMesh::PaletteColor(const std::vector<point_t>&palette,float u)
+{
+    assert(!palette.empty());
+    if(palette.size()==1) return palette[0];
+    // NaN of invalid samples gives the first color
+    u=u>0? (u<1? u:1):0;
+    const float x=u*(palette.size()-1);
+    const size_t i=std::min(size_t(x),palette.size()-2);
+    return palette[i]+(x-i)*(palette[i+1]-palette[i]);
+}
+
+// Drop the CPU copies of static mesh, returns released bytes
+
+size_t CFunctionalMesh::m_ReleaseData()
+{
+    if(!m_lean_memory||IsDynamic()||m_released||!m_valid_points||m_async_job) return 0;
+    const size_t bytes=(m_points.size()+m_normals.size()+m_colors.size())*sizeof(point_t);
+    m_points.resize(0,0);
+    m_normals.resize(0,0);
+    m_colors.resize(0,0);
+    m_samples_grid.reset();
+    m_released=true;
+    return bytes;
+}
+
+// Released data is recomputed entirely, if something computed from
+// the points is required again
+
+void CFunctionalMesh::m_RestoreReleased(bool force)const
+{
+    if(!m_released) return;
+    bool required=force||!m_valid_points||
+                  (!m_valid_normals&&m_traits.IsSpecularSurface())||
+                  (!m_valid_colors&&m_ColorsRequired());
+    for(int i=0;i<3;++i) required|=!m_levels_valid[i]&&m_traits.IsLevelLines(i);
+    if(!required) return;
+    m_InvalidateComputed();
+    m_released=false;
+}
+
 CFunctionalMesh& CFunctionalMesh::SetAmbientReflection(float val)
 {
     m_material.ambient=val;
@@ -244,6 +615,19 @@ CFunctionalMesh& CFunctionalMesh::SetShininess(float val)
     return *this;
 }
 
+CFunctionalMesh& CFunctionalMesh::SetSharedGeometry(const CFunctionalMesh*geometry)
+{
+    assert(geometry!=this&&(!geometry||!geometry->m_shared_geometry));
+    m_shared_geometry=geometry;
+    return *this;
+}
+
+CFunctionalMesh& CFunctionalMesh::SetGpuSurface(std::string source)
+{
+    m_gpu_surface=std::move(source);
+    return *this;
+}
+
 CFunctionalMesh& CFunctionalMesh::SetGrid(grid_t grid)
 {
     assert(!grid.empty());
@@ -271,6 +655,32 @@ CFunctionalMesh& CFunctionalMesh::SetRange(std::pair<float,float> s_range,std::p
     return *this;
 }
 
+CFunctionalMesh& CFunctionalMesh::SetAnimationCache(float period,size_t frames,size_t max_bytes)
+{
+    assert(period>0&&frames>1);
+    m_CancelAsyncJob();
+    m_cache_settings=animation_cache_t{period,frames,max_bytes};
+    m_animation_cache=nullptr;
+    m_InvalidateAll();
+    return *this;
+}
+
+CFunctionalMesh& CFunctionalMesh::DropAnimationCache()
+{
+    m_CancelAsyncJob();
+    m_cache_settings.reset();
+    m_animation_cache=nullptr;
+    m_InvalidateAll();
+    return *this;
+}
+
+CFunctionalMesh& CFunctionalMesh::SetThreadSafeFunctors(bool safe)
+{
+    if(!safe) m_CancelAsyncJob();
+    m_thread_safe=safe;
+    return *this;
+}
+
 CFunctionalMesh& CFunctionalMesh::SetNumberOfLevelsX(uint32_t x)
 {
     m_levels_valid[0]= x==m_num_levels[0];
@@ -295,18 +705,24 @@ CFunctionalMesh& CFunctionalMesh::SetNumberOfLevelsZ(uint32_t z)
 
 void CFunctionalMesh::Clear()
 {
+    m_CancelAsyncJob();
     m_points_functor=nullptr;
     m_InvalidateAll();
+    m_DropSamples();
 }
 
 
 CFunctionalMesh::CUpdateResult CFunctionalMesh::UpdateData(float time)
 {
+    CProfiler::CScope scope("UpdateData");
     int update=0;
+    size_t first=0,last=std::numeric_limits<size_t>::max();
     if(Empty()) return CUpdateResult(0);
+    m_CancelAsyncJob();
+    m_RestoreReleased();
     if(IsDynamic())
     {
-       if(time!=m_last_update_time) m_InvalidateAll();
+       if(time!=m_last_update_time) m_InvalidateComputed();
     }
     else
     {
@@ -316,29 +732,57 @@ CFunctionalMesh::CUpdateResult CFunctionalMesh::UpdateData(float time)
     if(!m_valid_points)
     {
         //std::cout<<"UPDATE POINTS\n";
-        if(m_grid.s_resolution+1!=m_points.rows()||m_grid.t_resolution+1!=m_points.cols())
+        if(m_grid.s_resolution+1!=size_t(m_points.rows())||m_grid.t_resolution+1!=size_t(m_points.cols()))
         {
-            m_points.resize(m_grid.s_resolution+1,m_grid.t_resolution+1);
             update|=CUpdateResult::update_grid;
         }
-        m_fill_functor(m_points,m_grid,time);
-        m_SetBoundedBox();
+        CProfiler::CScope fill_scope("Fill");
+        if(m_dirty_columns&&m_grid.s_resolution+1==size_t(m_points.rows())&&m_grid.t_resolution+1==size_t(m_points.cols()))
+        {
+            m_UpdateColumns(time);
+            // normals are changed also in the neighbouring columns
+            first=m_dirty_columns->first? m_dirty_columns->first-1:0;
+            last=std::min<size_t>(m_dirty_columns->second+1,m_points.cols());
+        }
+        else if(m_cache_settings&&IsDynamic())
+        {
+            m_CachedPoints(time);
+        }
+        else if(!m_RefinePoints(time))
+        {
+            m_points.resize(m_grid.s_resolution+1,m_grid.t_resolution+1);
+            m_fill_functor(m_points,m_grid,time);
+        }
+        fill_scope.End();
+        CProfiler::CScope box_scope("BoundedBox");
+        m_samples_grid=m_grid;
+        m_samples_time=time;
+        m_dirty_columns.reset();
+        const box_t box=m_bounded_box;
+        mask_t mask;
+        const bool has_invalid=m_FillMask(m_points,mask);
+        update|=m_SetMask(mask,has_invalid);
+        m_SetBoundedBox(m_points,has_invalid? &m_mask:nullptr,m_bounded_box);
+        // colors of unchanged points depend on the bounded box
+        if(box!=m_bounded_box) last=std::numeric_limits<size_t>::max();
         m_valid_points=true;
         update|=CUpdateResult::update_points;
     }
     if(!m_valid_normals&&m_traits.IsSpecularSurface())
     {
         //std::cout<<"UPDATE NORMALS\n";
+        CProfiler::CScope normals_scope("Normals");
         m_normals.resize(m_grid.s_resolution+1,m_grid.t_resolution+1);
-        m_FillNormals();
+        m_FillNormals(m_points,Mask(),m_grid,m_normals);
         m_valid_normals=true;
         update|=CUpdateResult::update_normals;
     }
-    if(!m_valid_colors&&m_traits.IsColored())
+    if(!m_valid_colors&&m_ColorsRequired())
     {
         //std::cout<<"UPDATE COLORS\n";
+        CProfiler::CScope colors_scope("Colors");
         m_colors.resize(m_grid.s_resolution+1,m_grid.t_resolution+1);
-        m_colors_functor(m_points,m_colors);
+        m_colors_functor(m_points,m_bounded_box,m_colors);
         m_valid_colors=true;
         update|=CUpdateResult::update_colors;
     }
@@ -347,7 +791,8 @@ CFunctionalMesh::CUpdateResult CFunctionalMesh::UpdateData(float time)
         if(!m_levels_valid[i]&&m_traits.IsLevelLines(i))
         {
             //std::cout<<"UPDATE LEVELS\n";
-            m_SetLevelLines(i,time);
+            CProfiler::CScope levels_scope("Levels");
+            m_SetLevelLines(m_points,Mask(),m_grid,m_bounded_box,m_num_levels[i],i,m_levels[i]);
             m_levels_valid[i]=true;
             update|=CUpdateResult::update_levels(i);
         }
@@ -355,9 +800,9 @@ CFunctionalMesh::CUpdateResult CFunctionalMesh::UpdateData(float time)
     m_last_update_time=time;
     if(m_update_callback)
     {
-        m_update_callback(*this,CUpdateResult(update));
+        m_update_callback(*this,CUpdateResult(update,first,last));
     }
-    return CUpdateResult(update);
+    return CUpdateResult(update,first,last);
 }
 
 
@@ -366,6 +811,283 @@ CFunctionalMesh::CUpdateResult CFunctionalMesh::UpdateData()
     return UpdateData(m_last_update_time);
 }
 
+void CFunctionalMesh::Evaluate(float time,size_t first_row,size_t last_row,matrix_t&points)const
+{
+    assert(!Empty()&&first_row<=last_row&&last_row<=m_grid.s_resolution+1);
+    // the functor isn't called concurrently with the job
+    m_CancelAsyncJob();
+    if(!IsDynamic()) time=0.0f;
+    points.resize(last_row-first_row,m_grid.t_resolution+1);
+    for(size_t i=first_row;i<last_row;++i)
+    {
+        const float s=m_grid.s(i);
+        for(size_t j=0;j<=m_grid.t_resolution;++j)
+        {
+            points(i-first_row,j)=m_points_functor(s,m_grid.t(j),time);
+        }
+    }
+}
+
+///////////////////////////////////////////////////////////////
+//                    Asynchronous update
+///////////////////////////////////////////////////////////////
+
+// Snapshot of the mesh state and buffers, filled by the worker thread.
+// Mesh members aren't touched by the worker, except of the animation cache,
+// which is thread safe and isn't dropped before the job is cancelled.
+
+struct CFunctionalMesh::async_job_t
+{
+    std::atomic<bool> m_cancel=false;
+    std::atomic<bool> m_done=false;
+    bool              m_completed=false;
+
+    int      m_update=0;
+    float    m_time;
+    float    m_ms=0;// CPU time of the job
+    uint64_t m_generation;
+    grid_t   m_grid;
+    std::array<uint32_t,3> m_num_levels;
+
+    matrix_t m_points;
+    mask_t   m_mask;
+    bool     m_has_invalid=false;
+    matrix_t m_normals;
+    matrix_t m_colors;
+    box_t    m_bounded_box;
+    std::array<std::vector<level_line_t>,3> m_levels;
+
+    const mask_t*Mask()const{return m_has_invalid? &m_mask:nullptr;}
+};
+
+// The thread runs one job at a time, the next one is started
+// after the mesh has taken the result of the previous one.
+
+struct CFunctionalMesh::async_worker_t
+{
+    std::mutex              m_mutex;
+    std::condition_variable m_condition;
+    std::function<void()>   m_task;
+    bool                    m_stop=false;
+    std::thread             m_thread;
+
+    async_worker_t():m_thread(&async_worker_t::m_Work,this){}
+    void m_Work()
+    {
+        std::unique_lock lock(m_mutex);
+        while(true)
+        {
+            m_condition.wait(lock,[this]{return m_stop||m_task;});
+            if(m_stop) return;
+            auto task=std::move(m_task);
+            m_task=nullptr;
+            lock.unlock();
+            task();
+            task=nullptr;
+            lock.lock();
+        }
+    }
+    void Run(std::function<void()> task)
+    {
+        std::lock_guard lock(m_mutex);
+        assert(!m_task);
+        m_task=std::move(task);
+        m_condition.notify_one();
+    }
+    ~async_worker_t()
+    {
+        {
+            std::lock_guard lock(m_mutex);
+            m_stop=true;
+        }
+        m_condition.notify_one();
+        m_thread.join();
+    }
+};
+
+// What must be recomputed to show the mesh in the moment 'time'
+
+int CFunctionalMesh::m_AsyncUpdateFlags(float time)const
+{
+    const bool new_time=IsDynamic()&&time!=m_last_update_time;
+    int update=0;
+    if(new_time||!m_valid_points) update|=CUpdateResult::update_points;
+    const bool points=update&CUpdateResult::update_points;
+    if((points||!m_valid_normals)&&m_traits.IsSpecularSurface()) update|=CUpdateResult::update_normals;
+    if((points||!m_valid_colors)&&m_ColorsRequired()) update|=CUpdateResult::update_colors;
+    for(int i=0;i<3;++i)
+    {
+        if((points||!m_levels_valid[i])&&m_traits.IsLevelLines(i)) update|=CUpdateResult::update_levels(i);
+    }
+    return update;
+}
+
+void CFunctionalMesh::m_StartAsyncJob(float time)
+{
+    assert(!m_async_job);
+    auto job=std::make_shared<async_job_t>();
+    job->m_update=m_AsyncUpdateFlags(time);
+    job->m_time=time;
+    job->m_generation=m_generation;
+    job->m_grid=m_grid;
+    job->m_num_levels=m_num_levels;
+    if(m_grid.s_resolution+1!=size_t(m_points.rows())||m_grid.t_resolution+1!=size_t(m_points.cols()))
+    {
+        job->m_update|=CUpdateResult::update_grid;
+    }
+    const bool points=job->m_update&CUpdateResult::update_points;
+    if(!points)
+    {
+        job->m_points=m_points;
+        job->m_mask=m_mask;
+        job->m_has_invalid=m_has_invalid;
+        job->m_bounded_box=m_bounded_box;
+    }
+    CAnimationCache*cache=points&&m_cache_settings&&IsDynamic()? &m_AnimationCache():nullptr;
+    if(!m_async_worker) m_async_worker=std::make_unique<async_worker_t>();
+    m_async_worker->Run([job,cache,
+                         points_functor=m_points_functor,
+                         colors_functor=m_colors_functor]()mutable
+    {
+        const grid_t&grid=job->m_grid;
+        const auto rows=grid.s_resolution+1;
+        const auto cols=grid.t_resolution+1;
+        auto cancelled=[&job]{return job->m_cancel.load(std::memory_order_relaxed);};
+        CProfiler::CScope scope("UpdateDataAsync");
+        const auto start=std::chrono::steady_clock::now();
+        if(job->m_update&CUpdateResult::update_points)
+        {
+            CProfiler::CScope fill_scope("Fill");
+            if(cache)
+            {
+                cache->Frame(job->m_time,job->m_points);
+            }
+            else
+            {
+                job->m_points.resize(rows,cols);
+                for(size_t i=0;i<rows;++i)
+                {
+                    if(cancelled()) break;
+                    const float s=grid.s(i);
+                    for(size_t j=0;j<cols;++j) job->m_points(i,j)=points_functor(s,grid.t(j),job->m_time);
+                }
+            }
+            fill_scope.End();
+            if(!cancelled())
+            {
+                CProfiler::CScope box_scope("BoundedBox");
+                job->m_has_invalid=m_FillMask(job->m_points,job->m_mask);
+                m_SetBoundedBox(job->m_points,job->Mask(),job->m_bounded_box);
+            }
+        }
+        if(!cancelled()&&(job->m_update&CUpdateResult::update_normals))
+        {
+            CProfiler::CScope normals_scope("Normals");
+            job->m_normals.resize(rows,cols);
+            m_FillNormals(job->m_points,job->Mask(),grid,job->m_normals);
+        }
+        if(!cancelled()&&(job->m_update&CUpdateResult::update_colors))
+        {
+            CProfiler::CScope colors_scope("Colors");
+            job->m_colors.resize(rows,cols);
+            colors_functor(job->m_points,job->m_bounded_box,job->m_colors);
+        }
+        for(int i=0;i<3;++i)
+        {
+            if(cancelled()||!(job->m_update&CUpdateResult::update_levels(i))) continue;
+            CProfiler::CScope levels_scope("Levels");
+            m_SetLevelLines(job->m_points,job->Mask(),grid,job->m_bounded_box,job->m_num_levels[i],i,job->m_levels[i]);
+        }
+        job->m_ms=std::chrono::duration<float,std::milli>(std::chrono::steady_clock::now()-start).count();
+        job->m_completed=!cancelled();
+        job->m_done.store(true,std::memory_order_release);
+        job->m_done.notify_all();
+    });
+    m_async_job=std::move(job);
+}
+
+void CFunctionalMesh::m_CancelAsyncJob()const
+{
+    if(!m_async_job) return;
+    m_async_job->m_cancel=true;
+    m_async_job->m_done.wait(false,std::memory_order_acquire);
+    m_async_job=nullptr;
+}
+
+// Take the finished job and swap its buffers into the mesh,
+// if it's computed for the actual state. Returns update flags.
+
+int CFunctionalMesh::m_TakeAsyncResult()
+{
+    assert(m_async_job&&m_async_job->m_done);
+    std::shared_ptr<async_job_t> job=std::move(m_async_job);
+    if(!job->m_completed||job->m_generation!=m_generation) return 0;
+    m_async_ms=job->m_ms;
+    int update=job->m_update&CUpdateResult::update_grid;
+    if(job->m_update&CUpdateResult::update_points)
+    {
+        m_points.swap(job->m_points);
+        update|=m_SetMask(job->m_mask,job->m_has_invalid);
+        m_bounded_box=job->m_bounded_box;
+        m_samples_grid=job->m_grid;
+        m_samples_time=job->m_time;
+        // the job has evaluated the whole grid
+        m_dirty_columns.reset();
+        m_valid_points=true;
+        // data computed for the previous points is obsolete
+        m_valid_normals=m_valid_colors=false;
+        m_levels_valid[0]=m_levels_valid[1]=m_levels_valid[2]=false;
+        update|=CUpdateResult::update_points;
+    }
+    if(job->m_update&CUpdateResult::update_normals)
+    {
+        m_normals.swap(job->m_normals);
+        m_valid_normals=true;
+        update|=CUpdateResult::update_normals;
+    }
+    if(job->m_update&CUpdateResult::update_colors)
+    {
+        m_colors.swap(job->m_colors);
+        m_valid_colors=true;
+        update|=CUpdateResult::update_colors;
+    }
+    for(int i=0;i<3;++i)
+    {
+        if(!(job->m_update&CUpdateResult::update_levels(i))) continue;
+        m_levels[i].swap(job->m_levels[i]);
+        m_levels_valid[i]=job->m_num_levels[i]==m_num_levels[i];
+        update|=CUpdateResult::update_levels(i);
+    }
+    m_last_update_time=job->m_time;
+    return update;
+}
+
+CFunctionalMesh::CUpdateResult CFunctionalMesh::UpdateDataAsync(float time,bool start)
+{
+    if(Empty()) return CUpdateResult(0);
+    if(!m_thread_safe) return start? UpdateData(time):CUpdateResult(0);
+    if(!IsDynamic()) time=0.0f;
+    int update=0;
+    if(m_async_job)
+    {
+        if(!m_async_job->m_done.load(std::memory_order_acquire))
+        {
+            // changes of time don't cancel the job, otherwise
+            // the slow animation would never be shown
+            if(m_async_job->m_generation!=m_generation) m_async_job->m_cancel=true;
+            return CUpdateResult(0);
+        }
+        update=m_TakeAsyncResult();
+    }
+    m_RestoreReleased();
+    if(start&&m_AsyncUpdateFlags(time)) m_StartAsyncJob(time);
+    if(update&&m_update_callback)
+    {
+        m_update_callback(*this,CUpdateResult(update));
+    }
+    return CUpdateResult(update);
+}
+
 // Get functions
 
 CFunctionalMesh::grid_t CFunctionalMesh::GetGrid()const
@@ -385,20 +1107,25 @@ uint32_t CFunctionalMesh::GetNumberOfLevel(int i)const
 
 const CFunctionalMesh::matrix_t*CFunctionalMesh::Points()const
 {
-    return m_valid_points? &m_points:nullptr;
+    return m_valid_points&&!m_released? &m_points:nullptr;
 }
 
 const CFunctionalMesh::matrix_t*CFunctionalMesh::Colors()const
 {
-    return m_valid_colors? &m_colors:nullptr;
+    return m_valid_colors&&!m_released? &m_colors:nullptr;
 }
 
 const CFunctionalMesh::matrix_t*CFunctionalMesh::Normals()const
 {
-    return m_valid_normals? &m_normals:nullptr;
+    return m_valid_normals&&!m_released? &m_normals:nullptr;
+}
+
+const CFunctionalMesh::mask_t*CFunctionalMesh::Mask()const
+{
+    return m_valid_points&&m_has_invalid? &m_mask:nullptr;
 }
 
-const std::pair<CFunctionalMesh::point_t,CFunctionalMesh::point_t>* CFunctionalMesh::BoundedBox()const
+const CFunctionalMesh::box_t* CFunctionalMesh::BoundedBox()const
 {
     return m_valid_points? &m_bounded_box:nullptr;
 }
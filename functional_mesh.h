@@ -5,12 +5,17 @@
 #include <iostream>
 #include <functional>
 #include <array>
+#include <memory>
 #include <type_traits>
 #include <concepts>
+#include <optional>
+#include <limits>
+#include <string>
 
 #include <Eigen/Core>
 
 #include "rigid_transform.h"
+#include "animation_cache.h"
 
 
 class CRenderingTraits
@@ -174,18 +179,53 @@ class spherical
     }
 };
 
+// GLSL sources of the surfaces above for CFunctionalMesh::SetGpuSurface,
+// 'function' is the name of GLSL function float(float,float,float)
+
+inline std::string glsl_cartesian(const std::string&function)
+{
+    return "vec3 surface(float s,float t,float time)\n{\n"
+           "    return vec3(s,t,"+function+"(s,t,time));\n}\n";
+}
+
+inline std::string glsl_cylindrical(const std::string&function)
+{
+    return "vec3 surface(float s,float t,float time)\n{\n"
+           "    return vec3(s*cos(t),s*sin(t),"+function+"(s,t,time));\n}\n";
+}
+
+inline std::string glsl_revolve(const std::string&function)
+{
+    return "vec3 surface(float phi,float z,float time)\n{\n"
+           "    float r="+function+"(phi,z,time);\n"
+           "    return vec3(r*cos(phi),r*sin(phi),z);\n}\n";
+}
+
+inline std::string glsl_spherical(const std::string&function)
+{
+    return "vec3 surface(float teta,float phi,float time)\n{\n"
+           "    float r="+function+"(teta,phi,time);\n"
+           "    return vec3(r*sin(teta)*cos(phi),r*sin(teta)*sin(phi),r*cos(teta));\n}\n";
+}
+
 }// plot
 
 class CFunctionalMesh
 {
     static const std::size_t default_resolution=20;
+    static const std::size_t default_cache_bytes=256<<20;
     public:
     enum animation_t {dynamic_id,static_id,auto_define_id };
+    // positions of lean meshes: floats, half floats or 16 bit inside of the bounded box
+    enum positions_t {float_positions_id,half_positions_id,box_positions_id};
     using point_t=Eigen::Vector3f;
     using matrix_t=Eigen::Matrix<point_t,Eigen::Dynamic,Eigen::Dynamic>;
     //using matrix_t=Eigen::MatrixX<point_t>;
+    using box_t=std::pair<point_t,point_t>;
+    // true for finite samples
+    using mask_t=Eigen::Matrix<bool,Eigen::Dynamic,Eigen::Dynamic>;
     using mesh_functor_t=std::function<point_t(float,float,float)>;
-    using color_functor_t=std::function<void(const matrix_t&,matrix_t&)>;
+    using color_functor_t=std::function<void(const matrix_t&,const box_t&,matrix_t&)>;
     using size_t=std::size_t;
     struct grid_t
     {
@@ -278,25 +318,44 @@ class CFunctionalMesh
         {
             update_grid=1<<0,update_points=1<<1,update_normals=1<<2,update_colors=1<<3,
             update_levels_x=1<<4,update_levels_y=1<<5,update_levels_z=1<<6,
+            update_mask=1<<7,
         };
         int  m_type;
+        // changed columns [m_first,m_last) of points, normals and colors,
+        // they are contiguous in column-major buffers
+        size_t m_first=0;
+        size_t m_last=std::numeric_limits<size_t>::max();
         static int update_levels(int i){return update_levels_x<<i;}
         CUpdateResult(int i):m_type(i){}
+        CUpdateResult(int i,size_t first,size_t last):m_type(i),m_first(first),m_last(last){}
         public:
         bool UpdateGrid()const{return m_type&update_grid;}
         bool UpdatePoints()const{return m_type&update_points;}
         bool UpdateNormals()const{return m_type&update_normals;}
         bool UpdateColors()const{return m_type&update_colors;}
         bool UpdateLevel(int i)const{return m_type&(update_levels_x<<i);}
+        // set of invalid samples is changed
+        bool UpdateMask()const{return m_type&update_mask;}
+        // only a part of columns is changed, all of them otherwise
+        bool   IsPartial()const{return m_last!=std::numeric_limits<size_t>::max();}
+        size_t FirstColumn()const{return m_first;}
+        size_t LastColumn()const{return m_last;}
         friend class CFunctionalMesh;
+        friend class CScene;
     };
+    // level line as a set of polylines, stored one after another:
+    // i-th polyline is [m_points[m_strips[i]],m_points[m_strips[i+1]]),
+    // closed polyline ends with its first point
     struct level_line_t
     {
         float m_constant;
-        std::vector<std::pair<point_t,point_t>> m_lines;
+        std::vector<point_t>  m_points;
+        std::vector<uint32_t> m_strips={0};
         explicit level_line_t(float c):m_constant(c){}
-        void clear(){m_lines.clear();}
-        void push_back(const point_t&_1,const point_t&_2){ m_lines.push_back({_1,_2});}
+        void clear(){m_points.clear();m_strips.assign(1,0);}
+        size_t Polylines()const{return m_strips.size()-1;}
+        void push_back(const point_t&p){m_points.push_back(p);}
+        void close_polyline(){m_strips.push_back(m_points.size());}
     };
     private:
     int              m_index=-1;
@@ -306,7 +365,29 @@ class CFunctionalMesh
     std::function<void(const CFunctionalMesh&,CUpdateResult)> m_update_callback;
     mutable matrix_t m_points;
     mutable bool     m_valid_points=false;
+    // grid and time of the samples in m_points, if they can be reused
+    // after change of resolution or range
+    mutable std::optional<grid_t> m_samples_grid;
+    mutable float    m_samples_time=0.0f;
+    // columns [first,last) to recompute, if only they are invalid
+    mutable std::optional<std::pair<size_t,size_t>> m_dirty_columns;
+    // samples, where the functor is NaN or Inf, they are excluded
+    // from the bounded box, normals, level lines and drawing
+    mutable mask_t   m_mask;
+    mutable bool     m_has_invalid=false;
+    // precomputed frames of periodic animation
+    struct animation_cache_t
+    {
+        float  period;
+        size_t frames;
+        size_t max_bytes;
+    };
+    std::optional<animation_cache_t>         m_cache_settings;
+    mutable std::unique_ptr<CAnimationCache> m_animation_cache;
+    mutable grid_t                           m_cache_grid;
     bool             m_is_dynamic=false;
+    // the functors can be called from the worker thread
+    bool             m_thread_safe=false;
     mutable matrix_t m_normals;
     mutable bool     m_valid_normals=false;
     mutable matrix_t m_colors;
@@ -316,24 +397,73 @@ class CFunctionalMesh
     mutable std::array<uint32_t,3> m_num_levels={15,15,15};
     mutable std::array<std::vector<level_line_t>,3> m_levels;
     mutable std::array<bool,3> m_levels_valid={false,false,false};
-    mutable std::pair<point_t,point_t> m_bounded_box;
+    mutable box_t    m_bounded_box;
 
     mutable float  m_last_update_time=0.0f;
     CRenderingTraits m_traits;
     material_t     m_material;
     float          m_transparency=0.0;
+    bool           m_lean_memory=false;
+    positions_t    m_positions=box_positions_id;
+    // colors of the default functor, interpolated from the bottom
+    // to the top of the bounded box
+    std::vector<point_t> m_palette={{0.f,0.f,1.f},{2.f,2.f,-1.f}};
+    bool           m_height_colors=true;
+    bool           m_gpu_palette=true;
+    // points, normals and colors are dropped after the upload
+    mutable bool   m_released=false;
 
     // Motion data
 
     point_t         m_anchor={0,0,0};
     CRigidTransform m_rigid;
+    // the points, colors and normals of instance are taken from this mesh
+    const CFunctionalMesh*m_shared_geometry=nullptr;
+    // GLSL definition of the mesh functor for the vertex shader
+    std::string     m_gpu_surface;
 
     void m_InvalidateAll()const;
-    void m_SetBoundedBox()const;
-    void m_FillNormals()const;
-    void m_SetLevelLines(int,float)const;
+    void m_DropSamples();
+    bool m_RefinePoints(float)const;
+    void m_UpdateColumns(float)const;
+    CAnimationCache& m_AnimationCache()const;
+    void m_CachedPoints(float)const;
+    // asynchronous update, computed into its own buffers; the task of the
+    // worker holds the job too, it may be signalled after the mesh drops it.
+    // Mutable, the const Evaluate cancels the job.
+    struct async_job_t;
+    mutable std::shared_ptr<async_job_t> m_async_job;
+    // persistent thread of the jobs, started with the first one
+    struct async_worker_t;
+    std::unique_ptr<async_worker_t> m_async_worker;
+    // CPU time of the last taken job in ms
+    float m_async_ms=0;
+    // incremented on every change of the functors, grid or traits,
+    // which makes results of a running job stale
+    mutable uint64_t m_generation=0;
+
+    void m_InvalidateComputed()const;
+    void m_StartAsyncJob(float);
+    // blocks until the running job has stopped
+    void m_CancelAsyncJob()const;
+    int  m_TakeAsyncResult();
+    int  m_AsyncUpdateFlags(float)const;
+
+    int  m_SetMask(mask_t&,bool)const;
+    size_t m_ReleaseData();
+    void   m_RestoreReleased(bool force=false)const;
+    bool   m_ColorsRequired()const{return m_traits.IsColored()&&!IsGpuPalette();}
+
+    static bool m_FillMask(const matrix_t&,mask_t&);
+    static void m_SetBoundedBox(const matrix_t&,const mask_t*,box_t&);
+    static void m_FillNormals(const matrix_t&,const mask_t*,const grid_t&,matrix_t&);
+    static void m_SetLevelLines(const matrix_t&,const mask_t*,const grid_t&,const box_t&,
+                                uint32_t,int,std::vector<level_line_t>&);
     public:
     CFunctionalMesh();
+    CFunctionalMesh(const CFunctionalMesh&)=delete;
+    CFunctionalMesh&operator=(const CFunctionalMesh&)=delete;
+    ~CFunctionalMesh();
 
     // Set functions
     template<class f_t>
@@ -347,42 +477,48 @@ class CFunctionalMesh
             if(!(hint==dynamic_id&&trinary))
             {
                 m_points_functor=[func](float s,float t,float time)mutable{ return func(s,t);};
-                m_fill_functor=[func,this](matrix_t& mtx,const grid_t& grid,float)mutable
+                m_fill_functor=[func](matrix_t& mtx,const grid_t& grid,float)mutable
                 {
                     float s_delta=grid.s_delta();
                     float t_delta=grid.t_delta();
-                    for(eigen_size_t i_s=0;i_s<m_points.rows();++i_s)
+                    for(eigen_size_t i_s=0;i_s<mtx.rows();++i_s)
                     {
                         float s=s_delta*i_s+grid.s_range.first;
-                        for(eigen_size_t i_t=0;i_t<m_points.cols();++i_t)
+                        for(eigen_size_t i_t=0;i_t<mtx.cols();++i_t)
                         {
                             mtx(i_s,i_t)=func(s,t_delta*i_t+grid.t_range.first);
                         }
                     }
                 };
                 m_is_dynamic=false;
+                m_thread_safe=false;
+                m_gpu_surface.clear();
                 m_InvalidateAll();
+                m_DropSamples();
                 return *this;
             }
         }
         if constexpr(trinary)
         {
            m_points_functor=func;
-           m_fill_functor=[func,this](matrix_t& mtx,const grid_t& grid,float time)mutable
+           m_fill_functor=[func](matrix_t& mtx,const grid_t& grid,float time)mutable
            {
                 float s_delta=grid.s_delta();
                 float t_delta=grid.t_delta();
-                for(eigen_size_t i_s=0;i_s<m_points.rows();++i_s)
+                for(eigen_size_t i_s=0;i_s<mtx.rows();++i_s)
                 {
                      float s=s_delta*i_s+grid.s_range.first;
-                     for(eigen_size_t i_t=0;i_t<m_points.cols();++i_t)
+                     for(eigen_size_t i_t=0;i_t<mtx.cols();++i_t)
                      {
                           mtx(i_s,i_t)=func(s,t_delta*i_t+grid.t_range.first,time);
                      }
                  }
             };
             m_is_dynamic=hint!=static_id;
+            m_thread_safe=false;
+            m_gpu_surface.clear();
             m_InvalidateAll();
+            m_DropSamples();
             return *this;
         }
     }
@@ -393,25 +529,26 @@ class CFunctionalMesh
         using eig_size_t=decltype(m_points.rows());
         if constexpr( std::is_same_v<f_t,nullptr_t>)
         {
-            m_colors_functor=[this](const matrix_t&points,matrix_t&colors)
+            m_height_colors=true;
+            m_colors_functor=[palette=m_palette](const matrix_t&points,const box_t&box,matrix_t&colors)
             {
                 assert(colors.rows()==points.rows()&&colors.cols()==points.cols());
-                const point_t a(0.f,0.f,1.0f);
-                const point_t b(1.f,1.f,-1.0f);
-                const float max_dz=(m_bounded_box.second[2]-m_bounded_box.first[2])/2;
+                const float dz=box.second[2]-box.first[2];
                 for(eig_size_t i_s=0;i_s<points.rows();++i_s)
                 {
                     for(eig_size_t i_t=0;i_t<points.cols();++i_t)
                     {
-                        float relative_coord=(points(i_s,i_t)[2]-m_bounded_box.first[2])/max_dz;
-                        colors(i_s,i_t)=a+relative_coord*b;
+                        const float u=dz>0? (points(i_s,i_t)[2]-box.first[2])/dz:0.0f;
+                        colors(i_s,i_t)=PaletteColor(palette,u);
                     }
                 }
             };
         }
         else
         {
-            m_colors_functor=[moved=std::move(func)](const matrix_t&points,matrix_t&colors)mutable
+            m_height_colors=false;
+            m_thread_safe=false;
+            m_colors_functor=[moved=std::move(func)](const matrix_t&points,const box_t&,matrix_t&colors)mutable
             {
                 assert(colors.rows()==points.rows()&&colors.cols()==points.cols());
                 for(eig_size_t i_s=0;i_s<points.rows();++i_s)
@@ -425,6 +562,7 @@ class CFunctionalMesh
             };
         }
         m_valid_colors=false;
+        ++m_generation;
         return *this;
     }
     template<class f_t>
@@ -434,23 +572,34 @@ class CFunctionalMesh
         if constexpr( std::is_same_v<f_t,nullptr_t>) return SetColorFunctor(nullptr);
         else
         {
-            m_colors_functor=[moved=std::move(func),this](const matrix_t&points,matrix_t&colors)mutable
+            m_height_colors=false;
+            m_thread_safe=false;
+            m_colors_functor=[moved=std::move(func)](const matrix_t&points,const box_t&box,matrix_t&colors)mutable
             {
                 assert(colors.rows()==points.rows()&&colors.cols()==points.cols());
-                const point_t diag=m_bounded_box.second-m_bounded_box.first;
+                const point_t diag=box.second-box.first;
                 for(eig_size_t i_s=0;i_s<points.rows();++i_s)
                 {
                     for(eig_size_t i_t=0;i_t<points.cols();++i_t)
                     {
-                        const point_t delta=points(i_s,i_t)-m_bounded_box.first;
+                        const point_t delta=points(i_s,i_t)-box.first;
                         colors(i_s,i_t)=moved(delta[0]/diag[0],delta[1]/diag[1],delta[2]/diag[2]);
                     }
                 }
             };
         }
         m_valid_colors=false;
+        ++m_generation;
         return *this;
     }
+    // Animation cache mode for dynamic surfaces, periodic in time:
+    // 'frames' frames over 'period' are computed in the background
+    // (the mesh functor must be safe to call from another thread),
+    // at most 'max_bytes' of them are held at once.
+    CFunctionalMesh& SetAnimationCache(float period,size_t frames,size_t max_bytes=default_cache_bytes);
+    CFunctionalMesh& DropAnimationCache();
+    const CAnimationCache*AnimationCache()const{return m_animation_cache.get();}
+
     template<class f_t>
     CFunctionalMesh& SetUpdateCallback(f_t f)
     {
@@ -464,6 +613,22 @@ class CFunctionalMesh
     CFunctionalMesh& SetResolution(size_t s_resol,size_t t_resol);
     CFunctionalMesh& SetRange(std::pair<float,float>,std::pair<float,float>);
     CFunctionalMesh& SetTraits(const CRenderingTraits&);
+    // The mesh functor is changed only for t in 't_range':
+    // the next update recomputes and reports only the covering columns
+    CFunctionalMesh& InvalidateRange(std::pair<float,float> t_range);
+    // Reduced memory: CScene quantizes the attributes (normals into
+    // 2x16 bit octahedral, colors into RGBA8, positions as 'positions')
+    // and releases points, normals and colors of static mesh after
+    // the upload, Points(), Normals() and Colors() return nullptr then.
+    // Half float positions don't depend on the box, so dynamic meshes
+    // upload only the changed columns of 6 bytes per point.
+    CFunctionalMesh& SetLeanMemory(bool lean,positions_t positions=box_positions_id);
+    // Colors of SetColorFunctor(nullptr) at equal steps of the height
+    CFunctionalMesh& SetPalette(std::vector<point_t>);
+    // The height colors are derived from the positions and the palette
+    // in the shader, so they aren't computed and uploaded, Colors()
+    // returns nullptr then
+    CFunctionalMesh& SetGpuPalette(bool);
     CFunctionalMesh& SetNumberOfLevelsX(uint32_t);
     CFunctionalMesh& SetNumberOfLevelsY(uint32_t);
     CFunctionalMesh& SetNumberOfLevelsZ(uint32_t);
@@ -476,6 +641,18 @@ class CFunctionalMesh
         m_transparency=t;
         return *this;
     }
+    // Instance of 'geometry': CScene draws it with the buffers and the traits
+    // of 'geometry' and with its own transform, material and transparency,
+    // instances of the same geometry are drawn by one instanced draw call.
+    // The mesh isn't updated itself, 'geometry' must be added to the scene.
+    // nullptr makes the mesh independent again.
+    CFunctionalMesh& SetSharedGeometry(const CFunctionalMesh*geometry);
+    // GLSL source, which defines vec3 surface(float s,float t,float time)
+    // equal to the mesh functor. CScene evaluates the points and the normals
+    // of dynamic mesh in the vertex shader then, the functor is called only
+    // at the changes of the grid or traits: for the index buffers, the bounded
+    // box and the palette range. SetMeshFunctor drops the source.
+    CFunctionalMesh& SetGpuSurface(std::string source);
 
     // Motion
     CFunctionalMesh& SetAnchor(const point_t&);
@@ -502,9 +679,20 @@ class CFunctionalMesh
     const matrix_t*Points()const;
     const matrix_t*Colors()const;
     const matrix_t*Normals()const;
-    const std::pair<point_t,point_t>* BoundedBox()const;
+    const box_t* BoundedBox()const;
+    // nullptr, if all samples are valid
+    const mask_t* Mask()const;
     const std::vector<level_line_t>*  Levels(int i)const;
     bool IsDynamic()const{return m_is_dynamic;}
+    const std::vector<point_t>& Palette()const{return m_palette;}
+    bool IsGpuPalette()const{return m_gpu_palette&&m_height_colors&&m_traits.IsColored();}
+    // color of the palette in u from [0,1]
+    static point_t PaletteColor(const std::vector<point_t>&,float u);
+    bool IsLeanMemory()const{return m_lean_memory;}
+    positions_t PositionsFormat()const{return m_lean_memory? m_positions:float_positions_id;}
+    bool IsReleased()const{return m_released;}
+    const CFunctionalMesh*SharedGeometry()const{return m_shared_geometry;}
+    const std::string& GpuSurface()const{return m_gpu_surface;}
     bool Empty()const;
     float LastUpdateTime()const;
     CRenderingTraits&RenderingTraits();
@@ -517,6 +705,23 @@ class CFunctionalMesh
 
     CUpdateResult UpdateData(float);
     CUpdateResult UpdateData();
+    // Non blocking update: the recomputation for 'time' runs in a worker
+    // thread with its own buffers, the previous data stays valid until
+    // the new one is completed and swapped in by one of the next calls.
+    // Running job is cancelled, if the grid or functors are changed.
+    // The mesh is updated in place, unless its functors are thread safe.
+    // If 'start' is false, only the result of finished job is taken.
+    CUpdateResult UpdateDataAsync(float,bool start=true);
+    // The mesh and color functors don't share a mutable state with
+    // other code, so the job can call them. Dropped by their setters.
+    CFunctionalMesh& SetThreadSafeFunctors(bool);
+    bool          IsThreadSafeFunctors()const{return m_thread_safe;}
+    bool          IsUpdating()const{return m_async_job!=nullptr;}
+    float         AsyncUpdateTime()const{return m_async_ms;}
+    // Points of grid rows [first_row,last_row) in the moment 'time',
+    // evaluated without touching the stored data. The running job is
+    // cancelled first, blocking until the worker has left the functor.
+    void Evaluate(float time,size_t first_row,size_t last_row,matrix_t&points)const;
 
     // Set specific surface
     CFunctionalMesh& SetSphere(float r,size_t teta_resol=default_resolution,size_t phi_resol=default_resolution);
@@ -526,6 +731,7 @@ class CFunctionalMesh
     CFunctionalMesh& SetPlane(float dx,float dy,size_t x_resol=1,size_t y_resol=1);
 
     friend class CScene;
+    friend class CMeshExporter;
 };
 
 #endif
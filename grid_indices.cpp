@@ -0,0 +1,155 @@
+#include <assert.h>
+#include <algorithm>
+
+#include "grid_indices.h"
+
+namespace{
+
+// rows [first,last] of the band, the last row is shared with the next band
+template<class visitor_t>
+void visit_bands(int rows,int band,visitor_t visitor)
+{
+    if(band<=0) band=rows-1;
+    for(int first=0;first<rows-1;first+=band) visitor(first,std::min(first+band,rows-1));
+}
+
+}
+
+void MakeEigesIndexes(int rows,int cols,std::vector<unsigned>&data)
+{
+    data.resize(2*rows*cols);
+    int index=0;
+    int pos=0;
+    for(int i=0;i<cols;++i)// by cols
+    {
+        if(i&1)
+        {
+            for(int j=0;j<rows;++j)
+            {
+                data[pos++]=index--;
+            }
+            index+=rows+1;
+        }
+        else
+        {
+            for(int j=0;j<rows;++j)
+            {
+                data[pos++]=index++;
+            }
+            index+=rows-1;
+        }
+    }
+    int delta;
+    if(cols&1)
+    {
+        delta=-1;
+        index=rows*cols-1;
+    }
+    else
+    {
+        delta=1;
+        index=rows*(cols-1);
+    }
+    for(int i=0;i<rows;++i)// by rows
+    {
+        if(i&1)
+        {
+            for(int j=0;j<cols;++j)
+            {
+                data[pos++]=index;
+                index+=rows;
+            }
+            index+=delta-rows;
+        }
+        else
+        {
+            for(int j=0;j<cols;++j)
+            {
+                data[pos++]=index;
+                index-=rows;
+            }
+            index+=delta+rows;
+        }
+    }
+    assert(pos==2*rows*cols);
+}
+
+void MakeTriansIndexes(int rows,int cols,std::vector<unsigned>&data,int band)
+{
+    data.resize((rows-1)*(cols-1)*6);
+
+    int pos=0;
+    visit_bands(rows,band,[&](int first,int last)
+    {
+        for(int j=0;j<cols-1;++j)
+        {
+            for(int i=first;i<last;++i)
+            {
+                const int index=i+j*rows;
+                data[pos++]=index;
+                data[pos++]=index+1;
+                data[pos++]=index+1+rows;
+
+                data[pos++]=index+1+rows;
+                data[pos++]=index+rows;
+                data[pos++]=index;
+            }
+        }
+    });
+    assert(pos==(rows-1)*(cols-1)*6);
+}
+
+void MakeTriansStrips(int rows,int cols,std::vector<unsigned>&data,int band)
+{
+    std::size_t size=0;
+    visit_bands(rows,band,[&](int first,int last){size+=(cols-1)*(2*(last-first+1)+1);});
+    data.resize(size);
+
+    std::size_t pos=0;
+    visit_bands(rows,band,[&](int first,int last)
+    {
+        for(int j=0;j<cols-1;++j)
+        {
+            for(int i=first;i<=last;++i)
+            {
+                data[pos++]=i+(j+1)*rows;
+                data[pos++]=i+j*rows;
+            }
+            data[pos++]=restart_index;
+        }
+    });
+    assert(pos==size);
+}
+
+// Vertex is in the cache, if less than cache_size vertices
+// were inserted after it
+
+vertex_cache_stat_t SimulateVertexCache(const std::vector<unsigned>&indices,bool strips,std::size_t cache_size)
+{
+    vertex_cache_stat_t stat;
+    unsigned max_index=0;
+    for(auto index:indices) if(index!=restart_index) max_index=std::max(max_index,index);
+
+    const std::size_t never=~std::size_t(0);
+    std::vector<std::size_t> inserted(std::size_t(max_index)+1,never);
+    std::size_t insertions=0;
+    std::size_t strip_length=0;
+    for(auto index:indices)
+    {
+        if(index==restart_index)
+        {
+            strip_length=0;
+            continue;
+        }
+        auto&stamp=inserted[index];
+        if(stamp==never) ++stat.vertices;
+        if(stamp==never||insertions-stamp>cache_size)
+        {
+            stamp=insertions++;
+            ++stat.misses;
+        }
+        if(strips&&++strip_length>=3) ++stat.triangles;
+    }
+    if(!strips) stat.triangles=indices.size()/3;
+    return stat;
+}
@@ -0,0 +1,44 @@
+#ifndef  _grid_indices_
+#define  _grid_indices_
+
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+// Index buffers of the grid rows x cols, which is stored column by column:
+// the point (i,j) has index i+j*rows. Triangles of the quad (i,j) are
+// (i,j),(i+1,j),(i+1,j+1) and (i+1,j+1),(i,j+1),(i,j).
+//
+// The quads are visited in bands of 'band' rows, column by column inside
+// of the band, so the vertices shared by neighbouring columns are still
+// in the post-transform cache: 2*(band+1) vertices must fit, the default
+// band is chosen for 32 entries. Band 0 sweeps entire columns.
+
+// index, which breaks strips
+constexpr unsigned      restart_index=~0u;
+constexpr std::uint16_t restart_index16=~std::uint16_t(0);
+constexpr int           default_band_rows=14;
+constexpr std::size_t   default_cache_size=32;
+
+// Line strips along the columns and then along the rows
+void MakeEigesIndexes(int rows,int cols,std::vector<unsigned>&data);
+// Triangle list
+void MakeTriansIndexes(int rows,int cols,std::vector<unsigned>&data,int band=default_band_rows);
+// Triangle strips for each pair of columns inside of the band, separated by restart index
+void MakeTriansStrips(int rows,int cols,std::vector<unsigned>&data,int band=default_band_rows);
+
+// Transformed vertices of FIFO post-transform cache
+struct vertex_cache_stat_t
+{
+    std::size_t triangles=0;
+    std::size_t vertices=0;// distinct
+    std::size_t misses=0;
+    // average cache miss ratio: transforms per triangle, 0.5 at best for grids
+    double ACMR()const{return triangles? double(misses)/triangles:0.0;}
+    // transforms per vertex, 1 at best
+    double ATVR()const{return vertices? double(misses)/vertices:0.0;}
+};
+vertex_cache_stat_t SimulateVertexCache(const std::vector<unsigned>&indices,bool strips,
+                                        std::size_t cache_size=default_cache_size);
+
+#endif
@@ -0,0 +1,435 @@
+#include <assert.h>
+#include <algorithm>
+#include <cmath>
+
+#include "implicit_mesh.h"
+#include "parallel_for.h"
+
+///////////////////////////////////////////////////////////////
+//                    CImplicitMesh
+///////////////////////////////////////////////////////////////
+
+CImplicitMesh& CImplicitMesh::SetIsoValue(float iso)
+{
+    if(iso!=m_iso) m_valid=false;
+    m_iso=iso;
+    return *this;
+}
+
+CImplicitMesh& CImplicitMesh::SetBox(const point_t&min,const point_t&max)
+{
+    assert(min[0]<max[0]&&min[1]<max[1]&&min[2]<max[2]);
+    m_box={min,max};
+    m_valid=false;
+    return *this;
+}
+
+CImplicitMesh& CImplicitMesh::SetResolution(size_t x,size_t y,size_t z)
+{
+    assert(x>0&&y>0&&z>0);
+    m_resolution={x,y,z};
+    m_valid=false;
+    return *this;
+}
+
+CImplicitMesh& CImplicitMesh::SetBlockSize(size_t block_size)
+{
+    m_block_size=block_size;
+    m_valid=false;
+    return *this;
+}
+
+CImplicitMesh& CImplicitMesh::SetSkipSafety(float safety)
+{
+    assert(safety>0);
+    m_skip_safety=safety;
+    m_valid=false;
+    return *this;
+}
+
+CImplicitMesh& CImplicitMesh::SetTraits(const CRenderingTraits&traits)
+{
+    m_traits=traits;
+    return *this;
+}
+
+CImplicitMesh& CImplicitMesh::SetMaterial(const material_t&material)
+{
+    m_material=material;
+    return *this;
+}
+
+CImplicitMesh& CImplicitMesh::SetTransparency(float transparency)
+{
+    m_transparency=transparency;
+    return *this;
+}
+
+CImplicitMesh& CImplicitMesh::SetFunctorMaker(maker_t make)
+{
+    m_functor=make();
+    m_maker=std::move(make);
+    m_tile_functors.clear();
+    m_concurrent=true;
+    m_valid=false;
+    return *this;
+}
+
+void CImplicitMesh::Clear()
+{
+    m_functor=nullptr;
+    m_maker=nullptr;
+    m_tile_functors.clear();
+    m_vertices.clear();
+    m_normals.clear();
+    m_indices.clear();
+    m_stat=stat_t{};
+    m_valid=false;
+}
+
+CImplicitMesh::point_t CImplicitMesh::m_Point(size_t i,size_t j,size_t k)const
+{
+    const point_t diag=m_box.second-m_box.first;
+    return m_box.first+point_t(diag[0]*i/m_resolution[0],
+                               diag[1]*j/m_resolution[1],
+                               diag[2]*k/m_resolution[2]);
+}
+
+void CImplicitMesh::m_MakeTileFunctors(size_t tiles)
+{
+    if(!m_maker) return;
+    while(m_tile_functors.size()+1<tiles) m_tile_functors.push_back(m_maker());
+}
+
+const CImplicitMesh::functor_t& CImplicitMesh::m_TileFunctor(size_t tile)const
+{
+    return tile==0||!m_maker? m_functor:m_tile_functors[tile-1];
+}
+
+std::array<std::size_t,3> CImplicitMesh::m_Blocks()const
+{
+    std::array<size_t,3> blocks;
+    for(int a=0;a<3;++a) blocks[a]=(m_resolution[a]+m_block_size-1)/m_block_size;
+    return blocks;
+}
+
+// Sample the field in the block corners and select blocks,
+// which can contain the surface: corners of different sign, or |f|
+// in the corners less than the estimated variation of f over the block
+
+void CImplicitMesh::m_ActiveBlocks(std::vector<block_t>&active)
+{
+    const size_t B=m_block_size;
+    const auto   nb=m_Blocks();
+    const size_t cx=nb[0]+1,cy=nb[1]+1,cz=nb[2]+1;
+    auto coarse=[&](size_t m,int a){return std::min(m*B,m_resolution[a]);};
+    auto coarse_index=[cx,cy](size_t i,size_t j,size_t k){return i+cx*(j+cy*k);};
+
+    std::vector<float> values(cx*cy*cz);
+    m_MakeTileFunctors(par::tiles(cz,m_concurrent? 1:cz));
+    par::tiles_for(cz,m_concurrent? 1:cz,[&](size_t tile,size_t begin,size_t end)
+    {
+        const functor_t&functor=m_TileFunctor(tile);
+        for(size_t k=begin;k<end;++k)
+          for(size_t j=0;j<cy;++j)
+            for(size_t i=0;i<cx;++i)
+            {
+                const point_t p=m_Point(coarse(i,0),coarse(j,1),coarse(k,2));
+                values[coarse_index(i,j,k)]=functor(p[0],p[1],p[2])-m_iso;
+            }
+    });
+    m_stat.evaluations+=values.size();
+
+    const point_t cell=(m_box.second-m_box.first).cwiseQuotient(
+                       point_t(m_resolution[0],m_resolution[1],m_resolution[2]));
+    const size_t num_blocks=nb[0]*nb[1]*nb[2];
+    std::vector<float> slope(num_blocks,0.0f),min_abs(num_blocks);
+    std::vector<char>  mixed(num_blocks);
+    auto block_index=[&nb](size_t i,size_t j,size_t k){return i+nb[0]*(j+nb[1]*k);};
+    for(size_t k=0;k<nb[2];++k)
+      for(size_t j=0;j<nb[1];++j)
+        for(size_t i=0;i<nb[0];++i)
+        {
+            const size_t index=block_index(i,j,k);
+            const std::array<size_t,3> org={i,j,k};
+            std::array<float,8> corners;
+            for(int c=0;c<8;++c)
+            {
+                corners[c]=values[coarse_index(i+(c&1),j+((c>>1)&1),k+((c>>2)&1))];
+            }
+            bool positive=false,negative=false,finite=true;
+            min_abs[index]=std::numeric_limits<float>::max();
+            for(float v:corners)
+            {
+                finite&=std::isfinite(v);
+                (v<0? negative:positive)=true;
+                min_abs[index]=std::min(min_abs[index],std::abs(v));
+            }
+            mixed[index]=(positive&&negative)||!finite;
+            for(int a=0;a<3;++a)
+            {
+                const float length=(coarse(org[a]+1,a)-coarse(org[a],a))*cell[a];
+                for(int c=0;c<8;++c)
+                {
+                    if(c&(1<<a)) continue;
+                    slope[index]=std::max(slope[index],std::abs(corners[c|(1<<a)]-corners[c])/length);
+                }
+            }
+        }
+
+    for(size_t k=0;k<nb[2];++k)
+      for(size_t j=0;j<nb[1];++j)
+        for(size_t i=0;i<nb[0];++i)
+        {
+            const size_t index=block_index(i,j,k);
+            bool is_active=mixed[index];
+            if(!is_active)
+            {
+                // variation of f is estimated by the block and its neighbours
+                float variation=slope[index];
+                const std::array<size_t,3> org={i,j,k};
+                for(int a=0;a<3;++a)
+                {
+                    std::array<size_t,3> next=org;
+                    if(org[a]>0)
+                    {
+                        --next[a];
+                        variation=std::max(variation,slope[block_index(next[0],next[1],next[2])]);
+                        ++next[a];
+                    }
+                    if(org[a]+1<nb[a])
+                    {
+                        ++next[a];
+                        variation=std::max(variation,slope[block_index(next[0],next[1],next[2])]);
+                    }
+                }
+                point_t extent;
+                for(int a=0;a<3;++a) extent[a]=(coarse(org[a]+1,a)-coarse(org[a],a))*cell[a];
+                is_active=!(min_abs[index]>m_skip_safety*variation*extent.norm()/2);
+            }
+            if(is_active)
+            {
+                active.push_back({});
+                active.back().m_index=index;
+            }
+        }
+}
+
+// Sample the field in the block, place vertices in the crossed cells
+// and collect the crossed edges, which start in the block
+
+void CImplicitMesh::m_ContourBlock(block_t&block,std::vector<float>&samples,const functor_t&functor)const
+{
+    const size_t B=m_block_size;
+    const auto   nb=m_Blocks();
+    const std::array<size_t,3> org={(block.m_index%nb[0])*B,
+                                    (block.m_index/nb[0]%nb[1])*B,
+                                    (block.m_index/(nb[0]*nb[1]))*B};
+    std::array<size_t,3> ext;
+    for(int a=0;a<3;++a) ext[a]=std::min(B,m_resolution[a]-org[a]);
+    const size_t sx=ext[0]+1,sy=ext[1]+1;
+    auto sample=[&](size_t i,size_t j,size_t k)->float&{return samples[i+sx*(j+sy*k)];};
+
+    samples.resize(sx*sy*(ext[2]+1));
+    for(size_t k=0;k<=ext[2];++k)
+      for(size_t j=0;j<=ext[1];++j)
+        for(size_t i=0;i<=ext[0];++i)
+        {
+            const point_t p=m_Point(org[0]+i,org[1]+j,org[2]+k);
+            sample(i,j,k)=functor(p[0],p[1],p[2])-m_iso;
+        }
+
+    const point_t cell=(m_box.second-m_box.first).cwiseQuotient(
+                       point_t(m_resolution[0],m_resolution[1],m_resolution[2]));
+    for(size_t k=0;k<ext[2];++k)
+      for(size_t j=0;j<ext[1];++j)
+        for(size_t i=0;i<ext[0];++i)
+        {
+            // corner c is (i+(c&1),j+(c>>1&1),k+(c>>2&1))
+            std::array<float,8> v;
+            bool positive=false,negative=false,finite=true;
+            for(int c=0;c<8;++c)
+            {
+                v[c]=sample(i+(c&1),j+((c>>1)&1),k+((c>>2)&1));
+                finite&=std::isfinite(v[c]);
+                (v[c]<0? negative:positive)=true;
+            }
+            if(!finite||!(positive&&negative)) continue;
+
+            // mass point of the edge intersections
+            point_t mass(0,0,0);
+            int     crossings=0;
+            for(int a=0;a<3;++a)
+            {
+                for(int c=0;c<8;++c)
+                {
+                    if(c&(1<<a)) continue;
+                    const int next=c|(1<<a);
+                    if((v[c]<0)==(v[next]<0)) continue;
+                    point_t p((c&1),((c>>1)&1),((c>>2)&1));
+                    p[a]=v[c]/(v[c]-v[next]);
+                    mass+=p;
+                    ++crossings;
+                }
+            }
+            mass/=crossings;
+
+            // gradient of the trilinear interpolation in the mass point
+            point_t grad(0,0,0);
+            for(int c=0;c<8;++c)
+            {
+                for(int a=0;a<3;++a)
+                {
+                    float weight=(c&(1<<a))? 1.0f:-1.0f;
+                    for(int b=0;b<3;++b)
+                    {
+                        if(b!=a) weight*=(c&(1<<b))? mass[b]:1-mass[b];
+                    }
+                    grad[a]+=weight*v[c];
+                }
+            }
+            grad=grad.cwiseQuotient(cell);
+            if(grad.squaredNorm()>0) grad.normalize();
+
+            block.m_cells.push_back(i+B*(j+B*k));
+            block.m_vertices.push_back(m_Point(org[0]+i,org[1]+j,org[2]+k)+mass.cwiseProduct(cell));
+            block.m_normals.push_back(grad);
+        }
+
+    // edges from the points of the block, surrounded by four cells
+    for(size_t k=0;k<ext[2];++k)
+      for(size_t j=0;j<ext[1];++j)
+        for(size_t i=0;i<ext[0];++i)
+        {
+            const std::array<size_t,3> p={i,j,k};
+            const float v=sample(i,j,k);
+            if(!std::isfinite(v)) continue;
+            for(int a=0;a<3;++a)
+            {
+                const int u=(a+1)%3,w=(a+2)%3;
+                if(org[u]+p[u]==0||org[w]+p[w]==0) continue;
+                std::array<size_t,3> q=p;
+                ++q[a];
+                const float next=sample(q[0],q[1],q[2]);
+                if(!std::isfinite(next)||(v<0)==(next<0)) continue;
+                block.m_edges.push_back(((i+B*(j+B*k))*3+a)*2+(v<0));
+            }
+        }
+}
+
+const CImplicitMesh::block_t* CImplicitMesh::m_FindBlock(const std::vector<block_t>&active,
+                                                         const std::vector<int>&table,size_t index)const
+{
+    const int pos=table[index];
+    return pos<0? nullptr:&active[pos];
+}
+
+bool CImplicitMesh::UpdateData()
+{
+    if(m_valid||Empty()) return false;
+    m_stat=stat_t{};
+    const size_t max_resolution=*std::max_element(m_resolution.begin(),m_resolution.end());
+    const size_t B=m_block_size;
+    if(B==0) m_block_size=max_resolution;// single block without skipping
+    assert(m_block_size*m_block_size*m_block_size*8<=std::numeric_limits<uint32_t>::max());
+
+    const auto nb=m_Blocks();
+    std::vector<block_t> active;
+    if(B==0)
+    {
+        active.push_back({});
+        active.back().m_index=0;
+    }
+    else
+    {
+        m_ActiveBlocks(active);
+    }
+    m_stat.blocks=nb[0]*nb[1]*nb[2];
+    m_stat.active_blocks=active.size();
+
+    std::vector<int> table(m_stat.blocks,-1);
+    for(size_t i=0;i<active.size();++i) table[active[i].m_index]=i;
+
+    // vertices and crossed edges of the active blocks
+    const size_t num_tiles=par::tiles(active.size(),m_concurrent? 1:active.size());
+    std::vector<size_t> evaluations(num_tiles,0);
+    m_MakeTileFunctors(num_tiles);
+    par::tiles_for(active.size(),m_concurrent? 1:active.size(),[&](size_t tile,size_t begin,size_t end)
+    {
+        std::vector<float> samples;
+        for(size_t i=begin;i<end;++i)
+        {
+            m_ContourBlock(active[i],samples,m_TileFunctor(tile));
+            evaluations[tile]+=samples.size();
+        }
+    });
+    for(auto count:evaluations) m_stat.evaluations+=count;
+
+    size_t num_vertices=0;
+    for(auto&block:active)
+    {
+        block.m_first_vertex=num_vertices;
+        num_vertices+=block.m_vertices.size();
+    }
+
+    // quads around the crossed edges, oriented along the gradient
+    const size_t BB=m_block_size;
+    std::vector<std::vector<uint32_t>> indices(active.size());
+    par::tiles_for(active.size(),1,[&](size_t,size_t begin,size_t end)
+    {
+        for(size_t b=begin;b<end;++b)
+        {
+            const block_t&block=active[b];
+            const std::array<size_t,3> org={(block.m_index%nb[0])*BB,
+                                            (block.m_index/nb[0]%nb[1])*BB,
+                                            (block.m_index/(nb[0]*nb[1]))*BB};
+            auto vertex=[&](const std::array<size_t,3>&c)->int64_t
+            {
+                const size_t index=c[0]/BB+nb[0]*(c[1]/BB+nb[1]*(c[2]/BB));
+                const block_t*owner=m_FindBlock(active,table,index);
+                if(!owner) return -1;
+                const uint32_t local=c[0]%BB+BB*(c[1]%BB+BB*(c[2]%BB));
+                auto iter=std::lower_bound(owner->m_cells.begin(),owner->m_cells.end(),local);
+                if(iter==owner->m_cells.end()||*iter!=local) return -1;
+                return owner->m_first_vertex+(iter-owner->m_cells.begin());
+            };
+            for(uint32_t code:block.m_edges)
+            {
+                const bool   flip=code&1;
+                const int    a=(code>>1)%3;
+                const size_t local=(code>>1)/3;
+                const std::array<size_t,3> p={org[0]+local%BB,org[1]+local/BB%BB,org[2]+local/(BB*BB)};
+                const int u=(a+1)%3,w=(a+2)%3;
+                std::array<std::array<size_t,3>,4> cells={p,p,p,p};
+                --cells[1][u];
+                --cells[2][u];--cells[2][w];
+                --cells[3][w];
+                std::array<int64_t,4> quad;
+                bool complete=true;
+                for(int c=0;c<4;++c)
+                {
+                    quad[c]=vertex(cells[c]);
+                    complete&=quad[c]>=0;
+                }
+                if(!complete) continue;
+                if(!flip) std::swap(quad[1],quad[3]);
+                for(int c:{0,1,2,0,2,3}) indices[b].push_back(quad[c]);
+            }
+        }
+    });
+
+    m_vertices.clear();
+    m_normals.clear();
+    m_indices.clear();
+    m_vertices.reserve(num_vertices);
+    m_normals.reserve(num_vertices);
+    for(size_t b=0;b<active.size();++b)
+    {
+        m_vertices.insert(m_vertices.end(),active[b].m_vertices.begin(),active[b].m_vertices.end());
+        m_normals.insert(m_normals.end(),active[b].m_normals.begin(),active[b].m_normals.end());
+        m_indices.insert(m_indices.end(),indices[b].begin(),indices[b].end());
+    }
+    m_block_size=B;
+    m_valid=true;
+    return true;
+}
@@ -0,0 +1,128 @@
+#ifndef  _implicit_mesh_
+#define  _implicit_mesh_
+
+#include <functional>
+#include <vector>
+#include <array>
+
+#include <Eigen/Core>
+
+#include "functional_mesh.h"
+
+// CImplicitMesh - surface f(x,y,z)=iso inside of the box, triangulated by
+// dual contouring (a vertex per cell, crossed by the surface, placed in
+// the mass point of the edge intersections, and a quad per crossed edge).
+// The grid is divided into blocks of cells, the field is sampled first in
+// the block corners only, blocks, which can't contain the surface,
+// are skipped. Blocks are processed in parallel, if the functor allows it.
+
+class CImplicitMesh
+{
+    public:
+    using point_t=Eigen::Vector3f;
+    using functor_t=std::function<float(float,float,float)>;
+    using maker_t=std::function<functor_t()>;
+    using box_t=std::pair<point_t,point_t>;
+    using size_t=std::size_t;
+    static const size_t default_resolution=64;
+    static const size_t default_block_size=8;
+    // Statistics of the last update
+    struct stat_t
+    {
+        size_t blocks=0;
+        size_t active_blocks=0;
+        size_t evaluations=0;
+    };
+    private:
+    // Cells of an active block, crossed by the surface,
+    // and the edges, which produce quads
+    struct block_t
+    {
+        size_t                m_index;
+        size_t                m_first_vertex=0;
+        std::vector<uint32_t> m_cells;
+        std::vector<point_t>  m_vertices;
+        std::vector<point_t>  m_normals;
+        std::vector<uint32_t> m_edges;
+    };
+    functor_t  m_functor;
+    // functors of the parallel tiles 1,2,..., tile 0 samples m_functor
+    maker_t    m_maker;
+    std::vector<functor_t> m_tile_functors;
+    bool       m_concurrent=true;
+    float      m_iso=0.0f;
+    box_t      m_box={point_t(-1,-1,-1),point_t(1,1,1)};
+    std::array<size_t,3> m_resolution={default_resolution,default_resolution,default_resolution};
+    size_t     m_block_size=default_block_size;
+    float      m_skip_safety=1.0f;
+
+    bool       m_valid=false;
+    std::vector<point_t>  m_vertices;
+    std::vector<point_t>  m_normals;
+    std::vector<uint32_t> m_indices;
+    stat_t     m_stat;
+
+    CRenderingTraits m_traits=CRenderingTraits(CRenderingTraits::specular_surface_id|
+                                               CRenderingTraits::two_side_specular_id);
+    material_t m_material;
+    float      m_transparency=0.0f;
+
+    point_t m_Point(size_t i,size_t j,size_t k)const;
+    std::array<size_t,3> m_Blocks()const;
+    void    m_MakeTileFunctors(size_t tiles);
+    const functor_t& m_TileFunctor(size_t tile)const;
+    void    m_ActiveBlocks(std::vector<block_t>&);
+    void    m_ContourBlock(block_t&,std::vector<float>&,const functor_t&)const;
+    const block_t* m_FindBlock(const std::vector<block_t>&,const std::vector<int>&,size_t)const;
+    public:
+    CImplicitMesh(){}
+
+    // The functor must be thread safe, if 'concurrent' is set: functions
+    // of CFunctionPool aren't, they are set by SetFunctorMaker
+    template<class f_t>
+    CImplicitMesh& SetFunctor(f_t func,bool concurrent=true)
+    {
+        m_functor=std::move(func);
+        m_maker=nullptr;
+        m_tile_functors.clear();
+        m_concurrent=concurrent;
+        m_valid=false;
+        return *this;
+    }
+    // Own functor of each parallel tile, made by 'make' in the updating
+    // thread and kept for the next updates: with CFunctionPool::CloneFunction
+    // a function of the pool is sampled concurrently
+    CImplicitMesh& SetFunctorMaker(maker_t make);
+    CImplicitMesh& SetIsoValue(float);
+    CImplicitMesh& SetBox(const point_t&min,const point_t&max);
+    CImplicitMesh& SetResolution(size_t x,size_t y,size_t z);
+    CImplicitMesh& SetResolution(size_t n){return SetResolution(n,n,n);}
+    // cells along block edge, 0 disables skipping of blocks
+    CImplicitMesh& SetBlockSize(size_t);
+    // Block is skipped, if |f| in its corners exceeds the variation
+    // of f, estimated by differences between neighbouring corners
+    // and multiplied by 'safety'. Larger values are more conservative.
+    CImplicitMesh& SetSkipSafety(float safety);
+    CImplicitMesh& SetTraits(const CRenderingTraits&);
+    CImplicitMesh& SetMaterial(const material_t&);
+    CImplicitMesh& SetTransparency(float);
+
+    // Recompute the surface, if it's invalid, returns true, if recomputed
+    bool UpdateData();
+    void Clear();
+
+    const std::vector<point_t>&  Vertices()const{return m_vertices;}
+    const std::vector<point_t>&  Normals()const{return m_normals;}
+    const std::vector<uint32_t>& Indices()const{return m_indices;}
+    size_t Triangles()const{return m_indices.size()/3;}
+    const stat_t& Statistics()const{return m_stat;}
+    const box_t&  Box()const{return m_box;}
+    bool  Empty()const{return !m_functor;}
+
+    CRenderingTraits&RenderingTraits(){return m_traits;}
+    const CRenderingTraits&RenderingTraits()const{return m_traits;}
+    const material_t&GetMaterial()const{return m_material;}
+    float Transparency()const{return m_transparency;}
+};
+
+#endif
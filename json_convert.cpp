@@ -1,6 +1,7 @@
 #include <algorithm>
 #include <regex>
 #include <tuple>
+#include <numbers>
 
 #include "../../CppProjects/json11/json11.hpp"
 #include "json_convert.h"
@@ -124,3 +125,175 @@ void ToJson(std::string&str,const CFunctionPool&pool)
   str= Json(Json::object({{"constants",constants},
                           {"functions",functions}})).dump();
 }
+
+string SceneFromJson(const string&str,scene_description_t&scene)
+{
+  using namespace json11;
+  using namespace std::numbers;
+  auto get_range=[](const Json&json,const string&key,std::pair<float,float>&range)
+  ->string
+  {
+      if(json[key].is_null()) return {};
+      const auto&items=json[key].array_items();
+      if(items.size()!=2||!items[0].is_number()||!items[1].is_number())
+      {
+          return "'"+key+"' must be array of two numbers";
+      }
+      range={items[0].number_value(),items[1].number_value()};
+      if(range.first>=range.second) return "min of '"+key+"' must be less max";
+      return {};
+  };
+  auto get_times=[](const Json&json,vector<float>&times)->string
+  {
+      if(json["times"].is_null()) return {};
+      if(!json["times"].is_array()||json["times"].array_items().empty())
+      {
+          return "'times' must be not empty array";
+      }
+      times.clear();
+      for(const auto&v:json["times"].array_items())
+      {
+          if(!v.is_number()) return "'times' must be array of numbers";
+          times.push_back(v.number_value());
+      }
+      return {};
+  };
+  // name, kind, functions and export, common for meshes and plots
+  auto get_common=[](const Json&json,const vector<std::pair<string,size_t>>&kinds,
+                     string&name,string&kind,vector<string>&functions,string&path)
+  ->string
+  {
+      string err;
+      const Json::shape shape={{"kind",Json::STRING},
+                               {"functions",Json::ARRAY}};
+      if(!json.has_shape(shape,err)) return err;
+      kind=json["kind"].string_value();
+      auto iter=std::find_if(kinds.begin(),kinds.end(),[&](auto&k){return k.first==kind;});
+      if(iter==kinds.end()) return "unknown kind '"+kind+"'";
+      functions.clear();
+      for(const auto&f:json["functions"].array_items())
+      {
+          if(!f.is_string()) return "'functions' must be an array of strings";
+          functions.push_back(f.string_value());
+      }
+      if(functions.size()!=iter->second)
+      {
+          return "'"+kind+"' requires "+std::to_string(iter->second)+" functions";
+      }
+      name=json["name"].is_string()? json["name"].string_value():kind;
+      path=json["export"].string_value();
+      return {};
+  };
+  auto get_mesh=[&](const Json&json,mesh_description_t&mesh)->string
+  {
+      auto err=get_common(json,{{"cartesian",1},{"spherical",1},{"polar",1},{"parametric",3}},
+                          mesh.name,mesh.kind,mesh.functions,mesh.export_path);
+      if(!err.empty()) return err;
+      if(mesh.kind=="spherical")
+      {
+          mesh.s_range={0,pi_v<float>};
+          mesh.t_range={-pi_v<float>,pi_v<float>};
+      }
+      else if(mesh.kind=="polar") mesh.t_range={-pi_v<float>,pi_v<float>};
+      if(err=get_range(json,"s_range",mesh.s_range);!err.empty()) return err;
+      if(err=get_range(json,"t_range",mesh.t_range);!err.empty()) return err;
+      const auto&resol=json["resolution"];
+      if(resol.is_number())
+      {
+          mesh.s_resolution=mesh.t_resolution=resol.int_value();
+      }
+      else if(resol.is_array()&&resol.array_items().size()==2&&
+              resol[0].is_number()&&resol[1].is_number())
+      {
+          mesh.s_resolution=resol[0].int_value();
+          mesh.t_resolution=resol[1].int_value();
+      }
+      else if(!resol.is_null()) return "'resolution' must be number or array of two numbers";
+      if((resol.is_number()&&resol.int_value()<=0)||
+         (resol.is_array()&&(resol[0].int_value()<=0||resol[1].int_value()<=0)))
+      {
+          return "'resolution' must be positive";
+      }
+      return get_times(json,mesh.times);
+  };
+  auto get_plot=[&](const Json&json,plot_description_t&plot)->string
+  {
+      auto err=get_common(json,{{"cartesian",1},{"polar",1},{"parametric",2}},
+                          plot.name,plot.kind,plot.functions,plot.export_path);
+      if(!err.empty()) return err;
+      if(plot.kind=="polar") plot.range={-pi_v<float>,pi_v<float>};
+      if(err=get_range(json,"range",plot.range);!err.empty()) return err;
+      if(!json["points"].is_null())
+      {
+          if(!json["points"].is_number()||json["points"].int_value()<2)
+          {
+              return "'points' must be number not less 2";
+          }
+          plot.points=json["points"].int_value();
+      }
+      return get_times(json,plot.times);
+  };
+  auto get_implicit=[&](const Json&json,implicit_description_t&surface)->string
+  {
+      string err;
+      const Json::shape shape={{"function",Json::STRING}};
+      if(!json.has_shape(shape,err)) return err;
+      surface.function=json["function"].string_value();
+      surface.name=json["name"].is_string()? json["name"].string_value():"implicit";
+      if(!json["iso"].is_null())
+      {
+          if(!json["iso"].is_number()) return "'iso' must be number";
+          surface.iso=json["iso"].number_value();
+      }
+      if(err=get_range(json,"x_range",surface.box[0]);!err.empty()) return err;
+      if(err=get_range(json,"y_range",surface.box[1]);!err.empty()) return err;
+      if(err=get_range(json,"z_range",surface.box[2]);!err.empty()) return err;
+      const auto&resol=json["resolution"];
+      if(resol.is_number())
+      {
+          surface.resolution.fill(resol.int_value());
+      }
+      else if(resol.is_array()&&resol.array_items().size()==3&&
+              resol[0].is_number()&&resol[1].is_number()&&resol[2].is_number())
+      {
+          for(int i=0;i<3;++i) surface.resolution[i]=resol[i].int_value();
+      }
+      else if(!resol.is_null()) return "'resolution' must be number or array of three numbers";
+      if((resol.is_number()&&resol.int_value()<=0)||
+         (resol.is_array()&&(resol[0].int_value()<=0||resol[1].int_value()<=0||resol[2].int_value()<=0)))
+      {
+          return "'resolution' must be positive";
+      }
+      return {};
+  };
+  string err;
+  scene=scene_description_t{};
+  auto res=Json::parse(str,err);
+  if(res.is_null()) return "Parse error:"+err;
+  if(!res.is_object()) return "json must be an object";
+  const auto&meshes=res["meshes"];
+  if(!meshes.is_null()&&!meshes.is_array()) return "'meshes' must be array";
+  const auto&plots=res["plots"];
+  if(!plots.is_null()&&!plots.is_array()) return "'plots' must be array";
+  const auto&implicit=res["implicit"];
+  if(!implicit.is_null()&&!implicit.is_array()) return "'implicit' must be array";
+  for(const auto&v:meshes.array_items())
+  {
+      scene.meshes.emplace_back();
+      err=get_mesh(v,scene.meshes.back());
+      if(!err.empty()) return err+", in 'meshes'";
+  }
+  for(const auto&v:plots.array_items())
+  {
+      scene.plots.emplace_back();
+      err=get_plot(v,scene.plots.back());
+      if(!err.empty()) return err+", in 'plots'";
+  }
+  for(const auto&v:implicit.array_items())
+  {
+      scene.implicit.emplace_back();
+      err=get_implicit(v,scene.implicit.back());
+      if(!err.empty()) return err+", in 'implicit'";
+  }
+  return {};
+}
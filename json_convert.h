@@ -1,10 +1,70 @@
 #ifndef _json_convert_
 #define _json_convert_
 
+#include <vector>
+#include <array>
+#include <utility>
+
 #include "../BaseLibraries/Expression/function_pool.h"
 
 std::string FromJson(const std::string&,CFunctionPool&);
 void ToJson(std::string&,const CFunctionPool&);
 
+// Description of meshes and 2D plots for batch evaluation, the bodies
+// of functions are parsed later with the pool, loaded by FromJson.
+// Mesh kinds and arguments of functions:
+//  "cartesian"  - z(x,y,time)
+//  "spherical"  - ro(t,phi,time)
+//  "polar"      - z(r,phi,time)
+//  "parametric" - x(s,t,time),y(s,t,time),z(s,t,time)
+// Plot kinds:
+//  "cartesian"  - y(x,time)
+//  "polar"      - r(phi,time)
+//  "parametric" - x(s,time),y(s,time)
+// Implicit surfaces: f(x,y,z)=iso inside of the box
+
+struct mesh_description_t
+{
+  std::string name;
+  std::string kind;
+  std::vector<std::string> functions;
+  std::pair<float,float> s_range={0,1};
+  std::pair<float,float> t_range={0,1};
+  std::size_t s_resolution=20;
+  std::size_t t_resolution=20;
+  std::vector<float> times={0};
+  std::string export_path;// .ply, .stl or .obj, empty if isn't exported
+};
+
+struct plot_description_t
+{
+  std::string name;
+  std::string kind;
+  std::vector<std::string> functions;
+  std::pair<float,float> range={-1,1};
+  int points=200;
+  std::vector<float> times={0};
+  std::string export_path;// csv, empty if isn't exported
+};
+
+struct implicit_description_t
+{
+  std::string name;
+  std::string function;
+  float iso=0;
+  std::array<std::pair<float,float>,3> box={{{-1,1},{-1,1},{-1,1}}};
+  std::array<std::size_t,3> resolution={64,64,64};
+};
+
+struct scene_description_t
+{
+  std::vector<mesh_description_t> meshes;
+  std::vector<plot_description_t> plots;
+  std::vector<implicit_description_t> implicit;
+};
+
+// Parse 'meshes', 'plots' and 'implicit' arrays, all are optional
+std::string SceneFromJson(const std::string&,scene_description_t&);
+
 
 #endif // _json_convert_
@@ -15,6 +15,7 @@
 #include "view_widget.h"
 #include "main_window.h"
 #include "json_convert.h"
+#include "profiler.h"
 
 
 const float fpi=std::numbers::pi_v<float>;
@@ -29,21 +30,18 @@ static QTime glTime;
 static CFunctionPool glFunctionPool;
 static CPlot2D glPlot2D;
 extern CFunctionalMesh glMesh;
+extern CImplicitMesh glImplicitMesh;
 
 static float Now()
 {
   return glTime.elapsed()/1000.0f;
 }
 
-static void SetCameraAndLight(CScene&scene)
+static void SetCameraAndLight(CScene&scene,const Eigen::Vector3f&min_corner,
+                              const Eigen::Vector3f&max_corner)
 {
   using point_t=Eigen::Vector3f;
   if(scene.Empty()) return;
-  assert(glMesh.BoundedBox());
-  point_t min_corner=glMesh.BoundedBox()->first;
-  point_t max_corner=glMesh.BoundedBox()->second;
-
-
   point_t center=(min_corner+max_corner)/2.0f;
   point_t delta=max_corner-min_corner;
   float _l=0.5*(delta[0]+std::max(delta[1],delta[2])/ std::tan(scene.Camera().Aspect()/2.0));
@@ -53,6 +51,12 @@ static void SetCameraAndLight(CScene&scene)
   scene.LightSource().SetPosition(center+point_t::UnitZ()*delta[2]);
 }
 
+static void SetCameraAndLight(CScene&scene)
+{
+  assert(glMesh.BoundedBox());
+  SetCameraAndLight(scene,glMesh.BoundedBox()->first,glMesh.BoundedBox()->second);
+}
+
 
 std::vector<int>
 ParseInts(const CBaseDialog&dg,const std::vector<int>&fields,
@@ -436,6 +440,10 @@ QMenu* CMainWindow::m_CreateDrawMenu()
   connect(act,SIGNAL(triggered()),SLOT(m_3D_parametric_dialog()));
   pmnuPlot3D->addAction(act);
 
+  act=new QAction("Implicit",nullptr);
+  connect(act,SIGNAL(triggered()),SLOT(m_3D_implicit_dialog()));
+  pmnuPlot3D->addAction(act);
+
   pmnuDraw->addMenu(pmnuPlot2D);
   pmnuDraw->addMenu(pmnuPlot3D);
   return pmnuDraw;
@@ -492,6 +500,24 @@ QMenu* CMainWindow::m_CreateSettingsMenu()
   return pmnuSett;
 }
 
+QMenu* CMainWindow::m_CreateProfilerMenu()
+{
+  QMenu*pmnuProf =new QMenu("Profiler");
+
+  QAction* act = new QAction("Enabled",nullptr);
+  act->setCheckable(true);
+  connect(act,SIGNAL(toggled(bool)),
+          this,SLOT(m_ProfilerToggled(bool)));
+  pmnuProf->addAction(act);
+
+  act = new QAction("Export Chrome trace",nullptr);
+  connect(act,SIGNAL(triggered()),
+          this,SLOT(m_ExportTrace()));
+  pmnuProf->addAction(act);
+
+  return pmnuProf;
+}
+
 void CMainWindow::contextMenuEvent(QContextMenuEvent* pe)
 {
   CViewWidget*view=static_cast<CViewWidget*>(centralWidget());
@@ -519,6 +545,7 @@ void CMainWindow::CreateMenu()
    menuBar()->addMenu(m_CreateFunctionsMenu());
    menuBar()->addMenu(m_CreateConstantsMenu());
    menuBar()->addMenu(m_CreateSettingsMenu());
+   menuBar()->addMenu(m_CreateProfilerMenu());
    QAction* calc = menuBar()->addAction("Calculate");
    connect(calc,SIGNAL(triggered()),SLOT(m_CalculateDialog()));
    m_context_menu=m_CreateContextMenu();
@@ -614,6 +641,29 @@ void CMainWindow::m_SaveToJson()
   file<<json_str;
 }
 
+// Profiler
+
+void CMainWindow::m_ProfilerToggled(bool enabled)
+{
+  if(enabled) CProfiler::Instance().Clear();
+  CProfiler::SetEnabled(enabled);
+  if(!enabled) m_statusbar->setText("");
+}
+
+void CMainWindow::m_ExportTrace()
+{
+  QString str=QFileDialog::getSaveFileName(0,"Export Chrome trace","","*.json");
+  if(str.isEmpty()) return;
+  if(!str.endsWith(".json")) str+=".json";
+  std::ofstream file(str.toStdString());
+  if(!file)
+  {
+      QMessageBox::information(nullptr,"File error","Can't create "+str);
+      return;
+  }
+  file<<CProfiler::Instance().ChromeTrace();
+}
+
 //3D plots
 void CMainWindow::m_3D_cartesian_dialog()
 {
@@ -642,14 +692,22 @@ void CMainWindow::m_3D_cartesian_edit()
 
       if(sutil::find_identifier(dg.Text(0,1),"time")==dg.Text(0,1).end())
       {
-          auto ftr=[f](float x,float y){return f(x,y,0);};
+          // the mesh evaluates its own copy of the function in the worker thread
+          auto ftr=[f=glFunctionPool.CloneFunction(f)](float x,float y){return f(x,y,0);};
           glMesh.SetMeshFunctor(plot::cartesian(ftr));
       }
       else
       {
-          glMesh.SetMeshFunctor(plot::cartesian(f),CFunctionalMesh::dynamic_id);
+          glMesh.SetMeshFunctor(plot::cartesian(glFunctionPool.CloneFunction(f)),CFunctionalMesh::dynamic_id);
+          // evaluated in the vertex shader, if the function is translated into GLSL
+          if(auto glsl=glFunctionPool.GlslSource(f,"surface_function"))
+          {
+              glMesh.SetGpuSurface(*glsl+plot::glsl_cartesian("surface_function"));
+          }
       }
       glMesh.SetRange({floats[1],floats[2]},{floats[3],floats[4]});
+      glMesh.SetThreadSafeFunctors(true);
+      glImplicitMesh.Clear();
       assert(!ViewWidget()->Scene().Empty());
       glMesh.UpdateData(Now());
       SetCameraAndLight(ViewWidget()->Scene());
@@ -683,14 +741,21 @@ void CMainWindow::m_3D_spherical_edit()
 
       if(sutil::find_identifier(dg.Text(0,1),"time")==dg.Text(0,1).end())
       {
-          auto ftr=[f](float theta,float phi){return f(theta,phi,0);};
+          auto ftr=[f=glFunctionPool.CloneFunction(f)](float theta,float phi){return f(theta,phi,0);};
           glMesh.SetMeshFunctor(plot::spherical(ftr));
       }
       else
       {
-          glMesh.SetMeshFunctor(plot::spherical(f),CFunctionalMesh::dynamic_id);
+          glMesh.SetMeshFunctor(plot::spherical(glFunctionPool.CloneFunction(f)),CFunctionalMesh::dynamic_id);
+          // evaluated in the vertex shader, if the function is translated into GLSL
+          if(auto glsl=glFunctionPool.GlslSource(f,"surface_function"))
+          {
+              glMesh.SetGpuSurface(*glsl+plot::glsl_spherical("surface_function"));
+          }
       }
       glMesh.SetRange({0,fpi},{-fpi,fpi});
+      glMesh.SetThreadSafeFunctors(true);
+      glImplicitMesh.Clear();
       assert(!ViewWidget()->Scene().Empty());
       glMesh.UpdateData(Now());
       SetCameraAndLight(ViewWidget()->Scene());
@@ -729,14 +794,21 @@ void CMainWindow::m_3D_polar_edit()
 
       if(sutil::find_identifier(dg.Text(0,1),"time")==dg.Text(0,1).end())
       {
-          auto ftr=[f](float r,float phi){return f(r,phi,0);};
+          auto ftr=[f=glFunctionPool.CloneFunction(f)](float r,float phi){return f(r,phi,0);};
           glMesh.SetMeshFunctor(plot::cylindrical(ftr));
       }
       else
       {
-          glMesh.SetMeshFunctor(plot::cylindrical(f),CFunctionalMesh::dynamic_id);
+          glMesh.SetMeshFunctor(plot::cylindrical(glFunctionPool.CloneFunction(f)),CFunctionalMesh::dynamic_id);
+          // evaluated in the vertex shader, if the function is translated into GLSL
+          if(auto glsl=glFunctionPool.GlslSource(f,"surface_function"))
+          {
+              glMesh.SetGpuSurface(*glsl+plot::glsl_cylindrical("surface_function"));
+          }
       }
       glMesh.SetRange({0,floats[1]},{-fpi,fpi});
+      glMesh.SetThreadSafeFunctors(true);
+      glImplicitMesh.Clear();
       assert(!ViewWidget()->Scene().Empty());
       glMesh.UpdateData(Now());
       SetCameraAndLight(ViewWidget()->Scene());
@@ -792,21 +864,33 @@ void CMainWindow::m_3D_parametric_edit()
          sutil::find_identifier(dg.Text(1,1),"time")!=dg.Text(1,1).end()||
          sutil::find_identifier(dg.Text(2,1),"time")!=dg.Text(2,1).end())
       {
-          auto ftr=[_x,_y,_z](float s,float t,float time)
+          auto ftr=[_x=glFunctionPool.CloneFunction(_x),
+                    _y=glFunctionPool.CloneFunction(_y),
+                    _z=glFunctionPool.CloneFunction(_z)](float s,float t,float time)
           {
               return Eigen::Vector3f(_x(s,t,time),_y(s,t,time),_z(s,t,time));
           };
           glMesh.SetMeshFunctor(ftr);
+          auto glsl=glFunctionPool.GlslSource({{_x,"x_function"},{_y,"y_function"},{_z,"z_function"}});
+          if(glsl)
+          {
+              glMesh.SetGpuSurface(*glsl+"vec3 surface(float s,float t,float time)\n{\n"
+                                   "    return vec3(x_function(s,t,time),y_function(s,t,time),z_function(s,t,time));\n}\n");
+          }
       }
       else
       {
-          auto ftr=[_x,_y,_z](float s,float t)
+          auto ftr=[_x=glFunctionPool.CloneFunction(_x),
+                    _y=glFunctionPool.CloneFunction(_y),
+                    _z=glFunctionPool.CloneFunction(_z)](float s,float t)
           {
               return Eigen::Vector3f(_x(s,t,0),_y(s,t,0),_z(s,t,0));
           };
           glMesh.SetMeshFunctor(ftr);
       }
       glMesh.SetRange({floats[3],floats[4]},{floats[5],floats[6]});
+      glMesh.SetThreadSafeFunctors(true);
+      glImplicitMesh.Clear();
       assert(!ViewWidget()->Scene().Empty());
       glMesh.UpdateData(Now());
       SetCameraAndLight(ViewWidget()->Scene());
@@ -819,6 +903,59 @@ void CMainWindow::m_3D_parametric_edit()
   if(dg->exec()==QDialog::Accepted) m_SwitchTo3D();
 }
 
+void CMainWindow::m_3D_implicit_dialog()
+{
+  m_previous_dg.SetEmpty(9);
+  m_3D_implicit_edit();
+}
+
+void CMainWindow::m_3D_implicit_edit()
+{
+  std::vector<QString> v_str
+  ({"f(x,y,z):","iso value:",
+    "min x:","max x:","min y:","max y:","min z:","max z:",
+    "resolution:"});
+  auto dg=LinesEditDg(v_str);
+  assert(m_previous_dg.m_edit.size()==v_str.size());
+  for(int i=0;i<v_str.size();++i)dg->SetText(i,1,m_previous_dg.m_edit[i]);
+  auto preprocess=[this,&v_str](const CBaseDialog&dg)
+  ->std::string
+  {
+      std::string mess;
+      expr::parse_error_t error;
+      auto floats=ParseFloats(dg,{1,2,3,4,5,6,7},mess,glFunctionPool);
+      if(!mess.empty()) return mess;
+      if(floats[2]>=floats[3])return "min x must be less max x";
+      if(floats[4]>=floats[5])return "min y must be less max y";
+      if(floats[6]>=floats[7])return "min z must be less max z";
+      auto ints=ParseInts(dg,{8},mess);
+      if(!mess.empty()) return mess;
+      if(ints[8]<2||ints[8]>512) return "resolution must be in [2,512]";
+      auto f=glFunctionPool.CreateFunction({"x","y","z"},dg.Text(0,1),error);
+      if(error) return  "Error:"+error.detail();
+
+      // each parallel tile evaluates its own copy of the function
+      glImplicitMesh.SetFunctorMaker([f=glFunctionPool.CloneFunction(f)]
+      {
+          return CImplicitMesh::functor_t(glFunctionPool.CloneFunction(f));
+      });
+      const Eigen::Vector3f min_corner(floats[2],floats[4],floats[6]);
+      const Eigen::Vector3f max_corner(floats[3],floats[5],floats[7]);
+      glImplicitMesh.SetIsoValue(floats[1])
+                    .SetBox(min_corner,max_corner)
+                    .SetResolution(ints[8]);
+      glMesh.Clear();
+      assert(!ViewWidget()->Scene().Empty());
+      SetCameraAndLight(ViewWidget()->Scene(),min_corner,max_corner);
+
+      for(int i=0;i<v_str.size();++i) m_previous_dg.m_edit[i]=dg.Text(i,1);
+      m_previous_dg.m_call=&CMainWindow::m_3D_implicit_edit;
+      return {};
+  };
+  dg->SetPreprocessor(preprocess);
+  if(dg->exec()==QDialog::Accepted) m_SwitchTo3D();
+}
+
 //2D plots
 
 void CMainWindow::m_2D_cartesian_dialog()
@@ -1066,7 +1203,8 @@ void CMainWindow::m_3D_settings()
   std::vector<QString> v_str={"Number of grid lines:",
                               "Number of levels lines:",
                               "Camera speed:",
-                              "Camera rotation speed:"};
+                              "Camera rotation speed:",
+                              "Update budget, ms (0 - unlimited):"};
   auto dg_ptr=LinesEditDg(v_str);
   auto vw=static_cast<CViewWidget*>(centralWidget());
   auto grid=glMesh.GetGrid();
@@ -1075,6 +1213,7 @@ void CMainWindow::m_3D_settings()
   dg_ptr->SetText(1,1,std::to_string(glMesh.GetNumberOfLevel(0)));
   dg_ptr->SetText(2,1,std::to_string(ViewWidget()->Viewer().MoveVelocity()));
   dg_ptr->SetText(3,1,std::to_string(ViewWidget()->Viewer().TurnVelocity()));
+  dg_ptr->SetText(4,1,std::to_string(Scene().UpdateBudget()));
   auto preprocess=[this,&vw](const CBaseDialog&dg)
   ->std::string
   {
@@ -1089,7 +1228,8 @@ void CMainWindow::m_3D_settings()
       {
           return "Acceptable range for number of levels lines:{0,40}";
       }
-      auto floats=ParseFloats(dg,{2,3},str,glFunctionPool);
+      auto floats=ParseFloats(dg,{2,3,4},str,glFunctionPool);
+      if(!str.empty()) return str;
       if(floats[2]<0)
       {
           return "Camera speed must be greater 0";
@@ -1098,8 +1238,13 @@ void CMainWindow::m_3D_settings()
       {
           return "Camera rotation speed must be greater 0";
       }
+      if(floats[4]<0)
+      {
+          return "Update budget can't be negative";
+      }
       ViewWidget()->Viewer().SetMoveVelocity(floats[2]);
       ViewWidget()->Viewer().SetTurnVelocity(floats[3]);
+      Scene().SetUpdateBudget(floats[4]);
       glMesh.SetResolution(ints[0],ints[0]);
       glMesh.SetNumberOfLevelsX(ints[1])
             .SetNumberOfLevelsY(ints[1])
@@ -106,15 +106,20 @@ class CMainWindow:public QMainWindow
   //Save/Load
   void m_LoadFromJson();
   void m_SaveToJson();
+  //Profiler
+  void m_ProfilerToggled(bool);
+  void m_ExportTrace();
   // 3D plots
   void m_3D_cartesian_dialog();
   void m_3D_spherical_dialog();
   void m_3D_polar_dialog();
   void m_3D_parametric_dialog();
+  void m_3D_implicit_dialog();
   void m_3D_cartesian_edit();
   void m_3D_spherical_edit();
   void m_3D_polar_edit();
   void m_3D_parametric_edit();
+  void m_3D_implicit_edit();
   // toolbars
   void m_3D_toolbar_slot(int,bool);
   void m_Clear();
@@ -145,6 +150,7 @@ class CMainWindow:public QMainWindow
   QMenu* m_CreateConstantsMenu();
   QMenu* m_CreateFunctionsMenu();
   QMenu* m_CreateSettingsMenu();
+  QMenu* m_CreateProfilerMenu();
   QMenu* m_CreateContextMenu();
 
   void m_SwitchTo2D();
@@ -0,0 +1,321 @@
+#include <assert.h>
+#include <algorithm>
+#include <fstream>
+#include <chrono>
+#include <charconv>
+#include <bit>
+#include <cstring>
+#include <cmath>
+
+#include <Eigen/Geometry>
+
+#include "mesh_export.h"
+
+// binary formats are written in the native byte order
+static_assert(std::endian::native==std::endian::little);
+
+namespace{
+
+template<class T>
+void put(std::vector<char>&buffer,T value)
+{
+    const char*ptr=reinterpret_cast<const char*>(&value);
+    buffer.insert(buffer.end(),ptr,ptr+sizeof(T));
+}
+
+void put(std::vector<char>&buffer,const Eigen::Vector3f&p)
+{
+    put(buffer,p[0]);put(buffer,p[1]);put(buffer,p[2]);
+}
+
+void put(std::vector<char>&buffer,const char*str)
+{
+    buffer.insert(buffer.end(),str,str+std::strlen(str));
+}
+
+// text form of number for OBJ
+template<class T>
+void put_text(std::vector<char>&buffer,T value)
+{
+    char str[32];
+    auto result=std::to_chars(str,str+sizeof(str),value);
+    assert(result.ec==std::errc());
+    buffer.insert(buffer.end(),str,result.ptr);
+}
+
+}
+
+///////////////////////////////////////////////////////////////
+//                    CMeshExporter
+///////////////////////////////////////////////////////////////
+
+CMeshExporter& CMeshExporter::SetFormat(format_t format)
+{
+    m_format=format;
+    return *this;
+}
+
+CMeshExporter& CMeshExporter::SetNormals(bool normals)
+{
+    m_normals=normals;
+    return *this;
+}
+
+CMeshExporter& CMeshExporter::SetChunkBytes(size_t bytes)
+{
+    m_chunk_bytes=bytes;
+    return *this;
+}
+
+std::optional<CMeshExporter::format_t> CMeshExporter::FormatOfPath(const std::string&path)
+{
+    auto dot=path.rfind('.');
+    if(dot==std::string::npos) return std::nullopt;
+    std::string ext=path.substr(dot+1);
+    std::transform(ext.begin(),ext.end(),ext.begin(),[](unsigned char c){return std::tolower(c);});
+    if(ext=="ply") return ply_id;
+    if(ext=="stl") return stl_id;
+    if(ext=="obj") return obj_id;
+    return std::nullopt;
+}
+
+// rows per chunk: points and normals with the output of the row
+// (two triangles per cell at most 50 bytes in STL, 26 in PLY)
+
+std::size_t CMeshExporter::m_ChunkRows(const CFunctionalMesh&mesh)const
+{
+    const auto grid=mesh.GetGrid();
+    const size_t row_bytes=(grid.t_resolution+1)*(2*sizeof(CFunctionalMesh::point_t)+2*50);
+    return std::clamp<size_t>(m_chunk_bytes/row_bytes,1,grid.s_resolution+1);
+}
+
+// Evaluate rows [first,last) with neighbouring ones, which are required
+// for the normals and the triangles, returns the index of first evaluated row
+
+std::size_t CMeshExporter::m_EvaluateChunk(const CFunctionalMesh&mesh,float time,size_t first,size_t last)
+{
+    const auto   grid=mesh.GetGrid();
+    const size_t rows=grid.s_resolution+1;
+    const size_t begin=first>0? first-1:0;
+    const size_t end=std::min(last+1,rows);
+    mesh.Evaluate(time,begin,end,m_points);
+    if(m_normals&&m_format!=stl_id)
+    {
+        CFunctionalMesh::mask_t mask;
+        const bool has_invalid=CFunctionalMesh::m_FillMask(m_points,mask);
+        CFunctionalMesh::m_FillNormals(m_points,has_invalid? &mask:nullptr,grid,m_normals_chunk);
+    }
+    m_UpdatePeak();
+    return begin;
+}
+
+void CMeshExporter::m_UpdatePeak()
+{
+    const size_t bytes=(m_points.size()+m_normals_chunk.size())*sizeof(CFunctionalMesh::point_t)+
+                       m_buffer.capacity();
+    m_stat.peak_bytes=std::max(m_stat.peak_bytes,bytes);
+}
+
+void CMeshExporter::m_Flush(std::ostream&out)
+{
+    m_UpdatePeak();
+    out.write(m_buffer.data(),m_buffer.size());
+    m_stat.bytes+=m_buffer.size();
+    m_buffer.clear();
+}
+
+void CMeshExporter::m_WritePly(const CFunctionalMesh&mesh,float time,std::ostream&out)
+{
+    const auto   grid=mesh.GetGrid();
+    const size_t rows=grid.s_resolution+1,cols=grid.t_resolution+1;
+    const size_t chunk=m_ChunkRows(mesh);
+    m_stat.vertices=rows*cols;
+    m_stat.triangles=2*grid.s_resolution*grid.t_resolution;
+
+    put(m_buffer,"ply\nformat binary_little_endian 1.0\ncomment GraphViewer\n");
+    put(m_buffer,("element vertex "+std::to_string(m_stat.vertices)+"\n").c_str());
+    put(m_buffer,"property float x\nproperty float y\nproperty float z\n");
+    if(m_normals) put(m_buffer,"property float nx\nproperty float ny\nproperty float nz\n");
+    put(m_buffer,("element face "+std::to_string(m_stat.triangles)+"\n").c_str());
+    put(m_buffer,"property list uchar int vertex_indices\nend_header\n");
+
+    for(size_t first=0;first<rows;first+=chunk)
+    {
+        const size_t last=std::min(first+chunk,rows);
+        const size_t offset=m_EvaluateChunk(mesh,time,first,last);
+        for(size_t i=first;i<last;++i)
+        {
+            for(size_t j=0;j<cols;++j)
+            {
+                put(m_buffer,m_points(i-offset,j));
+                if(m_normals) put(m_buffer,m_normals_chunk(i-offset,j));
+            }
+        }
+        m_Flush(out);
+    }
+    // faces don't require evaluation
+    auto face=[this](size_t _1,size_t _2,size_t _3)
+    {
+        put(m_buffer,uint8_t(3));
+        put(m_buffer,int32_t(_1));put(m_buffer,int32_t(_2));put(m_buffer,int32_t(_3));
+    };
+    for(size_t first=0;first+1<rows;first+=chunk)
+    {
+        const size_t last=std::min(first+chunk,rows-1);
+        for(size_t i=first;i<last;++i)
+        {
+            for(size_t j=0;j+1<cols;++j)
+            {
+                const size_t index=i*cols+j;
+                face(index,index+cols,index+cols+1);
+                face(index+cols+1,index+1,index);
+            }
+        }
+        m_Flush(out);
+    }
+}
+
+void CMeshExporter::m_WriteStl(const CFunctionalMesh&mesh,float time,std::ostream&out)
+{
+    using point_t=CFunctionalMesh::point_t;
+    const auto   grid=mesh.GetGrid();
+    const size_t rows=grid.s_resolution+1,cols=grid.t_resolution+1;
+    const size_t chunk=m_ChunkRows(mesh);
+    m_stat.vertices=rows*cols;
+
+    char header[80]={};
+    std::strncpy(header,"GraphViewer binary STL",sizeof(header));
+    m_buffer.insert(m_buffer.end(),header,header+sizeof(header));
+    put(m_buffer,uint32_t(0));// the number of triangles is written at the end
+
+    // triangles with non finite vertices are skipped
+    auto facet=[this](const point_t&_1,const point_t&_2,const point_t&_3)
+    {
+        if(!(_1.allFinite()&&_2.allFinite()&&_3.allFinite())) return;
+        point_t normal=(_2-_1).cross(_3-_1);
+        if(normal.squaredNorm()>0) normal.normalize();
+        put(m_buffer,normal);
+        put(m_buffer,_1);put(m_buffer,_2);put(m_buffer,_3);
+        put(m_buffer,uint16_t(0));
+        ++m_stat.triangles;
+    };
+    for(size_t first=0;first+1<rows;first+=chunk)
+    {
+        const size_t last=std::min(first+chunk,rows-1);
+        const size_t offset=m_EvaluateChunk(mesh,time,first,last);
+        for(size_t i=first;i<last;++i)
+        {
+            for(size_t j=0;j+1<cols;++j)
+            {
+                const point_t&p00=m_points(i-offset,j);
+                const point_t&p10=m_points(i+1-offset,j);
+                const point_t&p11=m_points(i+1-offset,j+1);
+                const point_t&p01=m_points(i-offset,j+1);
+                facet(p00,p10,p11);
+                facet(p11,p01,p00);
+            }
+        }
+        m_Flush(out);
+    }
+    out.seekp(sizeof(header));
+    const uint32_t triangles=m_stat.triangles;
+    out.write(reinterpret_cast<const char*>(&triangles),sizeof(triangles));
+}
+
+void CMeshExporter::m_WriteObj(const CFunctionalMesh&mesh,float time,std::ostream&out)
+{
+    const auto   grid=mesh.GetGrid();
+    const size_t rows=grid.s_resolution+1,cols=grid.t_resolution+1;
+    const size_t chunk=m_ChunkRows(mesh);
+    m_stat.vertices=rows*cols;
+    m_stat.triangles=2*grid.s_resolution*grid.t_resolution;
+
+    auto vector=[this](const char*prefix,const CFunctionalMesh::point_t&p)
+    {
+        put(m_buffer,prefix);
+        for(int k=0;k<3;++k)
+        {
+            m_buffer.push_back(' ');
+            put_text(m_buffer,p[k]);
+        }
+        m_buffer.push_back('\n');
+    };
+    put(m_buffer,"# GraphViewer\n");
+    for(size_t first=0;first<rows;first+=chunk)
+    {
+        const size_t last=std::min(first+chunk,rows);
+        const size_t offset=m_EvaluateChunk(mesh,time,first,last);
+        // v and vn of chunk are in the same order, so their indices coincide
+        for(size_t i=first;i<last;++i)
+        {
+            for(size_t j=0;j<cols;++j) vector("v",m_points(i-offset,j));
+        }
+        if(m_normals)
+        {
+            for(size_t i=first;i<last;++i)
+            {
+                for(size_t j=0;j<cols;++j) vector("vn",m_normals_chunk(i-offset,j));
+            }
+        }
+        m_Flush(out);
+    }
+    auto face=[this](size_t _1,size_t _2,size_t _3)
+    {
+        put(m_buffer,"f");
+        for(size_t index:{_1+1,_2+1,_3+1})
+        {
+            m_buffer.push_back(' ');
+            put_text(m_buffer,index);
+            if(m_normals)
+            {
+                put(m_buffer,"//");
+                put_text(m_buffer,index);
+            }
+        }
+        m_buffer.push_back('\n');
+    };
+    for(size_t first=0;first+1<rows;first+=chunk)
+    {
+        const size_t last=std::min(first+chunk,rows-1);
+        for(size_t i=first;i<last;++i)
+        {
+            for(size_t j=0;j+1<cols;++j)
+            {
+                const size_t index=i*cols+j;
+                face(index,index+cols,index+cols+1);
+                face(index+cols+1,index+1,index);
+            }
+        }
+        m_Flush(out);
+    }
+}
+
+std::string CMeshExporter::Export(const CFunctionalMesh&mesh,const std::string&path,float time)
+{
+    m_stat=stat_t{};
+    if(mesh.Empty()) return "Mesh is empty";
+    if(m_format==ply_id&&(mesh.GetGrid().s_resolution+1)*(mesh.GetGrid().t_resolution+1)>
+                          size_t(std::numeric_limits<int32_t>::max()))
+    {
+        return "Too many vertices for PLY";
+    }
+    std::ofstream out(path,std::ios::binary);
+    if(!out) return "Can't open file:"+path;
+
+    auto start=std::chrono::steady_clock::now();
+    switch(m_format)
+    {
+        case ply_id:m_WritePly(mesh,time,out);break;
+        case stl_id:m_WriteStl(mesh,time,out);break;
+        case obj_id:m_WriteObj(mesh,time,out);break;
+    }
+    out.flush();
+    m_stat.seconds=std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count();
+
+    // release chunk buffers
+    m_points.resize(0,0);
+    m_normals_chunk.resize(0,0);
+    m_buffer=std::vector<char>();
+    if(!out) return "Write error:"+path;
+    return {};
+}
@@ -0,0 +1,64 @@
+#ifndef  _mesh_export_
+#define  _mesh_export_
+
+#include <string>
+#include <vector>
+#include <optional>
+
+#include "functional_mesh.h"
+
+// CMeshExporter - writes the surface of CFunctionalMesh into binary PLY,
+// binary STL or OBJ file. The mesh functor is evaluated in chunks of grid
+// rows, which are written and dropped, so the memory is bounded by the
+// chunk size (at least one row) independently of the resolution.
+// The data, stored in the mesh, isn't used and isn't changed.
+
+class CMeshExporter
+{
+    public:
+    using size_t=std::size_t;
+    using matrix_t=CFunctionalMesh::matrix_t;
+    enum format_t{ply_id,stl_id,obj_id};
+    static const size_t default_chunk_bytes=16<<20;
+    struct stat_t
+    {
+        size_t vertices=0;
+        size_t triangles=0;
+        size_t bytes=0;
+        size_t peak_bytes=0;// memory of chunk buffers
+        double seconds=0;
+        double MegabytesPerSecond()const{return seconds>0? bytes/seconds/(1<<20):0;}
+        double VerticesPerSecond()const{return seconds>0? vertices/seconds:0;}
+    };
+    private:
+    format_t m_format=ply_id;
+    bool     m_normals=true;
+    size_t   m_chunk_bytes=default_chunk_bytes;
+    stat_t   m_stat;
+
+    matrix_t           m_points;
+    matrix_t           m_normals_chunk;
+    std::vector<char>  m_buffer;
+
+    size_t m_ChunkRows(const CFunctionalMesh&)const;
+    size_t m_EvaluateChunk(const CFunctionalMesh&,float,size_t,size_t);
+    void   m_Flush(std::ostream&);
+    void   m_UpdatePeak();
+    void   m_WritePly(const CFunctionalMesh&,float,std::ostream&);
+    void   m_WriteStl(const CFunctionalMesh&,float,std::ostream&);
+    void   m_WriteObj(const CFunctionalMesh&,float,std::ostream&);
+    public:
+    CMeshExporter& SetFormat(format_t);
+    // Vertex normals for PLY and OBJ, STL has facet normals always
+    CMeshExporter& SetNormals(bool);
+    // Approximate memory for one chunk of rows
+    CMeshExporter& SetChunkBytes(size_t);
+    // Format by extension of the path: .ply, .stl or .obj
+    static std::optional<format_t> FormatOfPath(const std::string&);
+
+    // Returns error message, empty if succeeded
+    std::string Export(const CFunctionalMesh&,const std::string&path,float time=0.0f);
+    const stat_t& Statistics()const{return m_stat;}
+};
+
+#endif
@@ -0,0 +1,130 @@
+#ifndef  _parallel_for_
+#define  _parallel_for_
+
+#include <assert.h>
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace par{
+
+inline std::size_t hardware_threads()
+{
+    std::size_t n=std::thread::hardware_concurrency();
+    return n? n:1;
+}
+
+// number of tiles, on which tiles_for split [0,size)
+// each tile contains at least 'grain' elements (except possibly a single one)
+inline std::size_t tiles(std::size_t size,std::size_t grain)
+{
+    if(size==0) return 0;
+    grain=std::max<std::size_t>(grain,1);
+    return std::clamp<std::size_t>(size/grain,1,hardware_threads());
+}
+
+// Persistent threads of tiles_for, started with the first parallel call.
+// The tiles of a call are counted down under the mutex, so the caller
+// returns only after the threads have left its counter. The waiting caller
+// runs the queued tiles too: nested calls and calls from several threads
+// (e.g. the async update of the meshes) don't deadlock.
+class pool_t
+{
+    struct task_t
+    {
+        std::function<void()> m_run;
+        std::size_t*          m_left;
+    };
+    std::mutex              m_mutex;
+    std::condition_variable m_queued;
+    std::condition_variable m_done;
+    std::deque<task_t>      m_tasks;
+    bool                    m_stop=false;
+    std::vector<std::thread> m_threads;
+
+    // runs the front task, the lock is released for the time of the run
+    void m_RunFront(std::unique_lock<std::mutex>&lock)
+    {
+        task_t task=std::move(m_tasks.front());
+        m_tasks.pop_front();
+        lock.unlock();
+        task.m_run();
+        lock.lock();
+        if(--*task.m_left==0) m_done.notify_all();
+    }
+    void m_Work()
+    {
+        std::unique_lock lock(m_mutex);
+        while(true)
+        {
+            m_queued.wait(lock,[this]{return m_stop||!m_tasks.empty();});
+            if(m_stop) return;
+            m_RunFront(lock);
+        }
+    }
+    pool_t()
+    {
+        for(std::size_t i=1;i<hardware_threads();++i) m_threads.emplace_back(&pool_t::m_Work,this);
+    }
+    public:
+    static pool_t& instance()
+    {
+        static pool_t pool;
+        return pool;
+    }
+    // 'run' for each index of [1,num), 'first' in the calling thread
+    template<class run_t,class first_t>
+    void run(std::size_t num,run_t run,first_t first)
+    {
+        std::size_t left=num-1;
+        {
+            std::lock_guard lock(m_mutex);
+            for(std::size_t i=1;i<num;++i) m_tasks.push_back({[&run,i]{run(i);},&left});
+        }
+        m_queued.notify_all();
+        first();
+        std::unique_lock lock(m_mutex);
+        while(left)
+        {
+            if(!m_tasks.empty()) m_RunFront(lock);
+            else m_done.wait(lock);
+        }
+    }
+    ~pool_t()
+    {
+        {
+            std::lock_guard lock(m_mutex);
+            m_stop=true;
+        }
+        m_queued.notify_all();
+        for(auto&thread:m_threads) thread.join();
+    }
+};
+
+// tiles_for - split [0,size) into tiles(size,grain) contiguous ranges
+// and call funct(tile,begin,end) for each of them in parallel.
+// Tile 0 is processed in the calling thread, splitting is deterministic,
+// so per-tile results can be merged in a stable order.
+template<class func_t>
+void tiles_for(std::size_t size,std::size_t grain,func_t funct)
+{
+    const std::size_t num=tiles(size,grain);
+    if(num==0) return;
+    auto bound=[size,num](std::size_t tile){return size*tile/num;};
+    if(num==1)
+    {
+        funct(std::size_t(0),bound(0),bound(1));
+        return;
+    }
+    pool_t::instance().run(num,[&](std::size_t tile){funct(tile,bound(tile),bound(tile+1));},
+                               [&]{funct(std::size_t(0),bound(0),bound(1));});
+}
+
+}// par
+
+#endif
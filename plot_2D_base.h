@@ -162,6 +162,10 @@ class CPlot2D
         //void SetColor(Eigen::Vector3f&v){m_color=v;}
         void SetWidth(int i){m_width=i;}
         void SetNumPoints(int i){m_num_points=i;m_Fill(0);}
+        // evaluates the points in the time
+        void Fill(float t){m_Fill(t);}
+        const std::vector<point_t>&Points()const{return m_points;}
+        const box_t&Box()const{return m_box;}
         friend class CPlot2D;
     };
     int m_num_hor_grid;
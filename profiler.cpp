@@ -0,0 +1,120 @@
+#include <sstream>
+#include <iomanip>
+
+#include "../../CppProjects/json11/json11.hpp"
+#include "profiler.h"
+
+// small numbers of the threads for the trace, in the order of their first event
+
+static int ThreadNumber()
+{
+    static std::atomic<int> next=0;
+    thread_local const int number=next++;
+    return number;
+}
+
+///////////////////////////////////////////////////////////////
+//                    CProfiler
+///////////////////////////////////////////////////////////////
+
+CProfiler& CProfiler::Instance()
+{
+    static CProfiler profiler;
+    return profiler;
+}
+
+void CProfiler::SetEnabled(bool enabled)
+{
+    s_enabled.store(enabled,std::memory_order_relaxed);
+}
+
+double CProfiler::Microseconds(clock::time_point time)const
+{
+    return std::chrono::duration<double,std::micro>(time-m_origin).count();
+}
+
+void CProfiler::m_Push(const event_t&event)
+{
+    if(m_events.size()>=max_events) m_events.erase(m_events.begin(),m_events.begin()+max_events/2);
+    m_events.push_back(event);
+    auto [iter,inserted]=m_totals.try_emplace(event.name,0.0);
+    if(inserted) m_order.push_back(event.name);
+    iter->second+=event.duration_us;
+}
+
+void CProfiler::Record(const char*name,clock::time_point start,clock::time_point end)
+{
+    const event_t event{name,ThreadNumber(),Microseconds(start),
+                        std::chrono::duration<double,std::micro>(end-start).count()};
+    std::lock_guard lock(m_mutex);
+    m_Push(event);
+}
+
+void CProfiler::RecordGpu(const char*name,double start_us,double duration_us)
+{
+    std::lock_guard lock(m_mutex);
+    m_Push({name,-1,start_us,duration_us});
+}
+
+void CProfiler::EndFrame()
+{
+    std::lock_guard lock(m_mutex);
+    ++m_frames;
+    const auto now=clock::now();
+    if(now-m_window_start<std::chrono::milliseconds(500)) return;
+    std::ostringstream summary;
+    summary<<std::fixed<<std::setprecision(2);
+    for(const auto&name:m_order)
+    {
+        if(&name!=&m_order.front()) summary<<" | ";
+        summary<<name<<' '<<m_totals[name]/1000.0/m_frames<<" ms";
+    }
+    m_summary=summary.str();
+    for(auto&[name,total]:m_totals) total=0;
+    m_frames=0;
+    m_window_start=now;
+}
+
+std::string CProfiler::Summary()const
+{
+    std::lock_guard lock(m_mutex);
+    return m_summary;
+}
+
+std::string CProfiler::ChromeTrace()const
+{
+    using namespace json11;
+    std::lock_guard lock(m_mutex);
+    Json::array events;
+    events.reserve(m_events.size()+1);
+    events.push_back(Json::object{{"name","thread_name"},{"ph","M"},{"pid",1},{"tid",-1},
+                                  {"args",Json::object{{"name","GPU"}}}});
+    for(const auto&event:m_events)
+    {
+        events.push_back(Json::object{{"name",event.name},
+                                      {"cat",event.thread<0? "gpu":"cpu"},
+                                      {"ph","X"},
+                                      {"pid",1},
+                                      {"tid",event.thread},
+                                      {"ts",event.start_us},
+                                      {"dur",event.duration_us}});
+    }
+    return Json(Json::object{{"traceEvents",events},{"displayTimeUnit","ms"}}).dump();
+}
+
+std::size_t CProfiler::NumberOfEvents()const
+{
+    std::lock_guard lock(m_mutex);
+    return m_events.size();
+}
+
+void CProfiler::Clear()
+{
+    std::lock_guard lock(m_mutex);
+    m_events.clear();
+    m_totals.clear();
+    m_order.clear();
+    m_frames=0;
+    m_window_start=clock::now();
+    m_summary.clear();
+}
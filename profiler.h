@@ -0,0 +1,82 @@
+#ifndef _profiler_
+#define _profiler_
+
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <map>
+
+// Profiler of the frames: the scopes of CPU work are recorded by CScope,
+// the intervals of GPU work are recorded by RecordGpu. The events are
+// exported as the Chrome trace JSON (chrome://tracing, Perfetto), the sums
+// of the times per frame are averaged over half a second for the summary.
+// When the profiler is disabled, the scope costs a relaxed atomic load.
+// Names of the events must be string literals, they aren't copied.
+
+class CProfiler
+{
+    public:
+    using clock=std::chrono::steady_clock;
+    struct event_t
+    {
+        const char* name;
+        int         thread;// -1 for the GPU
+        double      start_us;// since the creation of the profiler
+        double      duration_us;
+    };
+    class CScope
+    {
+        const char*       m_name=nullptr;
+        clock::time_point m_start;
+        public:
+        CScope(const char*name)
+        {
+            if(!CProfiler::IsEnabled()) return;
+            m_name=name;
+            m_start=clock::now();
+        }
+        // ends the scope before the destruction
+        void End()
+        {
+            if(m_name) CProfiler::Instance().Record(m_name,m_start,clock::now());
+            m_name=nullptr;
+        }
+        ~CScope(){End();}
+        CScope(const CScope&)=delete;
+        CScope&operator=(const CScope&)=delete;
+    };
+    private:
+    inline static std::atomic<bool> s_enabled=false;
+    // events are dropped by halves from the beginning over the limit
+    static const std::size_t max_events=1<<18;
+    mutable std::mutex  m_mutex;
+    clock::time_point   m_origin=clock::now();
+    std::vector<event_t> m_events;
+    // sums of the times of the current summary window
+    std::map<std::string,double> m_totals;
+    std::vector<std::string>     m_order;// names in the order of appearance
+    unsigned                     m_frames=0;
+    clock::time_point            m_window_start=clock::now();
+    std::string                  m_summary;
+    CProfiler()=default;
+    void m_Push(const event_t&event);
+    public:
+    static CProfiler& Instance();
+    static bool IsEnabled(){return s_enabled.load(std::memory_order_relaxed);}
+    static void SetEnabled(bool);
+
+    double Microseconds(clock::time_point)const;
+    void Record(const char*name,clock::time_point start,clock::time_point end);
+    void RecordGpu(const char*name,double start_us,double duration_us);
+    // ends the frame of the summary
+    void EndFrame();
+    // "name ms | ..." averaged per frame, empty before the first window
+    std::string Summary()const;
+    std::string ChromeTrace()const;
+    std::size_t NumberOfEvents()const;
+    void Clear();
+};
+
+#endif // _profiler_
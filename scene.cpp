@@ -2,18 +2,24 @@
 #include <iostream>
 #include <algorithm>
 #include <memory>
+#include <cmath>
+#include <limits>
+#include <chrono>
 
 #include "opengl_iface.h"
 #include "legacy_render.h"
 #include "scene.h"
+#include "grid_indices.h"
+#include "profiler.h"
 
 #include "Shaders/shaders_source.h"
 
-static void MakeContiniousBuffer(const CFunctionalMesh::matrix_t&mtx,std::vector<float>&data)
+// columns [first,last) of matrix, column by column
+
+static void MakeContiniousBuffer(const CFunctionalMesh::matrix_t&mtx,int first,int last,float*data)
 {
-    data.resize(mtx.size()*3);
     decltype(mtx.size()) index=0;
-    for(int i=0;i<mtx.cols();++i)
+    for(int i=first;i<last;++i)
     {
         for(int j=0;j<mtx.rows();++j)
         {
@@ -24,88 +30,259 @@ static void MakeContiniousBuffer(const CFunctionalMesh::matrix_t&mtx,std::vector
 
         }
     }
-    assert(index==mtx.size()*3);
+    assert(index==(last-first)*mtx.rows()*3);
+}
+
+static void MakeContiniousBuffer(const CFunctionalMesh::matrix_t&mtx,int first,int last,std::vector<float>&data)
+{
+    data.resize((last-first)*mtx.rows()*3);
+    MakeContiniousBuffer(mtx,first,last,data.data());
 }
 
-static void MakeEigesIndexes(int rows,int cols,std::vector<unsigned>&data)
+static void MakeContiniousBuffer(const CFunctionalMesh::matrix_t&mtx,std::vector<float>&data)
 {
-    data.resize(2*rows*cols);
-    int index=0;
-    int pos=0;
-    for(int i=0;i<cols;++i)// by cols
+    MakeContiniousBuffer(mtx,0,mtx.cols(),data);
+}
+
+static void MakeContiniousBuffer(const std::vector<Eigen::Vector3f>&points,std::vector<float>&data)
+{
+    data.resize(points.size()*3);
+    std::size_t index=0;
+    for(auto&p:points)
     {
-        if(i&1)
-        {
-            for(int j=0;j<rows;++j)
-            {
-                data[pos++]=index--;
-            }
-            index+=rows+1;
-        }
-        else
+        for(int k=0;k<3;++k) data[index++]=p[k];
+    }
+}
+
+// Upload the changed columns of mtx into buff, converted by make(mtx,first,last,data)
+// into 'components' values per point, entire buffer is rewritten, if all
+// columns are changed or the size or the type of buffer doesn't match
+
+template<class value_t,class make_t>
+static void UploadColumns(const CFunctionalMesh::matrix_t&mtx,CFunctionalMesh::CUpdateResult result,
+                          std::size_t components,make_t make,std::vector<value_t>&data,CBuffer&buff)
+{
+    if(result.IsPartial()&&buff.Size()==std::size_t(mtx.size())*components&&
+       buff.TypeEnum()==type_to_enum<value_t>())
+    {
+        make(mtx,result.FirstColumn(),result.LastColumn(),data);
+        buff.WriteSub(result.FirstColumn()*mtx.rows()*components,data);
+    }
+    else
+    {
+        make(mtx,0,mtx.cols(),data);
+        buff.Write(data,CBuffer::dynamic_draw);
+    }
+}
+
+static void UploadColumns(const CFunctionalMesh::matrix_t&mtx,CFunctionalMesh::CUpdateResult result,
+                          std::vector<float>&data,CBuffer&buff)
+{
+    auto make=[](const CFunctionalMesh::matrix_t&mtx,int first,int last,std::vector<float>&data)
+    {
+        MakeContiniousBuffer(mtx,first,last,data);
+    };
+    UploadColumns(mtx,result,3,make,data,buff);
+}
+
+// Position, color and normal of each point one after another, columns [first,last)
+
+static void MakeInterleavedBuffer(const CFunctionalMesh::matrix_t&pts,const CFunctionalMesh::matrix_t*colors,
+                                  const CFunctionalMesh::matrix_t*normals,int first,int last,float*data)
+{
+    std::size_t index=0;
+    auto push=[data,&index](const Eigen::Vector3f&p)
+    {
+        for(int k=0;k<3;++k) data[index++]=p[k];
+    };
+    for(int i=first;i<last;++i)
+    {
+        for(int j=0;j<pts.rows();++j)
         {
-            for(int j=0;j<rows;++j)
-            {
-                data[pos++]=index++;
-            }
-            index+=rows-1;
+            push(pts(j,i));
+            if(colors)  push((*colors)(j,i));
+            if(normals) push((*normals)(j,i));
         }
     }
-    int delta;
-    if(cols&1)
+}
+
+static void MakeInterleavedBuffer(const CFunctionalMesh::matrix_t&pts,const CFunctionalMesh::matrix_t*colors,
+                                  const CFunctionalMesh::matrix_t*normals,int first,int last,std::vector<float>&data)
+{
+    data.resize((last-first)*pts.rows()*3*(1+(colors? 1:0)+(normals? 1:0)));
+    MakeInterleavedBuffer(pts,colors,normals,first,last,data.data());
+}
+
+// Attributes of the mesh in the interleaved vertex buffer:
+// the colors of the palette aren't required
+
+static int InterleavedAttributes(const CFunctionalMesh&mesh)
+{
+    if(!mesh.Points()) return 0;
+    int attributes=CMeshShaderData::use_vertex;
+    if(mesh.Colors()&&!mesh.IsGpuPalette()&&mesh.Colors()->size()==mesh.Points()->size())
     {
-        delta=-1;
-        index=rows*cols-1;
+        attributes|=CMeshShaderData::use_color;
     }
-    else
+    if(mesh.Normals()&&mesh.Normals()->size()==mesh.Points()->size())
     {
-        delta=1;
-        index=rows*(cols-1);
+        attributes|=CMeshShaderData::use_normal;
     }
-    for(int i=0;i<rows;++i)// by rows
+    return attributes;
+}
+
+// Entire mtx is written straight into the next part of the stream
+
+static void StreamColumns(const CFunctionalMesh::matrix_t&mtx,CStreamBuffer&buff)
+{
+    MakeContiniousBuffer(mtx,0,mtx.cols(),buff.Map<float>(mtx.size()*3));
+    buff.Unmap();
+}
+
+///////////////////////////////////////////////////////
+//          Quantized attributes of lean meshes
+///////////////////////////////////////////////////////
+
+// positions in [0,65535] inside of the box, 4 values per point for alignment
+
+static void MakeQuantizedPositions(const CFunctionalMesh::matrix_t&mtx,int first,int last,
+                                   const CFunctionalMesh::box_t&box,std::vector<GLushort>&data)
+{
+    const Eigen::Vector3f extent=box.second-box.first;
+    Eigen::Vector3f scale;
+    for(int k=0;k<3;++k) scale[k]=extent[k]>0? 65535.0f/extent[k]:0.0f;
+    data.resize((last-first)*mtx.rows()*4);
+    std::size_t index=0;
+    for(int i=first;i<last;++i)
     {
-        if(i&1)
+        for(int j=0;j<mtx.rows();++j)
         {
-            for(int j=0;j<cols;++j)
+            const Eigen::Vector3f&p=mtx(j,i);
+            for(int k=0;k<3;++k)
             {
-                data[pos++]=index;
-                index+=rows;
+                // invalid samples aren't drawn
+                const float q=std::isfinite(p[k])? (p[k]-box.first[k])*scale[k]:0.0f;
+                data[index++]=GLushort(std::clamp(q+0.5f,0.0f,65535.0f));
             }
-            index+=delta-rows;
+            data[index++]=0;
         }
-        else
+    }
+}
+
+// half floats are converted directly from the matrix, which
+// stores the points column by column without gaps
+
+static void MakeHalfPositions(const CFunctionalMesh::matrix_t&mtx,int first,int last,std::vector<half_t>&data)
+{
+    static_assert(sizeof(CFunctionalMesh::point_t)==3*sizeof(float));
+    data.resize((last-first)*mtx.rows()*3);
+    const float*src=mtx.data()[first*mtx.rows()].data();
+    float_to_half(src,data.data(),data.size());
+}
+
+// octahedral encoding of unit vectors: the octants of the sphere
+// are projected onto the octahedron and unfolded onto the square
+
+static void MakeOctahedralNormals(const CFunctionalMesh::matrix_t&mtx,int first,int last,
+                                  std::vector<float>&encoded,std::vector<GLshort>&data)
+{
+    encoded.resize((last-first)*mtx.rows()*2);
+    std::size_t index=0;
+    for(int i=first;i<last;++i)
+    {
+        for(int j=0;j<mtx.rows();++j)
         {
-            for(int j=0;j<cols;++j)
+            const Eigen::Vector3f&n=mtx(j,i);
+            const float l1=std::abs(n[0])+std::abs(n[1])+std::abs(n[2]);
+            float x=0,y=0;
+            if(l1>0&&std::isfinite(l1))
             {
-                data[pos++]=index;
-                index-=rows;
+                x=n[0]/l1;
+                y=n[1]/l1;
+                if(n[2]<0)
+                {
+                    const float ox=(1-std::abs(y))*(x>=0? 1:-1);
+                    const float oy=(1-std::abs(x))*(y>=0? 1:-1);
+                    x=ox;
+                    y=oy;
+                }
             }
-            index+=delta+rows;
+            encoded[index++]=x;
+            encoded[index++]=y;
         }
     }
-    assert(pos==2*rows*cols);
+    data.resize(encoded.size());
+    float_to_snorm16(encoded.data(),data.data(),data.size());
 }
 
-static void MakeTriansIndexes(int rows,int cols,std::vector<unsigned>&data)
+static void MakeRGBA8Colors(const CFunctionalMesh::matrix_t&mtx,int first,int last,
+                            std::vector<float>&rgba,std::vector<GLubyte>&data)
 {
-    data.resize((rows-1)*(cols-1)*6);
-
-    int pos=0;
-    for(int i=0;i<rows-1;++i)
+    rgba.resize((last-first)*mtx.rows()*4);
+    std::size_t index=0;
+    for(int i=first;i<last;++i)
     {
-        for(int j=0;j<cols-1;++j)
+        for(int j=0;j<mtx.rows();++j)
         {
-            const int index=i+j*rows;
-            data[pos++]=index;
-            data[pos++]=index+1;
-            data[pos++]=index+1+rows;
-
-            data[pos++]=index+1+rows;
-            data[pos++]=index+rows;
-            data[pos++]=index;
+            const Eigen::Vector3f&c=mtx(j,i);
+            rgba[index++]=c[0];
+            rgba[index++]=c[1];
+            rgba[index++]=c[2];
+            rgba[index++]=1.0f;
         }
     }
-    assert(pos==(rows-1)*(cols-1)*6);
+    data.resize(rgba.size());
+    float_to_unorm8(rgba.data(),data.data(),data.size());
+}
+
+static void MakeEigesIndexes(const CFunctionalMesh::matrix_t&pts,const CFunctionalMesh::mask_t*mask,
+                             std::vector<unsigned>&data)
+{
+    MakeEigesIndexes(pts.rows(),pts.cols(),data);
+    if(!mask) return;
+    // invalid samples are replaced by single restart index
+    std::size_t pos=0;
+    for(auto index:data)
+    {
+        if((*mask)(index)) data[pos++]=index;
+        else if(pos>0&&data[pos-1]!=restart_index) data[pos++]=restart_index;
+    }
+    data.resize(pos);
+}
+
+static void MakeTriansIndexes(const CFunctionalMesh::matrix_t&pts,const CFunctionalMesh::mask_t*mask,
+                              std::vector<unsigned>&data)
+{
+    MakeTriansIndexes(pts.rows(),pts.cols(),data);
+    if(!mask) return;
+    // only triangles with all valid vertices
+    std::size_t pos=0;
+    for(std::size_t i=0;i<data.size();i+=3)
+    {
+        if(!((*mask)(data[i])&&(*mask)(data[i+1])&&(*mask)(data[i+2]))) continue;
+        data[pos++]=data[i];
+        data[pos++]=data[i+1];
+        data[pos++]=data[i+2];
+    }
+    data.resize(pos);
+}
+
+// Indices are written in 16 bits, if all vertices and restart index fit
+
+static void WriteIndices(const std::vector<unsigned>&indices,std::size_t vertices,
+                         std::vector<GLushort>&shorts,CIndexBuffer&buff,CIndexBuffer::usage_t usage)
+{
+    if(vertices>=std::numeric_limits<GLushort>::max())
+    {
+        buff.Write(indices,usage);
+        return;
+    }
+    shorts.resize(indices.size());
+    for(std::size_t i=0;i<indices.size();++i)
+    {
+        shorts[i]=indices[i]==restart_index? restart_index16:GLushort(indices[i]);
+    }
+    buff.Write(shorts,usage);
 }
 
 static void MakeBoxEdge(const Eigen::Vector3f&min,const Eigen::Vector3f&max,std::vector<float>&data)
@@ -134,24 +311,42 @@ static void MakeBoxEdge(const Eigen::Vector3f&min,const Eigen::Vector3f&max,std:
     }
 }
 
-static void MakeLevelsBuffer(int dir_index,
-                             const std::vector<std::pair<Eigen::Vector3f,Eigen::Vector3f>>&lines,
-                             std::vector<float>&data)
-{
+// All levels of the axis are packed into one buffer by one write,
+// the polylines of each level are shifted by the points before it
 
-    data.resize(3*2*lines.size());
-    typename std::vector<float>::size_type pos=0;
-    for(auto&[_1,_2]:lines)
+static void MakeLevelsBuffer(const std::vector<CFunctionalMesh::level_line_t>&lines,
+                             std::vector<float>&data,
+                             CMeshShaderData::levels_t&levels)
+{
+    std::size_t points=0,polylines=0;
+    for(auto&line:lines)
     {
-        data[pos++]=_1[0];
-        data[pos++]=_1[1];
-        data[pos++]=_1[2];
+        points+=line.m_points.size();
+        polylines+=line.Polylines();
+    }
+    data.resize(3*points);
+    levels.clear();
+    levels.m_first.reserve(polylines);
+    levels.m_count.reserve(polylines);
 
-        data[pos++]=_2[0];
-        data[pos++]=_2[1];
-        data[pos++]=_2[2];
+    std::size_t pos=0;
+    for(auto&line:lines)
+    {
+        const GLint base=pos/3;
+        for(auto&p:line.m_points)
+        {
+            data[pos++]=p[0];
+            data[pos++]=p[1];
+            data[pos++]=p[2];
+        }
+        for(std::size_t i=0;i<line.Polylines();++i)
+        {
+            levels.m_first.push_back(base+line.m_strips[i]);
+            levels.m_count.push_back(line.m_strips[i+1]-line.m_strips[i]);
+        }
     }
-    assert(pos==3*2*lines.size());
+    assert(pos==3*points);
+    if(!data.empty()) levels.m_buffer.Write(data,CBuffer::dynamic_draw);
 }
 
 ///////////////////////////////////////////////////////
@@ -164,24 +359,179 @@ m_box_vertex_buffer(float{0}),
 m_vertex_buffer(float{0}),
 m_color_buffer(float{0}),
 m_normals_buffer(float{0}),
-m_edges(unsigned{0}),
-m_triangles(unsigned{0})
+m_indices(std::make_shared<indices_t>())
 {
     glCheckError();
-    m_vao[0].EnableLayout(0,m_vertex_buffer,CBufferFormat::Solid(3));
+    m_EnableLayouts();
+    m_box_vao.EnableLayout(0,m_box_vertex_buffer,CBufferFormat::Solid(3));
+}
 
-    m_vao[1].EnableLayout(0,m_vertex_buffer,CBufferFormat::Solid(3)).
-             EnableLayout(1,m_color_buffer,CBufferFormat::Solid(3));
+void CMeshShaderData::m_EnableLayouts()
+{
+    const bool box_positions=m_positions==CFunctionalMesh::box_positions_id;
+    const CBufferFormat vertex=box_positions? CBufferFormat::Normalized(4).SetBlockSize(3):CBufferFormat::Solid(3);
+    const CBufferFormat color=m_lean? CBufferFormat::Normalized(4):CBufferFormat::Solid(3);
+    const CBufferFormat normal=m_lean? CBufferFormat::Normalized(2):CBufferFormat::Solid(3);
+
+    CBufferFormat formats[3]={vertex,color,normal};
+    CBuffer*buffers[3]={&m_vertex_buffer,&m_color_buffer,&m_normals_buffer};
+    CStreamBuffer*streams[3]={&m_streams[0],&m_streams[1],&m_streams[2]};
+    bool present[3]={true,true,true};
+    if(m_interleaved)
+    {
+        // position, color and normal of each vertex one after another in the vertex buffer
+        std::size_t offset=0;
+        for(int i=0;i<3;++i)
+        {
+            present[i]=m_interleaved&(1<<i);
+            formats[i].SetStartOffset(offset).SetStep(InterleavedStep());
+            if(present[i]) offset+=3;
+            buffers[i]=&m_vertex_buffer;
+            streams[i]=&m_streams[0];
+        }
+    }
+    auto enable=[&](const CVao&vao,std::initializer_list<GLuint> layouts)
+    {
+        for(GLuint i:layouts)
+        {
+            if(!present[i]) continue;
+            if(!m_streaming)                 vao.EnableLayout(i,*buffers[i],formats[i]);
+            else if(streams[i]->Valid())     vao.EnableLayout(i,*streams[i],formats[i]);
+        }
+    };
+    enable(m_vao[0],{0});
+    enable(m_vao[1],{0,1});
+    enable(m_vao[2],{0,2});
+    enable(m_vao[3],{0,1,2});
+
+    m_layout_types={m_vertex_buffer.TypeEnum(),m_color_buffer.TypeEnum(),m_normals_buffer.TypeEnum()};
+    for(int i=0;i<3;++i) m_stream_parts[i]={m_streams[i].Handler(),m_streams[i].Offset()};
+    m_layout_dirty=false;
+}
 
-    m_vao[2].EnableLayout(0,m_vertex_buffer,CBufferFormat::Solid(3)).
-             EnableLayout(2,m_normals_buffer,CBufferFormat::Solid(3));
+void CMeshShaderData::SetStreaming(bool streaming)
+{
+    if(m_streaming==streaming) return;
+    m_streaming=streaming;
+    if(m_streaming)
+    {
+        // lean formats aren't streamed
+        assert(!m_lean);
+        for(CBuffer*buff:{&m_vertex_buffer,&m_color_buffer,&m_normals_buffer})
+        {
+            CBuffer empty(float{0});
+            buff->Swap(empty);
+        }
+    }
+    else
+    {
+        for(auto&stream:m_streams)
+        {
+            CStreamBuffer empty;
+            stream.Swap(empty);
+        }
+    }
+    m_layout_dirty=true;
+}
 
-    m_vao[3].EnableLayout(0,m_vertex_buffer,CBufferFormat::Solid(3)).
-             EnableLayout(1,m_color_buffer,CBufferFormat::Solid(3)).
-             EnableLayout(2,m_normals_buffer,CBufferFormat::Solid(3));
+void CMeshShaderData::SetInterleaved(int attributes)
+{
+    if(m_interleaved==attributes) return;
+    m_interleaved=attributes;
+    if(m_interleaved)
+    {
+        // interleaved floats only
+        assert(!m_lean&&(m_interleaved&use_vertex));
+        CBuffer colors(float{0}),normals(float{0});
+        m_color_buffer.Swap(colors);
+        m_normals_buffer.Swap(normals);
+        CStreamBuffer color_stream,normal_stream;
+        m_streams[1].Swap(color_stream);
+        m_streams[2].Swap(normal_stream);
+    }
+    m_layout_dirty=true;
+}
 
+std::size_t CMeshShaderData::InterleavedStep()const
+{
+    return 3*((m_interleaved&use_vertex? 1:0)+(m_interleaved&use_color? 1:0)+(m_interleaved&use_normal? 1:0));
+}
 
-    m_box_vao.EnableLayout(0,m_box_vertex_buffer,CBufferFormat::Solid(3));
+void CMeshShaderData::FenceStreams()
+{
+    if(!m_streaming) return;
+    for(auto&stream:m_streams) stream.Fence();
+}
+
+void CMeshShaderData::SetLean(bool lean,positions_t positions)
+{
+    m_lean=lean;
+    m_positions=lean? positions:CFunctionalMesh::float_positions_id;
+    if(m_positions!=CFunctionalMesh::box_positions_id) m_decode.setIdentity();
+    m_layout_dirty=true;
+}
+
+// quantized positions q in [0,1] are restored as min+q*(max-min)
+
+void CMeshShaderData::SetDecodeBox(const Eigen::Vector3f&min,const Eigen::Vector3f&max)
+{
+    m_decode.setIdentity();
+    for(int k=0;k<3;++k)
+    {
+        m_decode(k,k)=max[k]-min[k];
+        m_decode(k,3)=min[k];
+    }
+}
+
+void CMeshShaderData::SetPalette(const std::vector<Eigen::Vector3f>&colors)
+{
+    if(!m_palette.Empty()&&colors==m_palette_colors) return;
+    m_palette_colors=colors;
+    m_palette.Write(m_palette_colors.front().data(),m_palette_colors.size());
+}
+
+void CMeshShaderData::ReleaseColors()
+{
+    if(!m_streams[1].Empty())
+    {
+        CStreamBuffer empty;
+        m_streams[1].Swap(empty);
+        m_layout_dirty=true;
+    }
+    if(m_color_buffer.Empty()) return;
+    // the storage is freed with the old buffer, the layouts refer to the new one
+    CBuffer empty(float{0});
+    m_color_buffer.Swap(empty);
+    m_layout_dirty=true;
+}
+
+void CMeshShaderData::SetSharedIndices(std::shared_ptr<indices_t> indices)
+{
+    assert(indices);
+    m_indices=std::move(indices);
+    m_shared_indices=true;
+}
+
+CMeshShaderData::indices_t&CMeshShaderData::UniqueIndices()
+{
+    if(m_shared_indices)
+    {
+        m_indices=std::make_shared<indices_t>();
+        m_shared_indices=false;
+    }
+    return *m_indices;
+}
+
+void CMeshShaderData::UpdateLayouts()
+{
+    const std::array<GLenum,3> types={m_vertex_buffer.TypeEnum(),m_color_buffer.TypeEnum(),
+                                      m_normals_buffer.TypeEnum()};
+    bool streams_written=false;
+    for(int i=0;i<3&&m_streaming;++i)
+    {
+        streams_written|=m_stream_parts[i]!=std::make_pair(m_streams[i].Handler(),m_streams[i].Offset());
+    }
+    if(m_layout_dirty||streams_written||types!=m_layout_types) m_EnableLayouts();
 }
 
 void  CMeshShaderData::Swap(CMeshShaderData&other)
@@ -191,10 +541,33 @@ void  CMeshShaderData::Swap(CMeshShaderData&other)
     m_box_vao.Swap(other.m_box_vao);
     m_box_vertex_buffer.Swap(other.m_box_vertex_buffer);
 
-    m_edges.Swap(other.m_edges);
-    m_triangles.Swap(other.m_triangles);
+    m_vertex_buffer.Swap(other.m_vertex_buffer);
+    m_color_buffer.Swap(other.m_color_buffer);
+    m_normals_buffer.Swap(other.m_normals_buffer);
+    for(int i=0;i<3;++i) m_streams[i].Swap(other.m_streams[i]);
+    std::swap(m_streaming,other.m_streaming);
+    std::swap(m_stream_parts,other.m_stream_parts);
+    std::swap(m_interleaved,other.m_interleaved);
+
+    m_indices.swap(other.m_indices);
+    std::swap(m_shared_indices,other.m_shared_indices);
 
     for(int i=0;i<3;++i) m_levels[i].Swap(other.m_levels[i]);
+
+    std::swap(m_lean,other.m_lean);
+    std::swap(m_positions,other.m_positions);
+    std::swap(m_decode,other.m_decode);
+    std::swap(m_layout_types,other.m_layout_types);
+    std::swap(m_layout_dirty,other.m_layout_dirty);
+    std::swap(m_memory,other.m_memory);
+    m_palette.Swap(other.m_palette);
+    m_palette_colors.swap(other.m_palette_colors);
+    std::swap(m_palette_range,other.m_palette_range);
+}
+
+static void SetRestartIndex(const CIndexBuffer&buff)
+{
+    glPrimitiveRestartIndex(buff.TypeEnum()==GL_UNSIGNED_SHORT? restart_index16:restart_index);
 }
 
 void  CMeshShaderData::DrawEdges(int _i)const
@@ -202,7 +575,8 @@ void  CMeshShaderData::DrawEdges(int _i)const
     int i=_i/2;
     assert(i>=0 && i<4 && (_i&1) );
 
-    m_vao[i].DrawElement(m_edges,CVao::line_strip);
+    SetRestartIndex(m_indices->m_edges);
+    m_vao[i].DrawElement(m_indices->m_edges,CVao::line_strip);
 }
 
 
@@ -211,7 +585,8 @@ void  CMeshShaderData::DrawTrians(int _i)const
     int i=_i/2;
     assert(i>=0 && i<4 && (_i&1) );
 
-    m_vao[i].DrawElement(m_triangles,CVao::triangles);
+    SetRestartIndex(m_indices->m_triangles);
+    m_vao[i].DrawElement(m_indices->m_triangles,m_indices->m_triangles_mode);
 }
 
 
@@ -219,11 +594,77 @@ void  CMeshShaderData::DrawBox()const
 {
     m_box_vao.DrawArraw(CVao::lines,0 ,m_box_vertex_buffer.Size());
 }
+
+// the columns of the transform are read by the layouts 3-6, the material by 7,
+// they are advanced once per instance
+
+void  CMeshShaderData::m_EnableInstances(const CVao&vao,const CStreamBuffer&instances,std::size_t first)const
+{
+    for(GLuint i=0;i<5;++i)
+    {
+        auto format=CBufferFormat::Solid(4).SetStep(instance_floats).SetStartOffset(first*instance_floats+4*i);
+        vao.EnableLayout(3+i,instances,format.SetDivisor(1));
+    }
+}
+
+void  CMeshShaderData::m_DisableInstances(const CVao&vao)const
+{
+    for(GLuint i=0;i<5;++i) vao.DisableLayout(3+i);
+}
+
+void  CMeshShaderData::DrawEdgesInstanced(int _i,const CStreamBuffer&instances,std::size_t first,std::size_t count)const
+{
+    int i=_i/2;
+    assert(i>=0 && i<4 && (_i&1) );
+
+    SetRestartIndex(m_indices->m_edges);
+    m_EnableInstances(m_vao[i],instances,first);
+    m_vao[i].DrawElementInstanced(m_indices->m_edges,CVao::line_strip,count);
+    m_DisableInstances(m_vao[i]);
+}
+
+void  CMeshShaderData::DrawTriansInstanced(int _i,const CStreamBuffer&instances,std::size_t first,std::size_t count)const
+{
+    int i=_i/2;
+    assert(i>=0 && i<4 && (_i&1) );
+
+    SetRestartIndex(m_indices->m_triangles);
+    m_EnableInstances(m_vao[i],instances,first);
+    m_vao[i].DrawElementInstanced(m_indices->m_triangles,m_indices->m_triangles_mode,count);
+    m_DisableInstances(m_vao[i]);
+}
 
 ///////////////////////////////////////////////////////
 //                      CScene
 ///////////////////////////////////////////////////////
 
+CScene::mesh_program_t::mesh_program_t(CShaderProgramm&&prog):CShaderProgramm(std::move(prog)),
+full_matrix(get_uniform<mat4>("full_matrix")),
+model_matrix4(get_uniform<mat4>("model_matrix4")),
+camera_matrix(get_uniform<mat4>("camera_matrix")),
+decode_matrix(get_uniform<mat4>("decode_matrix")),
+model_matrix3(get_uniform<mat3>("model_matrix3")),
+color(get_uniform<vec3>("color")),
+palette_range(get_uniform<vec2>("palette_range")),
+s_range(get_uniform<vec2>("s_range")),
+t_range(get_uniform<vec2>("t_range")),
+resolution(get_uniform<ivec2>("resolution")),
+alpha(get_uniform<float>("alpha")),
+material_ambient(get_uniform<float>("material.ambient")),
+material_diffuse(get_uniform<float>("material.diffuse")),
+material_specular(get_uniform<float>("material.specular")),
+material_shininess(get_uniform<float>("material.shininess")),
+shininess(get_uniform<float>("shininess")),
+time(get_uniform<float>("time")),
+two_side_specular(get_uniform<int>("two_side_specular")),
+oct_normals(get_uniform<int>("oct_normals")),
+instanced(get_uniform<int>("instanced")),
+palette(get_uniform<int>("palette")),
+palette_colors(get_uniform<int>("palette_colors")),
+specular(get_uniform<int>("specular"))
+{
+}
+
 CScene::CScene()
 {
     auto v_frag=CShader::Compile(CShader::fragment,fragment_shader);
@@ -244,6 +685,12 @@ CScene::CScene()
     m_actual_specular=&m_fong_shading;
     m_actual_colored_specular=&m_colored_fong_shading;
 
+    for(const mesh_program_t*prog:{&m_specular_prog,&m_specular_colored_prog,
+                                    &m_fong_shading,&m_colored_fong_shading})
+    {
+        prog->BindUniformBlock("frame_block",frame_block_binding);
+    }
+
     assert(m_vert.Valid());
     assert(m_colored_prog.Valid());
     assert(m_specular_prog.Valid());
@@ -261,44 +708,22 @@ bool CScene::AddMesh(CFunctionalMesh&mesh)
     m_meshes.push_back(&mesh);
     mesh.m_index=m_meshes.size()-1;
     m_shader_data.push_back({});
-    CMeshShaderData&data=m_shader_data.back();
+    m_update_states.push_back({});
 
+    // released data isn't available for the upload
+    mesh.m_RestoreReleased(true);
+    int update=0;
     if(mesh.Points())
     {
-        auto&pts=*mesh.Points();
-        MakeEigesIndexes(pts.rows(),pts.cols(),m_ints_cashe);
-        data.Edges().Write(m_ints_cashe,CBuffer::dynamic_draw);
-
-        MakeTriansIndexes(pts.rows(),pts.cols(),m_ints_cashe);
-        data.Trians().Write(m_ints_cashe,CBuffer::dynamic_draw);
-
-        MakeContiniousBuffer(pts,m_floats_cashe);
-        data.Vertex().Write(m_floats_cashe,CBuffer::dynamic_draw);
-        MakeBoxEdge(mesh.BoundedBox()->first,mesh.BoundedBox()->second,m_floats_cashe);
-        data.BoxVertex().Write(m_floats_cashe,CBuffer::dynamic_draw);
-    }
-    if(mesh.Colors())
-    {
-        MakeContiniousBuffer(*mesh.Colors(),m_floats_cashe);
-        data.Colors().Write(m_floats_cashe,CBuffer::dynamic_draw);
-    }
-    if(mesh.Normals())
-    {
-        MakeContiniousBuffer(*mesh.Normals(),m_floats_cashe);
-        data.Normals().Write(m_floats_cashe,CBuffer::dynamic_draw);
+        update|=CFunctionalMesh::CUpdateResult::update_grid|CFunctionalMesh::CUpdateResult::update_points;
     }
+    if(mesh.Colors())  update|=CFunctionalMesh::CUpdateResult::update_colors;
+    if(mesh.Normals()) update|=CFunctionalMesh::CUpdateResult::update_normals;
     for(int i=0;i<3;++i)
     {
-        if(mesh.Levels(i))
-        {
-            data.Levels(i).clear();
-            for(auto&level: *mesh.Levels(i))
-            {
-                MakeLevelsBuffer(i,level.m_lines,m_floats_cashe);
-                data.Levels(i).push_back().Write(m_floats_cashe,CBuffer::dynamic_draw);
-            }
-        }
+        if(mesh.Levels(i)) update|=CFunctionalMesh::CUpdateResult::update_levels(i);
     }
+    m_UpdateMeshData(mesh,m_shader_data.size()-1,CFunctionalMesh::CUpdateResult(update));
     mesh.SetUpdateCallback([this,i=m_shader_data.size()-1](const CFunctionalMesh&mesh,CFunctionalMesh::CUpdateResult result)
     {
         m_UpdateMeshData(mesh,i,result);
@@ -306,6 +731,17 @@ bool CScene::AddMesh(CFunctionalMesh&mesh)
     return true;
 }
 
+void CScene::SetInterleaved(bool interleaved)
+{
+    if(m_interleaved==interleaved) return;
+    m_interleaved=interleaved;
+    // the buffers of each mesh are written again in the other layout
+    for(std::size_t i=0;i<m_meshes.size();++i)
+    {
+        if(!m_meshes[i]->Empty()) m_UpdateMeshData(*m_meshes[i],i,CFunctionalMesh::CUpdateResult(0));
+    }
+}
+
 bool CScene::RemoveMesh(CFunctionalMesh&m)
 {
     assert(m_meshes.size()==m_shader_data.size());
@@ -317,10 +753,12 @@ bool CScene::RemoveMesh(CFunctionalMesh&m)
         (*iter)->m_index=-1;
         std::swap(m_meshes.back(),*iter);
         m_shader_data[iter-m_meshes.begin()].Swap(m_shader_data.back());
+        std::swap(m_update_states[iter-m_meshes.begin()],m_update_states.back());
     }
     m_meshes.back()->SetUpdateCallback(nullptr);
     m_meshes.pop_back();
     m_shader_data.pop_back();
+    m_update_states.pop_back();
     return true;
 }
 
@@ -329,6 +767,45 @@ bool CScene::IsMesh(const CFunctionalMesh&m)const
     return std::find(m_meshes.begin(),m_meshes.end(),&m)!=m_meshes.end();
 }
 
+const CMeshShaderData::memory_t& CScene::MemoryUsage(const CFunctionalMesh&m)const
+{
+    assert(IsMesh(m));
+    return m_shader_data[m.Index()].Memory();
+}
+
+bool CScene::AddMesh(CImplicitMesh&mesh)
+{
+    assert(m_implicit_meshes.size()==m_implicit_data.size());
+    if(std::find(m_implicit_meshes.begin(),m_implicit_meshes.end(),&mesh)!=m_implicit_meshes.end()) return false;
+    m_implicit_meshes.push_back(&mesh);
+    m_implicit_data.push_back({});
+    mesh.UpdateData();
+    m_UpdateImplicitData(mesh,m_implicit_data.back());
+    return true;
+}
+
+bool CScene::RemoveMesh(CImplicitMesh&mesh)
+{
+    assert(m_implicit_meshes.size()==m_implicit_data.size());
+    auto iter=std::find(m_implicit_meshes.begin(),m_implicit_meshes.end(),&mesh);
+    if(iter==m_implicit_meshes.end()) return false;
+    std::swap(*iter,m_implicit_meshes.back());
+    m_implicit_data[iter-m_implicit_meshes.begin()].Swap(m_implicit_data.back());
+    m_implicit_meshes.pop_back();
+    m_implicit_data.pop_back();
+    return true;
+}
+
+void CScene::m_UpdateImplicitData(const CImplicitMesh&mesh,CMeshShaderData&data)const
+{
+    // the buffers of the empty surface are emptied, the previous one isn't drawn
+    MakeContiniousBuffer(mesh.Vertices(),m_floats_cashe);
+    data.Vertex().Write(m_floats_cashe,CBuffer::dynamic_draw);
+    MakeContiniousBuffer(mesh.Normals(),m_floats_cashe);
+    data.Normals().Write(m_floats_cashe,CBuffer::dynamic_draw);
+    data.UniqueIndices().m_triangles.Write(mesh.Indices(),CBuffer::dynamic_draw);
+}
+
 void CScene::LegacyRender(float t)const
 {
     glMatrixMode(GL_MODELVIEW);
@@ -383,255 +860,906 @@ void CScene::LegacyRender(float t)const
     glDisable(GL_LIGHTING);
 }
 
+// Index buffers of the grid are written once, while they are in use
+
+std::shared_ptr<CMeshShaderData::indices_t> CScene::m_GridIndices(int rows,int cols)
+{
+    auto&cached=m_grid_indices[{rows,cols}];
+    if(auto indices=cached.lock()) return indices;
+
+    std::erase_if(m_grid_indices,[](const auto&item){return item.second.expired();});
+    auto indices=std::make_shared<CMeshShaderData::indices_t>();
+    MakeEigesIndexes(rows,cols,m_ints_cashe);
+    WriteIndices(m_ints_cashe,rows*cols,m_ushorts_cashe,indices->m_edges,CBuffer::static_draw);
+    MakeTriansStrips(rows,cols,m_ints_cashe);
+    WriteIndices(m_ints_cashe,rows*cols,m_ushorts_cashe,indices->m_triangles,CBuffer::static_draw);
+    indices->m_triangles_mode=CVao::triangle_strip;
+    m_grid_indices[{rows,cols}]=indices;
+    return indices;
+}
+
+std::size_t CScene::SharedGrids()const
+{
+    return std::count_if(m_grid_indices.begin(),m_grid_indices.end(),
+                         [](const auto&item){return !item.second.expired();});
+}
+
 void CScene::m_UpdateMeshData(const CFunctionalMesh&mesh,size_t index,CFunctionalMesh::CUpdateResult up_result)
 {
+    CProfiler::CScope scope("Upload");
     // Update all buffers if its necessary
 
     auto& data=m_shader_data[index];
+    if(data.IsLean()!=mesh.IsLeanMemory()||data.PositionsFormat()!=mesh.PositionsFormat())
+    {
+        data.SetLean(mesh.IsLeanMemory(),mesh.PositionsFormat());
+    }
+    // attributes of dynamic mesh are changed for every frame, they are written
+    // straight into the mapped memory, which isn't read by the GPU at the moment
+    const bool streaming=mesh.IsDynamic()&&!mesh.IsLeanMemory();
+    const int  interleaved=m_interleaved&&!mesh.IsLeanMemory()? InterleavedAttributes(mesh):0;
+    if(data.IsStreaming()!=streaming||data.InterleavedAttributes()!=interleaved)
+    {
+        // the storage of the other kind is released, all attributes are written again
+        using result_t=CFunctionalMesh::CUpdateResult;
+        data.SetStreaming(streaming);
+        data.SetInterleaved(interleaved);
+        int update=up_result.m_type;
+        if(mesh.Points())  update|=result_t::update_points;
+        if(mesh.Colors())  update|=result_t::update_colors;
+        if(mesh.Normals()) update|=result_t::update_normals;
+        up_result=result_t(update);
+    }
+    using matrix_t=CFunctionalMesh::matrix_t;
     if(up_result.UpdatePoints())
     {
         assert(mesh.Points()&&mesh.BoundedBox());
-
-        MakeContiniousBuffer(*mesh.Points(),m_floats_cashe);
-        data.Vertex().Write(m_floats_cashe,CBuffer::dynamic_draw);
-
-        MakeBoxEdge(mesh.BoundedBox()->first,mesh.BoundedBox()->second,m_floats_cashe);
+        const auto&box=*mesh.BoundedBox();
+        // quantized heights are in [0,1] inside of the box
+        if(data.PositionsFormat()==CFunctionalMesh::box_positions_id) data.SetPaletteRange(0.0f,1.0f);
+        else                                                          data.SetPaletteRange(box.first[2],box.second[2]);
+        if(data.IsInterleaved())
+        {
+            // written below together with colors and normals
+        }
+        else if(data.PositionsFormat()==CFunctionalMesh::box_positions_id)
+        {
+            auto make=[&box](const matrix_t&mtx,int first,int last,std::vector<GLushort>&data)
+            {
+                MakeQuantizedPositions(mtx,first,last,box,data);
+            };
+            UploadColumns(*mesh.Points(),up_result,4,make,m_ushorts_cashe,data.Vertex());
+            data.SetDecodeBox(box.first,box.second);
+        }
+        else if(data.PositionsFormat()==CFunctionalMesh::half_positions_id)
+        {
+            UploadColumns(*mesh.Points(),up_result,3,MakeHalfPositions,m_halfs_cashe,data.Vertex());
+        }
+        else if(data.IsStreaming())
+        {
+            StreamColumns(*mesh.Points(),data.StreamVertex());
+        }
+        else
+        {
+            UploadColumns(*mesh.Points(),up_result,m_floats_cashe,data.Vertex());
+        }
+        MakeBoxEdge(box.first,box.second,m_floats_cashe);
         data.BoxVertex().Write(m_floats_cashe,CBuffer::dynamic_draw);
     }
-    if(up_result.UpdateColors())
+    if(up_result.UpdateColors()&&!data.IsInterleaved())
     {
         assert(mesh.Colors());
-        MakeContiniousBuffer(*mesh.Colors(),m_floats_cashe);
-        data.Colors().Write(m_floats_cashe,CBuffer::dynamic_draw);
+        auto make=[this](const matrix_t&mtx,int first,int last,std::vector<GLubyte>&data)
+        {
+            MakeRGBA8Colors(mtx,first,last,m_floats_cashe,data);
+        };
+        if(data.IsLean())           UploadColumns(*mesh.Colors(),up_result,4,make,m_bytes_cashe,data.Colors());
+        else if(data.IsStreaming()) StreamColumns(*mesh.Colors(),data.StreamColors());
+        else                        UploadColumns(*mesh.Colors(),up_result,m_floats_cashe,data.Colors());
     }
-    if(up_result.UpdateNormals())
+    if(up_result.UpdateNormals()&&!data.IsInterleaved())
     {
         assert(mesh.Normals());
-        MakeContiniousBuffer(*mesh.Normals(),m_floats_cashe);
-        data.Normals().Write(m_floats_cashe,CBuffer::dynamic_draw);
+        auto make=[this](const matrix_t&mtx,int first,int last,std::vector<GLshort>&data)
+        {
+            MakeOctahedralNormals(mtx,first,last,m_floats_cashe,data);
+        };
+        if(data.IsLean())           UploadColumns(*mesh.Normals(),up_result,2,make,m_shorts_cashe,data.Normals());
+        else if(data.IsStreaming()) StreamColumns(*mesh.Normals(),data.StreamNormals());
+        else                        UploadColumns(*mesh.Normals(),up_result,m_floats_cashe,data.Normals());
+    }
+    if(data.IsInterleaved()&&(up_result.UpdatePoints()||up_result.UpdateColors()||up_result.UpdateNormals()))
+    {
+        // one upload of all attributes
+        const auto&pts=*mesh.Points();
+        const matrix_t*colors=interleaved&CMeshShaderData::use_color? mesh.Colors():nullptr;
+        const matrix_t*normals=interleaved&CMeshShaderData::use_normal? mesh.Normals():nullptr;
+        if(data.IsStreaming())
+        {
+            float*ptr=data.StreamVertex().Map<float>(pts.size()*data.InterleavedStep());
+            MakeInterleavedBuffer(pts,colors,normals,0,pts.cols(),ptr);
+            data.StreamVertex().Unmap();
+        }
+        else
+        {
+            auto make=[colors,normals](const matrix_t&mtx,int first,int last,std::vector<float>&data)
+            {
+                MakeInterleavedBuffer(mtx,colors,normals,first,last,data);
+            };
+            UploadColumns(pts,up_result,data.InterleavedStep(),make,m_floats_cashe,data.Vertex());
+        }
     }
-    if(up_result.UpdateGrid())
+    if(up_result.UpdateGrid()||up_result.UpdateMask())
     {
         //std::cout<<"UPDATE GRID\n";
         auto&pts=*mesh.Points();
-        MakeEigesIndexes(pts.rows(),pts.cols(),m_ints_cashe);
-        data.Edges().Write(m_ints_cashe,CBuffer::dynamic_draw);
-
-        MakeTriansIndexes(pts.rows(),pts.cols(),m_ints_cashe);
-        data.Trians().Write(m_ints_cashe,CBuffer::dynamic_draw);
+        if(mesh.Mask())
+        {
+            // triangles with invalid vertices are dropped one by one
+            auto&indices=data.UniqueIndices();
+            MakeEigesIndexes(pts,mesh.Mask(),m_ints_cashe);
+            WriteIndices(m_ints_cashe,pts.size(),m_ushorts_cashe,indices.m_edges,CBuffer::dynamic_draw);
+
+            MakeTriansIndexes(pts,mesh.Mask(),m_ints_cashe);
+            WriteIndices(m_ints_cashe,pts.size(),m_ushorts_cashe,indices.m_triangles,CBuffer::dynamic_draw);
+            indices.m_triangles_mode=CVao::triangles;
+        }
+        else
+        {
+            data.SetSharedIndices(m_GridIndices(pts.rows(),pts.cols()));
+        }
     }
+    if(mesh.IsGpuPalette()) data.ReleaseColors();
     for(int i=0;i<3;++i)
     {
         if(up_result.UpdateLevel(i))
         {
             //std::cout<<"UPDATE LEVELS\n";
             assert(mesh.Levels(i));
-            data.Levels(i).clear();
-            auto&levels_pool=*mesh.Levels(i);
-            for(auto&level:levels_pool)
-            {
-                MakeLevelsBuffer(i,level.m_lines,m_floats_cashe);
-                data.Levels(i).push_back().Write(m_floats_cashe,CBuffer::dynamic_draw);
-            }
-
+            MakeLevelsBuffer(*mesh.Levels(i),m_floats_cashe,data.Levels(i));
         }
     }
+    data.UpdateLayouts();
+
+    // Memory of the attributes in use
+    const auto   traits=mesh.RenderingTraits();
+    const auto   grid=mesh.GetGrid();
+    const size_t vertices=(grid.s_resolution+1)*(grid.t_resolution+1);
+    auto&memory=data.Memory();
+    memory.gpu_bytes=memory.float_gpu_bytes=0;
+    memory.index_bytes=data.Edges().Size()*data.Edges().SizeOfType()+
+                       data.Trians().Size()*data.Trians().SizeOfType();
+    memory.stream_bytes=0;
+    auto count=[&memory,&data,vertices](const CBuffer&buff,const CStreamBuffer&stream)
+    {
+        if(data.IsStreaming())
+        {
+            memory.gpu_bytes+=stream.Size()*stream.SizeOfType();
+            memory.stream_bytes+=stream.Capacity();
+        }
+        else
+        {
+            memory.gpu_bytes+=buff.Size()*buff.SizeOfType();
+        }
+        memory.float_gpu_bytes+=vertices*3*sizeof(float);
+    };
+    count(data.Vertex(),data.StreamVertex());
+    if(mesh.IsGpuPalette())     memory.float_gpu_bytes+=vertices*3*sizeof(float);
+    else if(traits.IsColored()) count(data.Colors(),data.StreamColors());
+    if(traits.IsSpecularSurface()) count(data.Normals(),data.StreamNormals());
+    // CPU copies of static lean mesh aren't required after the upload
+    if(auto bytes=m_meshes[index]->m_ReleaseData())
+    {
+        memory.released_bytes=bytes;
+        m_halfs_cashe=std::vector<half_t>();
+        m_ushorts_cashe=std::vector<GLushort>();
+        m_shorts_cashe=std::vector<GLshort>();
+        m_bytes_cashe=std::vector<GLubyte>();
+    }
+    else if(!mesh.IsReleased())
+    {
+        memory.released_bytes=0;
+    }
 }
 
-void CScene::m_RenderMesh(const CFunctionalMesh&mesh,CMeshShaderData&data,const Eigen::Matrix4f&cam_matrix)const
+// Index of the data, which is drawn for the mesh: the geometry of the instance,
+// -1, if the geometry isn't in the scene
+
+int CScene::m_DataIndex(unsigned index)const
 {
-    CRenderingTraits traits=mesh.RenderingTraits();
+    const CFunctionalMesh*geometry=m_meshes[index]->SharedGeometry();
+    if(!geometry) return m_meshes[index]->Empty()? -1:int(index);
+    const int i=geometry->Index();
+    if(i<0||i>=int(m_meshes.size())||m_meshes[i]!=geometry||geometry->Empty()) return -1;
+    return i;
+}
+
+void CScene::m_CollectDraws(unsigned index,unsigned data_index,const Eigen::Matrix4f&cam_matrix)const
+{
+    // the instance has its own transform, material and transparency only
+    const CFunctionalMesh&mesh=*m_meshes[index];
+    const CFunctionalMesh&geometry=*m_meshes[data_index];
+    const CMeshShaderData&data=m_shader_data[data_index];
+    CRenderingTraits traits=geometry.RenderingTraits();
     const auto use_vertex=CMeshShaderData::use_vertex;
     const auto use_color=CMeshShaderData::use_color;
     const auto use_normal=CMeshShaderData::use_normal;
 
-    const Eigen::Matrix4f full_mtx=cam_matrix*mesh.GetTransform();
-    // Draw box
-    if(traits.IsBox())
-    {
-        m_vert.Use();
-        m_vert.get_uniform<mat4>("full_matrix")=full_mtx;
-        m_vert.get_uniform<vec3>("color")=Eigen::Vector3f(1.0,1.0,1.0);
-
-        data.DrawBox();
-    }
+    auto&matrices=m_frame_meshes[index];
+    matrices.full=cam_matrix*mesh.GetTransform();
+    // quantized positions of the surface and the mesh are restored by matrices
+    matrices.model=mesh.GetTransform()*data.DecodeMatrix();
+    matrices.vertex=matrices.full*data.DecodeMatrix();
+    // height colors are taken from the palette texture instead of the color buffer
+    const int use_colors=geometry.IsGpuPalette()? 0:use_color;
 
-    // Draw level lines
+    const std::uint64_t blend=mesh.Transparency()!=0;
+    auto push=[&](draw_t::kind_t kind,draw_t::program_t program,int use,float width,const point_t&color)
+    {
+        const std::uint64_t lines=kind!=draw_t::trians_id;
+        const std::uint64_t key=blend<<40|lines<<39|std::uint64_t(program)<<37|
+                                std::uint64_t(width>1)<<36|std::uint64_t(data_index)<<4|kind;
+        m_draws.push_back({key,index,data_index,kind,program,use,width,color});
+    };
+    if(traits.IsBox()) push(draw_t::box_id,draw_t::vert_id,use_vertex,1,point_t(1,1,1));
     for(int i=0;i<3;++i)
     {
-        glLineWidth(traits.IsSurface()? 2:1);
-        if(traits.IsLevelLines(i))
-        {
-            m_vert.Use();
-            m_vert.get_uniform<mat4>("full_matrix")=full_mtx;
-            m_vert.get_uniform<vec3>("color")=traits.IsSurface()? point_t(0,0,0):point_t(1,1,1);
-            data.Levels(i).DrawAll();
-        }
-        glLineWidth(1);
+        if(!traits.IsLevelLines(i)) continue;
+        push(draw_t::kind_t(draw_t::levels_x_id+i),draw_t::vert_id,use_vertex,traits.IsSurface()? 2:1,
+             traits.IsSurface()? point_t(0,0,0):point_t(1,1,1));
     }
 
-    // Draw the surface
-    const float alpha=1.f-mesh.Transparency();
-
+    // the surface
     int surf_param=traits.IsSurface();
     surf_param|=traits.IsColored()<<1;
     surf_param|=traits.IsSpecularSurface()<<2;
     switch(surf_param)
     {
         case 1:// pure surface, uniform grey
-        {
-            m_vert.Use();
-            m_vert.get_uniform<mat4>("full_matrix")=full_mtx;
-            m_vert.get_uniform<vec3>("color")=Eigen::Vector3f(0.5,0.5,0.5);
-            m_vert.get_uniform<float>("alpha")=alpha;
-
-            data.DrawTrians(use_vertex);
-        }
+            push(draw_t::trians_id,draw_t::vert_id,use_vertex,1,point_t(0.5,0.5,0.5));
         break;
-
         case 3:// color surface
-        {
-            m_colored_prog.Use();
-            m_colored_prog.get_uniform<mat4>("full_matrix")=full_mtx;
-            m_colored_prog.get_uniform<float>("alpha")=alpha;
-
-            data.DrawTrians(use_vertex|use_color);
-        }
+            push(draw_t::trians_id,draw_t::colored_id,use_vertex|use_colors,1,point_t());
         break;
-
         case 5:// specular surface
-        {
-            m_actual_specular->Use();
-            // Matrix
-            m_actual_specular->get_uniform<mat4>("full_matrix")=full_mtx;
-            m_actual_specular->get_uniform<mat4>("model_matrix4")=mesh.GetTransform();
-            m_actual_specular->get_uniform<mat3>("model_matrix3")=mesh.GetRotate();
-            m_actual_specular->get_uniform<vec3>("view_org")=m_camera.GetPosition();
-            //light source
-            m_actual_specular->get_uniform<vec3>("light_source.position")=m_light_source.Position();
-            m_actual_specular->get_uniform<vec3>("light_source.ambient")=m_light_source.Ambient();
-            m_actual_specular->get_uniform<vec3>("light_source.diffuse")=m_light_source.Diffuse();
-            m_actual_specular->get_uniform<vec3>("light_source.specular")=m_light_source.Specular();
-
-            //material
-            auto&material=mesh.GetMaterial();
-            m_actual_specular->get_uniform<float>("material.ambient")=material.ambient;
-            m_actual_specular->get_uniform<float>("material.diffuse")=material.diffuse;
-            m_actual_specular->get_uniform<float>("material.specular")=material.specular;
-            m_actual_specular->get_uniform<float>("material.shininess")=material.shininess;
-            m_actual_specular->get_uniform<int>("two_side_specular")=traits.IsTwoSideSpecular();
-            m_actual_specular->get_uniform<float>("alpha")=alpha;
-
-            data.DrawTrians(use_vertex|use_normal);
-        }
+            push(draw_t::trians_id,draw_t::specular_id,use_vertex|use_normal,1,point_t());
         break;
-
         case 7:// colored and specular surface
-        {
-            m_actual_colored_specular->Use();
-            // Matrix
-            m_actual_colored_specular->get_uniform<mat4>("full_matrix")=full_mtx;
-            m_actual_colored_specular->get_uniform<mat4>("model_matrix4")=mesh.GetTransform();
-            m_actual_colored_specular->get_uniform<mat3>("model_matrix3")=mesh.GetRotate();
-            m_actual_colored_specular->get_uniform<vec3>("view_org")=m_camera.GetPosition();
-            //light source
-            m_actual_colored_specular->get_uniform<vec3>("light_source.position")=m_light_source.Position();
-            m_actual_colored_specular->get_uniform<vec3>("light_source.ambient")=m_light_source.Ambient();
-            m_actual_colored_specular->get_uniform<vec3>("light_source.diffuse")=m_light_source.Diffuse();
-            m_actual_colored_specular->get_uniform<vec3>("light_source.specular")=m_light_source.Specular();
-            m_actual_colored_specular->get_uniform<int>("two_side_specular")=traits.IsTwoSideSpecular();
-
-            m_actual_colored_specular->get_uniform<float>("shininess")=mesh.GetMaterial().shininess;
-            m_actual_colored_specular->get_uniform<float>("alpha")=alpha;
-
-            data.DrawTrians(use_vertex|use_normal|use_color);
-        }
+            push(draw_t::trians_id,draw_t::colored_specular_id,use_vertex|use_normal|use_colors,1,point_t());
         break;
-
         default: assert((surf_param&1)==0);
-
     }
 
-    //Draw mesh
+    // the mesh
     int param=traits.IsMesh();
     param|=traits.IsSurface()<<1;
     param|=traits.IsColored()<<2;
-
     switch(param)
     {
         case 1:// pure mesh, uniform white
-        {
-            m_vert.Use();
-            m_vert.get_uniform<mat4>("full_matrix")=full_mtx;
-            m_vert.get_uniform<vec3>("color")=Eigen::Vector3f(1.0,1.0,1.0);
-
-            data.DrawEdges(use_vertex);
-        }
+            push(draw_t::edges_id,draw_t::vert_id,use_vertex,1,point_t(1,1,1));
         break;
-
         case 3:// mesh over unpainted surface
         case 7:// mesh over painted surface
+            push(draw_t::edges_id,draw_t::vert_id,use_vertex,2,point_t(0,0,0));
+        break;
+        case 5:// colored mesh
+            push(draw_t::edges_id,draw_t::colored_id,use_vertex|use_colors,1,point_t());
+        break;
+        default:assert((param&1)==0);
+    }
+}
+
+void CScene::m_SubmitDraws(const Eigen::Matrix4f&cam_matrix)const
+{
+    if(m_sorted_draws)
+    {
+        std::sort(m_draws.begin(),m_draws.end(),[](const draw_t&a,const draw_t&b){return a.key<b.key;});
+    }
+    else
+    {
+        // order of the meshes, the transparent ones after all others
+        std::stable_sort(m_draws.begin(),m_draws.end(),[](const draw_t&a,const draw_t&b)
         {
-            glLineWidth(2);
-            m_vert.Use();
-            m_vert.get_uniform<mat4>("full_matrix")=full_mtx;
-            m_vert.get_uniform<vec3>("color")=Eigen::Vector3f(0.0,0.0,0.0);
+            return (a.key>>40)<(b.key>>40);
+        });
+    }
+    auto&stat=m_render_stat;
+    const mesh_program_t*programs[4]={&m_vert,&m_colored_prog,m_actual_specular,m_actual_colored_specular};
+
+    // runs of equal draws of one geometry: end of the run and its first instance
+    auto&runs=m_instance_runs;
+    runs.assign(m_draws.size(),{0,0});
+    std::size_t instances=0;
+    for(std::size_t i=0;i<m_draws.size();++i)
+    {
+        const draw_t&draw=m_draws[i];
+        std::size_t end=i+1;
+        const bool instanced=m_instancing&&programs[draw.program]->instanced&&
+                             (draw.kind==draw_t::trians_id||draw.kind==draw_t::edges_id);
+        // the alpha isn't in the instance buffer, it's the uniform of the run
+        while(instanced&&end<m_draws.size()&&m_draws[end].key==draw.key&&
+              m_draws[end].line_width==draw.line_width&&m_draws[end].color==draw.color&&
+              m_meshes[m_draws[end].mesh]->Transparency()==m_meshes[draw.mesh]->Transparency())
+        {
+            ++end;
+        }
+        if(end-i<2) continue;
+        runs[i]={end,instances};
+        instances+=end-i;
+        i=end-1;
+    }
+    if(instances)
+    {
+        // transforms and materials of all instances of the frame are written at once
+        const std::size_t step=CMeshShaderData::instance_floats;
+        float*ptr=m_instances.Map<float>(instances*step);
+        for(std::size_t i=0;i<m_draws.size();++i)
+        {
+            if(!runs[i].first) continue;
+            float*instance=ptr+runs[i].second*step;
+            for(std::size_t k=i;k<runs[i].first;++k,instance+=step)
+            {
+                const CFunctionalMesh&mesh=*m_meshes[m_draws[k].mesh];
+                const auto&material=mesh.GetMaterial();
+                std::copy_n(mesh.GetTransform().data(),16,instance);
+                instance[16]=material.ambient;
+                instance[17]=material.diffuse;
+                instance[18]=material.specular;
+                instance[19]=material.shininess;
+            }
+        }
+        m_instances.Unmap();
+    }
 
-            data.DrawEdges(use_vertex);
-            glLineWidth(1);
+    const mesh_program_t*current=nullptr;
+    const CMeshShaderData*bound_palette=nullptr;
+    float line_width=1;
+    bool  blend=false;
+    glLineWidth(1);
+    for(std::size_t index=0;index<m_draws.size();++index)
+    {
+        const draw_t&draw=m_draws[index];
+        const CFunctionalMesh&mesh=*m_meshes[draw.mesh];
+        const CFunctionalMesh&geometry=*m_meshes[draw.data];
+        CMeshShaderData&data=m_shader_data[draw.data];
+        const auto&matrices=m_frame_meshes[draw.mesh];
+        const mesh_program_t&prog=*programs[draw.program];
+        if(!blend&&(draw.key>>40))
+        {
+            // transparent meshes
+            glEnable(GL_BLEND);
+            glDepthMask(GL_FALSE);
+            glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+            blend=true;
+            ++stat.state_changes;
         }
-        break;
+        if(&prog!=current)
+        {
+            prog.Use();
+            current=&prog;
+            ++stat.program_changes;
+        }
+        if(draw.line_width!=line_width)
+        {
+            glLineWidth(draw.line_width);
+            line_width=draw.line_width;
+            ++stat.state_changes;
+        }
+        const bool trians=draw.kind==draw_t::trians_id;
+        const float alpha=1.f-mesh.Transparency();
+        auto set_palette=[&]()
+        {
+            const bool palette=geometry.IsGpuPalette();
+            prog.palette_colors=palette;
+            if(!palette) return;
+            if(bound_palette!=&data)
+            {
+                data.SetPalette(geometry.Palette());
+                data.BindPalette(0);
+                bound_palette=&data;
+                ++stat.state_changes;
+            }
+            prog.palette=0;
+            prog.palette_range=data.PaletteRange();
+        };
+        switch(draw.program)
+        {
+            case draw_t::vert_id:
+            {
+                // the box and the level lines aren't quantized
+                const bool decoded=draw.kind==draw_t::trians_id||draw.kind==draw_t::edges_id;
+                prog.full_matrix=decoded? matrices.vertex:matrices.full;
+                prog.color=draw.color;
+                if(trians) prog.alpha=alpha;
+            }
+            break;
 
-        case 5:// colored mesh
+            case draw_t::colored_id:
+            {
+                prog.full_matrix=matrices.vertex;
+                if(trians) prog.alpha=alpha;
+                set_palette();
+            }
+            break;
+
+            case draw_t::specular_id:
+            {
+                const auto traits=geometry.RenderingTraits();
+                prog.full_matrix=matrices.vertex;
+                prog.model_matrix4=matrices.model;
+                prog.model_matrix3=mesh.GetRotate();
+
+                //material
+                auto&material=mesh.GetMaterial();
+                prog.material_ambient=material.ambient;
+                prog.material_diffuse=material.diffuse;
+                prog.material_specular=material.specular;
+                prog.material_shininess=material.shininess;
+                prog.two_side_specular=traits.IsTwoSideSpecular();
+                prog.oct_normals=data.IsLean();
+                prog.alpha=alpha;
+            }
+            break;
+
+            case draw_t::colored_specular_id:
+            {
+                const auto traits=geometry.RenderingTraits();
+                prog.full_matrix=matrices.vertex;
+                prog.model_matrix4=matrices.model;
+                prog.model_matrix3=mesh.GetRotate();
+                prog.two_side_specular=traits.IsTwoSideSpecular();
+                prog.oct_normals=data.IsLean();
+
+                prog.shininess=mesh.GetMaterial().shininess;
+                prog.alpha=alpha;
+                set_palette();
+            }
+            break;
+        }
+        if(runs[index].first)
         {
-            m_colored_prog.Use();
-            m_colored_prog.get_uniform<mat4>("full_matrix")=full_mtx;
+            // all instances of the run by one call
+            const auto[end,first]=runs[index];
+            prog.instanced=1;
+            prog.camera_matrix=cam_matrix;
+            prog.decode_matrix=data.DecodeMatrix();
+            if(trians) data.DrawTriansInstanced(draw.use,m_instances,first,end-index);
+            else       data.DrawEdgesInstanced(draw.use,m_instances,first,end-index);
+            prog.instanced=0;
+            ++stat.draw_calls;
+            stat.instances+=end-index;
+            index=end-1;
+            continue;
+        }
+        switch(draw.kind)
+        {
+            case draw_t::box_id:
+                data.DrawBox();
+                ++stat.draw_calls;
+            break;
+            case draw_t::levels_x_id:
+            case draw_t::levels_y_id:
+            case draw_t::levels_z_id:
+            {
+                stat.draw_calls+=data.Levels(draw.kind-draw_t::levels_x_id).DrawAll();
+            }
+            break;
+            case draw_t::trians_id:
+                data.DrawTrians(draw.use);
+                ++stat.draw_calls;
+            break;
+            case draw_t::edges_id:
+                data.DrawEdges(draw.use);
+                ++stat.draw_calls;
+            break;
+        }
+    }
+    glLineWidth(1);
+    for(auto&data:m_shader_data) data.FenceStreams();
+    if(instances) m_instances.Fence();
+}
 
-            data.DrawEdges(use_vertex|use_color);
+// Planes of the frustum of the full matrix (Gribb, Hartmann): the point p
+// is inside, if dot(plane,(p,1))>=0 for all of them
+
+static std::array<Eigen::Vector4f,6> FrustumPlanes(const Eigen::Matrix4f&mtx)
+{
+    std::array<Eigen::Vector4f,6> planes;
+    for(int i=0;i<3;++i)
+    {
+        planes[2*i]=(mtx.row(3)+mtx.row(i)).transpose();
+        planes[2*i+1]=(mtx.row(3)-mtx.row(i)).transpose();
+    }
+    return planes;
+}
+
+// The box, moved by 'transform', is entirely behind one of the planes.
+// The world box around the moved corners is tested by its corner,
+// which is the farthest along the normal of the plane
+
+static bool IsOutside(const std::array<Eigen::Vector4f,6>&planes,const CFunctionalMesh::box_t&box,
+                      const Eigen::Matrix4f&transform)
+{
+    Eigen::Vector3f min=Eigen::Vector3f::Constant(std::numeric_limits<float>::infinity());
+    Eigen::Vector3f max=-min;
+    for(int i=0;i<8;++i)
+    {
+        const Eigen::Vector3f corner(i&1? box.second[0]:box.first[0],
+                                     i&2? box.second[1]:box.first[1],
+                                     i&4? box.second[2]:box.first[2]);
+        const Eigen::Vector3f p=transform.topLeftCorner<3,3>()*corner+transform.topRightCorner<3,1>();
+        min=min.cwiseMin(p);
+        max=max.cwiseMax(p);
+    }
+    for(const auto&plane:planes)
+    {
+        const Eigen::Vector3f farthest(plane[0]>0? max[0]:min[0],
+                                       plane[1]>0? max[1]:min[1],
+                                       plane[2]>0? max[2]:min[2]);
+        if(plane.head<3>().dot(farthest)+plane[3]<0) return true;
+    }
+    return false;
+}
+
+void CScene::m_CountUpdate(unsigned index,float ms)const
+{
+    auto&state=m_update_states[index];
+    state.stat.cost_ms=state.measured? 0.75f*state.stat.cost_ms+0.25f*ms:ms;
+    state.measured=true;
+    ++state.window_updates;
+}
+
+// Synchronous update of the mesh, returns its time in ms
+
+float CScene::m_TimedUpdate(unsigned index,float t)const
+{
+    using clock=std::chrono::steady_clock;
+    const auto start=clock::now();
+    m_meshes[index]->UpdateData(t);
+    const float ms=std::chrono::duration<float,std::milli>(clock::now()-start).count();
+    m_CountUpdate(index,ms);
+    m_update_states[index].stat.skipped=0;
+    return ms;
+}
+
+// Asynchronous update of the mesh: the taken result is counted
+// with the time of its job, the next job is started, if 'start'
+
+void CScene::m_AsyncUpdate(unsigned index,float t,bool start)const
+{
+    CFunctionalMesh&mesh=*m_meshes[index];
+    if(mesh.UpdateDataAsync(t,start).UpdatePoints()) m_CountUpdate(index,mesh.AsyncUpdateTime());
+}
+
+// Priority of the update of the dynamic mesh under the budget: the weight
+// of the mesh, which grows with its angular size, and is small out of the view,
+// multiplied by the frames waited, so every mesh is updated at some rate
+
+float CScene::m_UpdatePriority(unsigned index,const std::array<Eigen::Vector4f,6>&frustum)const
+{
+    const CFunctionalMesh&mesh=*m_meshes[index];
+    const float waited=m_update_states[index].stat.skipped+1;
+    const auto*box=mesh.BoundedBox();
+    if(!box) return waited;
+    if(IsOutside(frustum,*box,mesh.GetTransform())) return 0.02f*waited;
+    const auto&transform=mesh.GetTransform();
+    const Eigen::Vector3f center=transform.topLeftCorner<3,3>()*(0.5f*(box->first+box->second))+
+                                 transform.topRightCorner<3,1>();
+    const float radius=0.5f*(box->second-box->first).norm();
+    const float distance=(center-m_camera.GetPosition()).norm();
+    // sine of the angular radius, 1 for the camera inside of the box
+    const float size=distance>radius? radius/distance:1.0f;
+    return std::isfinite(size)? (0.2f+size)*waited:waited;
+}
+
+// Updates of the frame: instances aren't updated, they draw the data of their
+// geometry, meshes evaluated on GPU are updated only at the changes of the grid
+// or traits. Under the budget the dynamic meshes are updated in the order
+// of priority, while their average costs fit, the first one always.
+// The jobs of asynchronous meshes are started in the same order, the meshes
+// with running jobs aren't scheduled.
+
+void CScene::m_UpdateMeshes(float t,const std::array<Eigen::Vector4f,6>&frustum)const
+{
+    CProfiler::CScope scope("Update");
+    using clock=std::chrono::steady_clock;
+    m_frame_programs.assign(m_meshes.size(),nullptr);
+    m_scheduled.clear();
+    float spent=0;
+    for(decltype(m_meshes.size()) i=0;i<m_meshes.size();++i)
+    {
+        CFunctionalMesh& mesh=*m_meshes[i];
+        if(mesh.Empty()||mesh.SharedGeometry()) continue;
+        m_frame_programs[i]=m_GpuProgram(mesh);
+        const bool scheduled=m_update_budget>0&&mesh.IsDynamic();
+        if(m_frame_programs[i]) mesh.UpdateData();
+        else if(m_async_update&&mesh.IsThreadSafeFunctors())
+        {
+            m_AsyncUpdate(i,t,!scheduled);
+            if(scheduled&&!mesh.IsUpdating()) m_scheduled.push_back({m_UpdatePriority(i,frustum),i});
         }
-        break;
+        else if(scheduled) m_scheduled.push_back({m_UpdatePriority(i,frustum),i});
+        else               spent+=m_TimedUpdate(i,t);
+    }
+    std::sort(m_scheduled.begin(),m_scheduled.end(),[](const auto&a,const auto&b){return a.first>b.first;});
+    // the times of the updates and the costs of the started jobs
+    float planned=spent;
+    for(std::size_t k=0;k<m_scheduled.size();++k)
+    {
+        const unsigned index=m_scheduled[k].second;
+        auto&state=m_update_states[index];
+        if(k&&planned+state.stat.cost_ms>m_update_budget)
+        {
+            ++state.stat.skipped;
+            ++m_render_stat.deferred_updates;
+            continue;
+        }
+        if(m_async_update&&m_meshes[index]->IsThreadSafeFunctors())
+        {
+            m_AsyncUpdate(index,t,true);
+            state.stat.skipped=0;
+            planned+=state.stat.cost_ms;
+            continue;
+        }
+        const float ms=m_TimedUpdate(index,t);
+        spent+=ms;
+        planned+=ms;
+    }
+    m_render_stat.update_ms=spent;
 
-        default:assert((param&1)==0);
+    // frequencies over the last second
+    const double now=std::chrono::duration<double>(clock::now().time_since_epoch()).count();
+    for(auto&state:m_update_states)
+    {
+        if(now-state.window_start<1.0) continue;
+        if(state.window_start>0) state.stat.frequency=state.window_updates/(now-state.window_start);
+        state.window_start=now;
+        state.window_updates=0;
     }
 }
 
+const CScene::update_stat_t& CScene::UpdateStat(const CFunctionalMesh&m)const
+{
+    assert(IsMesh(m));
+    return m_update_states[m.Index()].stat;
+}
+
+// With the profiler enabled the GPU time of the frame is measured, the times
+// are read frames later, when the GPU has finished them
 
 void CScene::Render(float t)const
+{
+    CProfiler::CScope scope("Render");
+    if(!CProfiler::IsEnabled())
+    {
+        m_gpu_timer.reset();
+        m_RenderFrame(t);
+        return;
+    }
+    auto&profiler=CProfiler::Instance();
+    if(!m_gpu_timer) m_gpu_timer=std::make_unique<CGpuTimer>();
+    for(auto[start_us,ms]:m_gpu_timer->Poll())
+    {
+        profiler.RecordGpu("GPU frame",start_us,ms*1000.0);
+        m_gpu_ms=ms;
+    }
+    const bool timed=m_gpu_timer->Begin(profiler.Microseconds(CProfiler::clock::now()));
+    m_RenderFrame(t);
+    if(timed) m_gpu_timer->End();
+}
+
+void CScene::m_RenderFrame(float t)const
 {
     glEnable(GL_DEPTH_TEST);
+    glEnable(GL_PRIMITIVE_RESTART);
+    glPrimitiveRestartIndex(restart_index);
     glDisable(GL_BLEND);
     glClear(GL_COLOR_BUFFER_BIT|GL_DEPTH_BUFFER_BIT);
 
-    if(m_meshes.empty()) return;
+    if(Empty()) return;
     const auto cam_matrix=m_camera.PerspectiveMatrix()*m_camera.ViewMatrix();
-    m_meshes_cashe.clear();
+    m_WriteFrameBlock();
+    for(decltype(m_implicit_meshes.size()) i=0;i<m_implicit_meshes.size();++i)
+    {
+        CImplicitMesh&mesh=*m_implicit_meshes[i];
+        if(mesh.Empty()) continue;
+        if(mesh.UpdateData()) m_UpdateImplicitData(mesh,m_implicit_data[i]);
+        if(!mesh.Transparency()) m_RenderImplicit(mesh,m_implicit_data[i],cam_matrix);
+    }
+    m_render_stat={};
+    const auto frustum=FrustumPlanes(cam_matrix);
+    m_UpdateMeshes(t,frustum);
+    // draws of all meshes are sorted by the state, which they require
+    m_draws.clear();
+    m_gpu_draws.clear();
+    m_frame_meshes.resize(m_meshes.size());
     for(decltype(m_meshes.size()) i=0;i<m_meshes.size();++i)
     {
-        if (m_meshes[i]->Empty()) continue;
-        CFunctionalMesh& mesh=*m_meshes[i];
-        CMeshShaderData& data=m_shader_data[i];
-        mesh.UpdateData(t);
-        if(m_meshes[i]->Transparency())
+        const int data_index=m_DataIndex(i);
+        if(data_index<0) continue;
+        // meshes out of the view aren't drawn, the box of the surface
+        // evaluated on GPU isn't of this moment
+        const auto*box=m_meshes[data_index]->BoundedBox();
+        if(m_frustum_culling&&box&&!m_frame_programs[data_index]&&
+           IsOutside(frustum,*box,m_meshes[i]->GetTransform()))
         {
-            m_meshes_cashe.push_back(i);
+            ++m_render_stat.culled_meshes;
             continue;
         }
-        m_RenderMesh(mesh,data,cam_matrix);// Draw only no transparency meshes
+        if(m_frame_programs[data_index]) m_gpu_draws.push_back({i,data_index});
+        else                             m_CollectDraws(i,data_index,cam_matrix);
+    }
+    {
+        CProfiler::CScope scope("Submit");
+        m_SubmitDraws(cam_matrix);
+        for(auto[index,data_index]:m_gpu_draws) m_RenderGpuSurface(index,data_index,cam_matrix,t);
+    }
+    auto transparent=[](const CImplicitMesh*mesh){return !mesh->Empty()&&mesh->Transparency();};
+    if(std::none_of(m_implicit_meshes.begin(),m_implicit_meshes.end(),transparent))
+    {
+        glDisable(GL_BLEND);
+        glDepthMask(GL_TRUE);
+        return;
     }
-    if(m_meshes_cashe.empty()) return;
 
-    // Draw transparency meshes
+    // Draw transparency implicit meshes
     glEnable(GL_BLEND);
     glDepthMask(GL_FALSE);
     glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-    for(auto index:m_meshes_cashe)
+    for(decltype(m_implicit_meshes.size()) i=0;i<m_implicit_meshes.size();++i)
     {
-        m_RenderMesh(*m_meshes[index],m_shader_data[index],cam_matrix);
+        if(transparent(m_implicit_meshes[i])) m_RenderImplicit(*m_implicit_meshes[i],m_implicit_data[i],cam_matrix);
     }
     glDisable(GL_BLEND);
     glDepthMask(GL_TRUE);
 }
 
+void CScene::m_RenderImplicit(const CImplicitMesh&mesh,CMeshShaderData&data,const Eigen::Matrix4f&cam_matrix)const
+{
+    CRenderingTraits traits=mesh.RenderingTraits();
+    if(!traits.IsSurface()||data.Trians().Empty()) return;
+    const float alpha=1.f-mesh.Transparency();
+    if(!traits.IsSpecularSurface())
+    {
+        m_vert.Use();
+        m_vert.full_matrix=cam_matrix;
+        m_vert.color=Eigen::Vector3f(0.5,0.5,0.5);
+        m_vert.alpha=alpha;
+
+        data.DrawTrians(CMeshShaderData::use_vertex);
+        return;
+    }
+    m_actual_specular->Use();
+    // Matrix
+    m_actual_specular->full_matrix=cam_matrix;
+    m_actual_specular->model_matrix4=Eigen::Matrix4f(Eigen::Matrix4f::Identity());
+    m_actual_specular->model_matrix3=Eigen::Matrix3f(Eigen::Matrix3f::Identity());
+
+    //material
+    auto&material=mesh.GetMaterial();
+    m_actual_specular->material_ambient=material.ambient;
+    m_actual_specular->material_diffuse=material.diffuse;
+    m_actual_specular->material_specular=material.specular;
+    m_actual_specular->material_shininess=material.shininess;
+    m_actual_specular->two_side_specular=traits.IsTwoSideSpecular();
+    m_actual_specular->oct_normals=0;
+    m_actual_specular->alpha=alpha;
+
+    data.DrawTrians(CMeshShaderData::use_vertex|CMeshShaderData::use_normal);
+}
+
+// Program of the GLSL surface of the mesh, nullptr, if the mesh is evaluated
+// on CPU: static, colored by the functor or the source isn't compiled
+
+const CScene::mesh_program_t*CScene::m_GpuProgram(const CFunctionalMesh&mesh)const
+{
+    if(!m_gpu_evaluation||mesh.GpuSurface().empty()||!mesh.IsDynamic()) return nullptr;
+    const CRenderingTraits traits=mesh.RenderingTraits();
+    if(traits.IsColored()&&!mesh.IsGpuPalette()) return nullptr;
+    // the box and the level lines are computed from the points on CPU
+    if(traits.IsBox()||traits.IsLevelLines(0)||traits.IsLevelLines(1)||traits.IsLevelLines(2)) return nullptr;
+    auto iter=m_gpu_programs.find(mesh.GpuSurface());
+    if(iter==m_gpu_programs.end())
+    {
+        // programs of the sources, which no mesh has any more, are freed
+        std::erase_if(m_gpu_programs,[this](const auto&item)
+        {
+            return std::none_of(m_meshes.begin(),m_meshes.end(),
+                                [&item](const CFunctionalMesh*m){return m->GpuSurface()==item.first;});
+        });
+        const std::string source="#version 330 core\n"+mesh.GpuSurface()+gpu_surface_shader;
+        CShaderBuildError error;
+        CShaderProgramm prog;
+        auto vertex=CShader::Compile(CShader::vertex,source,error);
+        if(!error)
+        {
+            prog=CShaderProgramm::Link(error,vertex,CShader::Compile(CShader::fragment,fragment_shader));
+        }
+        if(!error) prog.BindUniformBlock("frame_block",frame_block_binding);
+        else       prog=CShaderProgramm();
+        iter=m_gpu_programs.emplace(mesh.GpuSurface(),std::move(prog)).first;
+    }
+    return iter->second.Valid()? &iter->second:nullptr;
+}
+
+void CScene::m_RenderGpuSurface(unsigned index,unsigned data_index,const Eigen::Matrix4f&cam_matrix,float t)const
+{
+    const CFunctionalMesh&mesh=*m_meshes[index];
+    const CFunctionalMesh&geometry=*m_meshes[data_index];
+    CMeshShaderData&data=m_shader_data[data_index];
+    const mesh_program_t&prog=*m_frame_programs[data_index];
+    const CRenderingTraits traits=geometry.RenderingTraits();
+    const auto grid=geometry.GetGrid();
+    auto&stat=m_render_stat;
+
+    prog.Use();
+    ++stat.program_changes;
+    ++stat.gpu_meshes;
+    prog.full_matrix=Eigen::Matrix4f(cam_matrix*mesh.GetTransform());
+    prog.model_matrix4=mesh.GetTransform();
+    prog.model_matrix3=mesh.GetRotate();
+    prog.s_range=Eigen::Vector2f(grid.s_range.first,grid.s_range.second);
+    prog.t_range=Eigen::Vector2f(grid.t_range.first,grid.t_range.second);
+    prog.resolution=Eigen::Vector2i(grid.s_resolution,grid.t_resolution);
+    prog.time=t;
+
+    auto&material=mesh.GetMaterial();
+    prog.material_ambient=material.ambient;
+    prog.material_diffuse=material.diffuse;
+    prog.material_specular=material.specular;
+    prog.material_shininess=material.shininess;
+    prog.two_side_specular=traits.IsTwoSideSpecular();
+    // the palette spans the bounded box of the last update on CPU
+    if(traits.IsColored())
+    {
+        const auto&box=*geometry.BoundedBox();
+        data.SetPalette(geometry.Palette());
+        data.BindPalette(0);
+        prog.palette=0;
+        prog.palette_range=Eigen::Vector2f(box.first[2],box.second[2]);
+        ++stat.state_changes;
+    }
+    auto draw=[&](const CIndexBuffer&buff,CVao::mode_t mode,bool specular,bool colored,const point_t&color)
+    {
+        prog.specular=specular;
+        prog.palette_colors=colored;
+        prog.color=color;
+        SetRestartIndex(buff);
+        m_attributeless_vao.DrawElement(buff,mode);
+        ++stat.draw_calls;
+    };
+    if(traits.IsSurface())
+    {
+        draw(data.Trians(),data.TriansMode(),traits.IsSpecularSurface(),traits.IsColored(),point_t(0.5,0.5,0.5));
+    }
+    if(traits.IsMesh())
+    {
+        // black lines over the surface, white or colored lines otherwise
+        const bool surface=traits.IsSurface();
+        if(surface) glLineWidth(2);
+        draw(data.Edges(),CVao::line_strip,false,!surface&&traits.IsColored(),
+             surface? point_t(0,0,0):point_t(1,1,1));
+        if(surface) glLineWidth(1);
+    }
+}
+
+// std140 layout of frame_block: vec3 members are aligned to 16 bytes
+
+void CScene::m_WriteFrameBlock()const
+{
+    std::array<float,20> block={};
+    const Eigen::Vector3f*members[5]={&m_light_source.Position(),&m_light_source.Ambient(),
+                                      &m_light_source.Diffuse(),&m_light_source.Specular(),
+                                      &m_camera.GetPosition()};
+    for(int i=0;i<5;++i)
+    {
+        for(int k=0;k<3;++k) block[4*i+k]=(*members[i])[k];
+    }
+    m_frame_block.Write(block,CUniformBuffer::dynamic_draw);
+    m_frame_block.BindBase(frame_block_binding);
+}
+
 void CScene::SetFongShading(bool is_fong)
 {
     if(is_fong)
@@ -649,10 +1777,13 @@ void CScene::SetFongShading(bool is_fong)
 
 void CScene::Clear()
 {
-    while(!Empty())
+    while(!m_meshes.empty())
     {
         RemoveMesh(*m_meshes.back());
     }
+    m_implicit_meshes.clear();
+    m_implicit_data.clear();
+    m_gpu_programs.clear();
 }
 
 
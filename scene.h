@@ -4,13 +4,20 @@
 
 #include <iostream>
 #include <vector>
+#include <array>
+#include <map>
+#include <memory>
 
 #include "functional_mesh.h"
+#include "implicit_mesh.h"
 #include "light_source.h"
 #include "view_ruling.h"
 
 #include "Shaders/vao_managment.h"
+#include "Shaders/texture.h"
+#include "Shaders/stream_buffer.h"
 #include "Shaders/shader_programm.h"
+#include "Shaders/gpu_timer.h"
 
 
 class CMeshShaderData
@@ -18,42 +25,96 @@ class CMeshShaderData
     public:
     struct levels_t
     {
+        // polylines of all levels of the axis one after another in one buffer,
+        // drawn as line strips by one call, m_first and m_count are the offsets
+        // and the sizes of the polylines in the buffer
         CVao                 m_vao;
-        std::vector<CBuffer> m_lines;
-        void clear(){m_lines.clear();}
-        CBuffer& push_back()
+        CBuffer              m_buffer=CBuffer(float{0});
+        std::vector<GLint>   m_first;
+        std::vector<GLsizei> m_count;
+        levels_t(){m_vao.EnableLayout(0,m_buffer,CBufferFormat::Solid(3));}
+        void clear()
         {
-            m_lines.push_back(CBuffer(float{0}));
-            return m_lines.back();
+            m_first.clear();
+            m_count.clear();
         }
-        auto Size()const{return m_lines.size();}
-        CBuffer&Buffer(int i){ return m_lines[i];}
-        void DrawAll()
+        bool Empty()const{return m_count.empty();}
+        // returns the number of draw calls
+        std::size_t DrawAll()const
         {
-            for(auto&line:m_lines)
-            {
-                m_vao.EnableLayout(0,line,CBufferFormat::Solid(3));
-                m_vao.DrawArraw(CVao::lines,0 ,line.Size());
-            }
+            if(Empty()) return 0;
+            m_vao.MultiDrawArrays(CVao::line_strip,m_first.data(),m_count.data(),m_count.size());
+            return 1;
         }
         void Swap(levels_t&other)
         {
             m_vao.Swap(other.m_vao);
-            m_lines.swap(other.m_lines);
+            m_buffer.Swap(other.m_buffer);
+            m_first.swap(other.m_first);
+            m_count.swap(other.m_count);
         }
     };
+    // Index buffers of the surface and of the mesh lines
+    struct indices_t
+    {
+        CIndexBuffer m_edges=CIndexBuffer(unsigned{0});
+        CIndexBuffer m_triangles=CIndexBuffer(unsigned{0});
+        // strips with restart index for the entire grid
+        CVao::mode_t m_triangles_mode=CVao::triangles;
+    };
+    // Bytes of vertex, color and normal buffers in use
+    struct memory_t
+    {
+        std::size_t gpu_bytes=0;
+        std::size_t float_gpu_bytes=0;// the same attributes in floats
+        std::size_t released_bytes=0;// CPU copies, released by the mesh
+        std::size_t index_bytes=0;// drawn index buffers, may be shared
+        std::size_t stream_bytes=0;// all parts of the streams of dynamic mesh
+        std::size_t Saved()const{return float_gpu_bytes-gpu_bytes+released_bytes;}
+    };
     private:
     CBuffer      m_box_vertex_buffer;
     CBuffer      m_vertex_buffer;
     CBuffer      m_color_buffer;
     CBuffer      m_normals_buffer;
-    CIndexBuffer m_edges;
-    CIndexBuffer m_triangles;
+    // vertex, colors and normals of dynamic meshes, rewritten for every frame
+    // instead of the buffers above
+    CStreamBuffer m_streams[3];
+    bool         m_streaming=false;
+    // handlers and offsets of the streams, when the layouts were enabled
+    std::array<std::pair<GLuint,std::size_t>,3> m_stream_parts={};
+    // attributes in the vertex buffer (use_enum), 0 for separate buffers
+    int          m_interleaved=0;
+    // shared by the meshes with the same grid, if all samples are valid
+    std::shared_ptr<indices_t> m_indices;
+    bool         m_shared_indices=false;
 
     levels_t     m_levels[3];
     CVao         m_vao[4];
     CVao         m_box_vao;
 
+    // Lean format: positions in half floats or in unsigned shorts inside
+    // of the bounded box, which are restored by m_decode, RGBA8 colors,
+    // octahedral normals
+    using positions_t=CFunctionalMesh::positions_t;
+    bool            m_lean=false;
+    positions_t     m_positions=CFunctionalMesh::float_positions_id;
+    Eigen::Matrix4f m_decode=Eigen::Matrix4f::Identity();
+    // types of buffers, when the layouts were enabled
+    std::array<GLenum,3> m_layout_types={GL_FLOAT,GL_FLOAT,GL_FLOAT};
+    bool            m_layout_dirty=false;
+    memory_t        m_memory;
+
+    // height colors: palette texture, its colors, and the heights
+    // of the bottom and the top of the bounded box in the vertex buffer
+    CTexture1D      m_palette;
+    std::vector<Eigen::Vector3f> m_palette_colors;
+    Eigen::Vector2f m_palette_range={0.0f,1.0f};
+
+    void  m_EnableLayouts();
+    void  m_EnableInstances(const CVao&,const CStreamBuffer&,std::size_t first)const;
+    void  m_DisableInstances(const CVao&)const;
+
     public:
     enum use_enum{use_vertex=1<<0,use_color=1<<1,use_normal=1<<2};
 
@@ -64,41 +125,204 @@ class CMeshShaderData
     CBuffer&BoxVertex(){return m_box_vertex_buffer;}
     CBuffer&Colors(){return m_color_buffer;}
     CBuffer&Normals(){return m_normals_buffer;}
-    CIndexBuffer&Edges(){return m_edges;}
-    CIndexBuffer&Trians(){return m_triangles;}
+    CStreamBuffer&StreamVertex(){return m_streams[0];}
+    CStreamBuffer&StreamColors(){return m_streams[1];}
+    CStreamBuffer&StreamNormals(){return m_streams[2];}
+    const CIndexBuffer&Edges()const{return m_indices->m_edges;}
+    const CIndexBuffer&Trians()const{return m_indices->m_triangles;}
+    CVao::mode_t TriansMode()const{return m_indices->m_triangles_mode;}
+    // Buffers of the grid, which aren't written by this mesh
+    void  SetSharedIndices(std::shared_ptr<indices_t>);
+    // Buffers of this mesh only, for writing
+    indices_t&UniqueIndices();
     levels_t&    Levels(int i){return m_levels[i];}
 
+    // Buffers must be written again in the new format
+    void  SetLean(bool lean,positions_t positions);
+    bool  IsLean()const{return m_lean;}
+    positions_t PositionsFormat()const{return m_positions;}
+    void  SetDecodeBox(const Eigen::Vector3f&min,const Eigen::Vector3f&max);
+    const Eigen::Matrix4f&DecodeMatrix()const{return m_decode;}
+    // The layouts refer to the streams, the storage of the other kind is released
+    void  SetStreaming(bool);
+    bool  IsStreaming()const{return m_streaming;}
+    // The attributes, which are interleaved in the vertex buffer or stream,
+    // other buffers are released, 0 returns to separate buffers
+    void  SetInterleaved(int attributes);
+    int   InterleavedAttributes()const{return m_interleaved;}
+    bool  IsInterleaved()const{return m_interleaved!=0;}
+    // floats per vertex
+    std::size_t InterleavedStep()const;
+    // The written parts of the streams are read by the draws before
+    void  FenceStreams();
+    // Enable the layouts again, if the buffers are written in other types
+    // or the streams are written
+    void  UpdateLayouts();
+    // The texture is written again, only if the colors are changed
+    void  SetPalette(const std::vector<Eigen::Vector3f>&);
+    void  SetPaletteRange(float bottom,float top){m_palette_range={bottom,top};}
+    const Eigen::Vector2f&PaletteRange()const{return m_palette_range;}
+    void  BindPalette(GLuint unit)const{m_palette.Bind(unit);}
+    // Color buffer isn't required with the palette
+    void  ReleaseColors();
+    memory_t&Memory(){return m_memory;}
+    const memory_t&Memory()const{return m_memory;}
+
     void  DrawEdges(int)const;
     void  DrawTrians(int)const;
     void  DrawBox()const;
+    // Instances [first,first+count) of 'instances', each of 'instance_floats':
+    // the transform (column-major 4x4) and the material (ambient, diffuse,
+    // specular, shininess), which are read by the layouts 3-6 and 7
+    static const std::size_t instance_floats=20;
+    void  DrawEdgesInstanced(int,const CStreamBuffer&instances,std::size_t first,std::size_t count)const;
+    void  DrawTriansInstanced(int,const CStreamBuffer&instances,std::size_t first,std::size_t count)const;
 };
 
 class CScene
 {
+    public:
+    // Counters of the last frame of functional meshes
+    struct render_stat_t
+    {
+        std::size_t draw_calls=0;
+        std::size_t program_changes=0;
+        std::size_t state_changes=0;// line width, blending, palette texture
+        std::size_t instances=0;// draws merged into instanced draw calls
+        std::size_t gpu_meshes=0;// meshes evaluated in the vertex shader
+        std::size_t culled_meshes=0;// meshes out of the view, which aren't drawn
+        std::size_t deferred_updates=0;// dynamic meshes left for the next frames
+        float       update_ms=0;// synchronous updates of the meshes
+    };
+    // Updates of the mesh
+    struct update_stat_t
+    {
+        float       cost_ms=0;// running average of the update time, of the job for async one
+        float       frequency=0;// updates per second, over the last second
+        std::size_t skipped=0;// frames in a row without update under the budget
+    };
+    private:
     using point_t=Eigen::Vector3f;
+    // One draw of the frame. The key orders the draws by blending,
+    // surfaces before lines, program and line width, then by the drawn data,
+    // so the instances of one geometry are adjacent
+    struct draw_t
+    {
+        enum kind_t:std::uint8_t{box_id,levels_x_id,levels_y_id,levels_z_id,trians_id,edges_id};
+        enum program_t:std::uint8_t{vert_id,colored_id,specular_id,colored_specular_id};
+        std::uint64_t key;
+        unsigned      mesh;// transform and material
+        unsigned      data;// buffers, the geometry of the instance
+        kind_t        kind;
+        program_t     program;
+        int           use;// attributes of CMeshShaderData
+        float         line_width;
+        point_t       color;// of m_vert
+    };
+    struct frame_mesh_t
+    {
+        Eigen::Matrix4f full,vertex,model;
+    };
 
     mutable std::vector<float>    m_floats_cashe;
     mutable std::vector<unsigned> m_ints_cashe;
-    mutable std::vector<unsigned> m_meshes_cashe;
+    // quantized attributes of lean meshes
+    mutable std::vector<half_t>   m_halfs_cashe;
+    mutable std::vector<GLushort> m_ushorts_cashe;
+    mutable std::vector<GLshort>  m_shorts_cashe;
+    mutable std::vector<GLubyte>  m_bytes_cashe;
 
     std::vector<CFunctionalMesh*>   m_meshes;
     mutable std::vector<CMeshShaderData>    m_shader_data;
+    std::vector<CImplicitMesh*>     m_implicit_meshes;
+    mutable std::vector<CMeshShaderData>    m_implicit_data;
+    // index buffers of the grids by (rows,cols), they are alive,
+    // while some mesh without invalid samples uses them
+    std::map<std::pair<int,int>,std::weak_ptr<CMeshShaderData::indices_t>> m_grid_indices;
     CLightSource m_light_source;
     CMoveableCamera m_camera;
 
+    // Program of meshes with the handles of its uniforms, resolved once
+    // after the link, the uniforms, which the program hasn't, are -1.
+    // Values are written through the handles, which aren't changed by it.
+    struct mesh_program_t:CShaderProgramm
+    {
+        mutable uniform_value<mat4>  full_matrix,model_matrix4,camera_matrix,decode_matrix;
+        mutable uniform_value<mat3>  model_matrix3;
+        mutable uniform_value<vec3>  color;
+        mutable uniform_value<vec2>  palette_range,s_range,t_range;
+        mutable uniform_value<ivec2> resolution;
+        mutable uniform_value<float> alpha,material_ambient,material_diffuse,material_specular,
+                                     material_shininess,shininess,time;
+        mutable uniform_value<int>   two_side_specular,oct_normals,instanced,palette,palette_colors,specular;
+        mesh_program_t(){}
+        mesh_program_t(CShaderProgramm&&prog);
+    };
     // Shaders programms
-    CShaderProgramm m_vert;
-    CShaderProgramm m_colored_prog;
-    CShaderProgramm m_specular_prog;
-    CShaderProgramm m_specular_colored_prog;
+    mesh_program_t m_vert;
+    mesh_program_t m_colored_prog;
+    mesh_program_t m_specular_prog;
+    mesh_program_t m_specular_colored_prog;
 
-    CShaderProgramm m_fong_shading;
-    CShaderProgramm m_colored_fong_shading;
-    CShaderProgramm*m_actual_specular;
-    CShaderProgramm*m_actual_colored_specular;
+    mesh_program_t m_fong_shading;
+    mesh_program_t m_colored_fong_shading;
+    mesh_program_t*m_actual_specular;
+    mesh_program_t*m_actual_colored_specular;
+    // light source and camera position of all programs
+    static const GLuint frame_block_binding=0;
+    mutable CUniformBuffer m_frame_block=CUniformBuffer(float{0});
+    bool m_async_update=false;
+    bool m_interleaved=false;
+    bool m_sorted_draws=true;
+    bool m_instancing=true;
+    bool m_frustum_culling=true;
+    // transforms and materials of the instanced draws of the frame
+    mutable CStreamBuffer             m_instances;
+    mutable std::vector<std::pair<std::size_t,std::size_t>> m_instance_runs;
+    mutable std::vector<draw_t>       m_draws;
+    mutable std::vector<frame_mesh_t> m_frame_meshes;
+    mutable render_stat_t             m_render_stat;
+    struct update_state_t
+    {
+        update_stat_t stat;
+        bool          measured=false;
+        double        window_start=0;// seconds of steady clock
+        unsigned      window_updates=0;
+    };
+    // CPU time of the updates of dynamic meshes per frame in ms, 0 for unlimited
+    float m_update_budget=0;
+    mutable std::vector<update_state_t> m_update_states;
+    // priorities and indices of the dynamic meshes of the frame
+    mutable std::vector<std::pair<float,unsigned>> m_scheduled;
+    // programs of the GLSL surfaces by their sources, invalid for the sources,
+    // which aren't compiled, and the program of every mesh in the frame,
+    // nullptr for the meshes evaluated on CPU
+    bool m_gpu_evaluation=true;
+    mutable std::map<std::string,mesh_program_t,std::less<>> m_gpu_programs;
+    mutable std::vector<const mesh_program_t*> m_frame_programs;
+    mutable std::vector<std::pair<unsigned,unsigned>> m_gpu_draws;
+    // the vertices of GLSL surfaces have no attributes
+    CVao m_attributeless_vao;
+    // GPU time of the frames, while the profiler is enabled
+    mutable std::unique_ptr<CGpuTimer> m_gpu_timer;
+    mutable float m_gpu_ms=0;
 
+    std::shared_ptr<CMeshShaderData::indices_t> m_GridIndices(int rows,int cols);
+    void m_WriteFrameBlock()const;
     void m_UpdateMeshData(const CFunctionalMesh&mesh,size_t index,CFunctionalMesh::CUpdateResult up_result);
-    void m_RenderMesh(const CFunctionalMesh&mesh,CMeshShaderData&data,const Eigen::Matrix4f&full_mtx)const;
+    int  m_DataIndex(unsigned index)const;
+    void m_CollectDraws(unsigned index,unsigned data_index,const Eigen::Matrix4f&cam_matrix)const;
+    void m_SubmitDraws(const Eigen::Matrix4f&cam_matrix)const;
+    void  m_CountUpdate(unsigned index,float ms)const;
+    float m_TimedUpdate(unsigned index,float t)const;
+    void  m_AsyncUpdate(unsigned index,float t,bool start)const;
+    float m_UpdatePriority(unsigned index,const std::array<Eigen::Vector4f,6>&frustum)const;
+    void  m_UpdateMeshes(float t,const std::array<Eigen::Vector4f,6>&frustum)const;
+    const mesh_program_t*m_GpuProgram(const CFunctionalMesh&mesh)const;
+    void m_RenderGpuSurface(unsigned index,unsigned data_index,const Eigen::Matrix4f&cam_matrix,float t)const;
+    void m_RenderFrame(float t)const;
+    void m_UpdateImplicitData(const CImplicitMesh&mesh,CMeshShaderData&data)const;
+    void m_RenderImplicit(const CImplicitMesh&mesh,CMeshShaderData&data,const Eigen::Matrix4f&full_mtx)const;
 
     public:
     CScene();
@@ -108,15 +332,56 @@ class CScene
     bool AddMesh(CFunctionalMesh&m);
     bool RemoveMesh(CFunctionalMesh&m);
     bool IsMesh(const CFunctionalMesh&m)const;
+    // GPU bytes of the mesh and bytes saved by the lean memory mode
+    const CMeshShaderData::memory_t& MemoryUsage(const CFunctionalMesh&m)const;
+    bool AddMesh(CImplicitMesh&m);
+    bool RemoveMesh(CImplicitMesh&m);
     auto Meshes()const{return m_meshes.size();}
+    // Number of distinct grids, whose index buffers are shared
+    std::size_t SharedGrids()const;
     CLightSource&LightSource(){return m_light_source;}
     const CLightSource&LightSource()const{return m_light_source;}
     void  LegacyRender(float t)const;
     void  Render(float t)const;
     void SetFongShading(bool);
     bool IsFongShading()const{return m_actual_specular==&m_fong_shading;}
+    // Meshes with thread safe functors are recomputed in background,
+    // the previous data is drawn meanwhile
+    void SetAsyncUpdate(bool async){m_async_update=async;}
+    bool IsAsyncUpdate()const{return m_async_update;}
+    // Position, color and normal of each vertex are interleaved
+    // in one buffer of the mesh, lean meshes aren't affected
+    void SetInterleaved(bool);
+    bool IsInterleaved()const{return m_interleaved;}
+    // Draws are sorted by the state, the order of meshes is kept otherwise
+    void SetSortedDraws(bool sorted){m_sorted_draws=sorted;}
+    bool IsSortedDraws()const{return m_sorted_draws;}
+    // Equal draws of the instances of one geometry (SetSharedGeometry)
+    // with equal transparency are merged into one instanced draw call
+    void SetInstancing(bool instancing){m_instancing=instancing;}
+    bool IsInstancing()const{return m_instancing;}
+    // Dynamic meshes with GLSL surface (CFunctionalMesh::SetGpuSurface) are
+    // evaluated in the vertex shader, if they are colored by the GPU palette
+    // or aren't colored: the points and the normals aren't computed and
+    // uploaded for every frame. The box and the level lines aren't drawn.
+    void SetGpuEvaluation(bool gpu){m_gpu_evaluation=gpu;}
+    bool IsGpuEvaluation()const{return m_gpu_evaluation;}
+    // CPU time in ms for the updates of dynamic meshes per frame, 0 for unlimited,
+    // the asynchronous jobs are counted by their average times at the start.
+    // Visible and large meshes are updated first, the others are drawn
+    // with their previous data and are updated at reduced rates.
+    void  SetUpdateBudget(float ms){m_update_budget=ms;}
+    float UpdateBudget()const{return m_update_budget;}
+    const update_stat_t& UpdateStat(const CFunctionalMesh&)const;
+    // Meshes, whose moved bounded boxes are out of the view frustum
+    // of the camera, aren't drawn
+    void SetFrustumCulling(bool culling){m_frustum_culling=culling;}
+    bool IsFrustumCulling()const{return m_frustum_culling;}
+    const render_stat_t&RenderStat()const{return m_render_stat;}
+    // the latest measured GPU time of the frame in ms, with the profiler enabled
+    float GpuTime()const{return m_gpu_ms;}
 
-    bool Empty()const{return m_meshes.empty();}
+    bool Empty()const{return m_meshes.empty()&&m_implicit_meshes.empty();}
     void Clear();
 };
 
@@ -14,11 +14,13 @@
 #include "plot_2D_opengl.h"
 #include "plot_2D_qt.h"
 #include "view_widget.h"
+#include "profiler.h"
 
 #include <QtCore>
 #include <QKeyEvent>
 
 CFunctionalMesh glMesh;
+CImplicitMesh glImplicitMesh;
 static QTime glTime;
 
 static float Now()
@@ -54,7 +56,11 @@ void CSceneViewer::initializeGL()
   }
 
   m_scene=std::make_unique<CScene>();
+  m_scene->SetAsyncUpdate(true);
+  // half of the frame at 60 Hz
+  m_scene->SetUpdateBudget(8);
   m_scene->AddMesh(glMesh);
+  m_scene->AddMesh(glImplicitMesh);
 }
 
 void CSceneViewer::paintGL()
@@ -64,6 +70,7 @@ void CSceneViewer::paintGL()
   m_scene->Render(Now());
 
   swapBuffers();
+  if(CProfiler::IsEnabled()) CProfiler::Instance().EndFrame();
 }
 
 float   CSceneViewer::MoveVelocity()const
@@ -98,6 +105,7 @@ void CViewWidget::m_slotForUpdate()
   if(m_view==ogl_view_id)
   {
       m_scene_viewer->paintGL();
+      if(CProfiler::IsEnabled()) m_statusbar->setText(QString::fromStdString(CProfiler::Instance().Summary()));
   }
   else
   {
@@ -230,6 +238,7 @@ void CViewWidget::SwitchTo2D()
 {
   if(m_view==qt_view_id) return;
   glMesh.Clear();
+  glImplicitMesh.Clear();
   m_scene_viewer->hide();
   m_view=qt_view_id;
   setMouseTracking(true);
@@ -239,4 +248,5 @@ void CViewWidget::Clear()
 {
   m_plot.Clear();
   glMesh.Clear();
+  glImplicitMesh.Clear();
 }